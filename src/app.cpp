@@ -2,11 +2,19 @@
 #include <SDL2/SDL.h>
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_sdl.h>
+#include <sf_libs/stb_image_write.h>
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <sstream>
 
 #include "app.h"
 #include "geometry/util.h"
 #include "platform/platform.h"
+#include "platform/ipc.h"
 #include "scene/renderer.h"
+#include "util/json.h"
 
 App::App(Settings set, Platform* plt)
     : window_dim(plt ? plt->window_draw() : Vec2{1.0f}),
@@ -18,11 +26,17 @@ App::App(Settings set, Platform* plt)
     std::string err;
     bool loaded_scene = true;
 
+    if(set.headless && !set.jobs.empty()) {
+        err = run_jobs(set);
+        if(!err.empty()) warn("Error running jobs: %s", err.c_str());
+        return;
+    }
+
     if(!set.scene_file.empty()) {
         info("Loading scene file...");
         Scene::Load_Opts opts;
         opts.new_scene = true;
-        err = scene.load(opts, undo, gui, set.scene_file);
+        err = gui.load_file(scene, undo, opts, set.scene_file);
         gui.set_file(set.scene_file);
     }
 
@@ -41,12 +55,13 @@ App::App(Settings set, Platform* plt)
         GL::global_params();
         Renderer::setup(window_dim);
         apply_window_dim(plt->window_draw());
+    } else if(!set.serve.empty()) {
+        err = serve(set, loaded_scene && !set.scene_file.empty());
+        if(!err.empty()) warn("Error serving renders: %s", err.c_str());
     } else if(loaded_scene) {
 
         info("Rendering scene...");
-        err = gui.get_render().headless_render(gui.get_animate(), scene, set.output_file,
-                                               set.animate, set.w, set.h, set.s, set.ls, set.d,
-                                               set.exp, set.w_from_ar);
+        err = gui.get_render().headless_render(gui.get_animate(), scene, set);
 
         if(!err.empty())
             warn("Error rendering scene: %s", err.c_str());
@@ -57,6 +72,312 @@ App::App(Settings set, Platform* plt)
     }
 }
 
+static bool json_vec3(const Json* j, Vec3& out) {
+    if(!j || j->type != Json::Type::array || j->array.size() != 3) return false;
+    for(int i = 0; i < 3; i++) {
+        if(j->array[i].type != Json::Type::number) return false;
+        out[i] = (float)j->array[i].number;
+    }
+    return true;
+}
+
+// Renders every job in set.jobs, a JSON file like
+//   {"jobs": [{"scene": "a.dae", "output": "a.png", "time": 12, "samples": 64},
+//             {"output": "b.png", "camera": {"position": [0, 1, 4], "center": [0, 0, 0]}}]}
+// Jobs may also set width, height, area_samples, depth and exposure, and the
+// camera's fov, aperture and focal_dist. Whatever they leave out comes from the
+// command line. The camera is the scene's, or the animation's at "time".
+// Jobs on the same scene run together, so it's loaded and built only once.
+// Those without a time go first, while the scene is still as loaded.
+std::string App::run_jobs(const Settings& set) {
+
+    std::ifstream file(set.jobs);
+    if(!file) return "Failed to open " + set.jobs + ".";
+    std::stringstream text;
+    text << file.rdbuf();
+
+    Json root;
+    std::string err = Json::parse(text.str(), root);
+    if(!err.empty()) return set.jobs + ": " + err;
+
+    const Json* list = root.type == Json::Type::array ? &root : root.find("jobs");
+    if(!list || list->type != Json::Type::array) return "Expected a list of jobs.";
+    if(set.animate || set.tracer.tile_size || !set.tracer.checkpoint.empty() ||
+       set.farm.coordinate || !set.farm.worker.empty())
+        return "Jobs are plain stills: no animation, tiles, checkpoints, or workers.";
+    if(Image_Encoder::is_stream(set.encoder.format)) return "Jobs need an image format.";
+
+    std::vector<std::string> scenes;
+    std::vector<std::pair<size_t, const Json*>> jobs;
+    for(const Json& job : list->array) {
+        std::string file = job.get("scene", set.scene_file);
+        if(file.empty()) return "Job " + std::to_string(jobs.size()) + " has no scene.";
+        if(job.get("output", "").empty())
+            return "Job " + std::to_string(jobs.size()) + " has no output.";
+        size_t group = std::find(scenes.begin(), scenes.end(), file) - scenes.begin();
+        if(group == scenes.size()) scenes.push_back(file);
+        jobs.push_back({group, &job});
+    }
+    auto timed = [](const Json* job) {
+        const Json* time = job->find("time");
+        return time && time->type == Json::Type::number;
+    };
+    std::stable_sort(jobs.begin(), jobs.end(), [&](const auto& a, const auto& b) {
+        return std::make_pair(a.first, timed(a.second)) < std::make_pair(b.first, timed(b.second));
+    });
+
+    Gui::Render& render = gui.get_render();
+    Image_Encoder encoder(set.encoder);
+    size_t loaded = scenes.size();
+    bool built = false;
+    std::optional<double> posed_at; // unset while the scene is as loaded
+
+    for(size_t i = 0; i < jobs.size(); i++) {
+
+        auto [group, job] = jobs[i];
+        info("Job %zu of %zu: %s", i + 1, jobs.size(), job->get("output", "").c_str());
+
+        if(group != loaded) {
+            Scene::Load_Opts opts;
+            opts.new_scene = true;
+            opts.editable = false;
+            err = gui.load_file(scene, undo, opts, scenes[group]);
+            if(!err.empty()) return "Failed to load " + scenes[group] + ": " + err;
+            if(!set.env_map_file.empty()) {
+                err = scene.set_env_map(set.env_map_file);
+                if(!err.empty()) warn("Error loading environment map: %s", err.c_str());
+            }
+            gui.set_file(scenes[group]);
+            loaded = group;
+            built = false;
+            posed_at.reset();
+        }
+
+        Gui::Render_Job r;
+        r.output = job->get("output", "");
+        r.w = (int)job->get("width", (double)set.w);
+        r.h = (int)job->get("height", (double)set.h);
+        r.s = (int)job->get("samples", (double)set.s);
+        r.ls = (int)job->get("area_samples", (double)set.ls);
+        r.d = (int)job->get("depth", (double)set.d);
+        r.exp = (float)job->get("exposure", (double)set.exp);
+        if(r.w <= 0 || r.h <= 0 || r.s <= 0) return "Job " + r.output + " has nothing to render.";
+
+        // Animated objects move with the camera, so another time is another BVH
+        bool rebuild = !built;
+        r.camera = render.get_cam();
+        const Json* time = job->find("time");
+        if(time && time->type == Json::Type::number) {
+            r.camera = gui.get_animate().set_time(scene, (float)time->number);
+            rebuild = rebuild || posed_at != time->number;
+            posed_at = time->number;
+        }
+
+        if(const Json* cam = job->find("camera")) {
+            Vec3 pos = r.camera.pos(), center = r.camera.center();
+            json_vec3(cam->find("position"), pos);
+            json_vec3(cam->find("center"), center);
+            r.camera.look_at(center, pos);
+            r.camera.set_fov((float)cam->get("fov", (double)r.camera.get_fov()));
+            r.camera.set_ap((float)cam->get("aperture", (double)r.camera.get_ap()));
+            r.camera.set_dist((float)cam->get("focal_dist", (double)r.camera.get_dist()));
+        }
+        r.camera.set_ar((float)r.w / (float)r.h);
+
+        err = render.render_job(scene, r, rebuild, set.aovs, set.tracer, encoder);
+        if(!err.empty()) return err;
+        built = true;
+
+        auto [build, trace] = render.completion_time();
+        info("Built scene in %.2fs, rendered in %.2fs", build, trace);
+    }
+    return encoder.finish();
+}
+
+static bool read_line(Socket& s, std::string& line) {
+    line.clear();
+    char c;
+    while(s.recv(&c, 1)) {
+        if(c == '\n') return true;
+        if(c != '\r') line += c;
+        if(line.size() > 4096) return false;
+    }
+    return false;
+}
+
+// Keeps scenes in memory and renders them for local clients connecting to
+// set.serve, a UNIX socket path. Requests are one line each:
+//   load <scene file>    time <t>       camera <px py pz cx cy cz> [fov]
+//   size <w> <h>         samples <n>    exposure <e>
+//   render               cancel         progress
+//   image                save <file>    quit
+// and get a line back: "ok", with any results, or "error" and why. After
+// "ok <bytes>", image sends that many bytes of PNG. Renders run in the
+// background, so clients can poll progress and fetch the image so far. Only
+// loading a scene or changing the time rebuilds the BVH; moving the camera
+// or changing settings starts the next render right away.
+std::string App::serve(const Settings& set, bool loaded) {
+
+    if(set.tracer.tile_size || !set.tracer.checkpoint.empty())
+        return "The render service doesn't support tiles or checkpoints.";
+
+    Socket server;
+    std::string err = server.listen_local(set.serve);
+    if(!err.empty()) return err;
+    info("Serving renders at %s.", set.serve.c_str());
+
+    Gui::Render& render = gui.get_render();
+    PT::Pathtracer& tracer = render.tracer();
+    Gui::Render_Job job;
+    job.camera = render.get_cam();
+    job.w = set.w;
+    job.h = set.h;
+    job.s = set.s;
+    job.ls = set.ls;
+    job.d = set.d;
+    job.exp = set.exp;
+    bool built = false, quit = false;
+
+    auto current_image = [&]() {
+        return tracer.in_progress() ? tracer.preview() : tracer.get_output().copy();
+    };
+
+    auto handle = [&](const std::string& line, std::string& payload) -> std::string {
+
+        std::istringstream in(line);
+        std::string cmd;
+        in >> cmd;
+
+        if(cmd == "load") {
+            std::string file;
+            std::getline(in >> std::ws, file);
+            tracer.cancel();
+            Scene::Load_Opts opts;
+            opts.new_scene = true;
+            opts.editable = false;
+            std::string e = gui.load_file(scene, undo, opts, file);
+            if(!e.empty()) {
+                loaded = false;
+                return "error " + e;
+            }
+            if(!set.env_map_file.empty()) scene.set_env_map(set.env_map_file);
+            gui.set_file(file);
+            job.camera = render.get_cam();
+            loaded = true;
+            built = false;
+            return "ok";
+        }
+        if(cmd == "time") {
+            float t;
+            if(!(in >> t)) return "error time takes a frame number";
+            if(!loaded) return "error no scene loaded";
+            job.camera = gui.get_animate().set_time(scene, t);
+            built = false;
+            return "ok";
+        }
+        if(cmd == "camera") {
+            Vec3 pos, center;
+            if(!(in >> pos.x >> pos.y >> pos.z >> center.x >> center.y >> center.z))
+                return "error camera takes px py pz cx cy cz [fov]";
+            job.camera.look_at(center, pos);
+            float fov;
+            if(in >> fov) job.camera.set_fov(fov);
+            return "ok";
+        }
+        if(cmd == "size") {
+            int w, h;
+            if(!(in >> w >> h) || w <= 0 || h <= 0) return "error size takes a width and height";
+            job.w = w;
+            job.h = h;
+            return "ok";
+        }
+        if(cmd == "samples") {
+            int s;
+            if(!(in >> s) || s <= 0) return "error samples takes a positive count";
+            job.s = s;
+            return "ok";
+        }
+        if(cmd == "exposure") {
+            float e;
+            if(!(in >> e)) return "error exposure takes a number";
+            job.exp = e;
+            return "ok";
+        }
+        if(cmd == "render") {
+            if(!loaded) return "error no scene loaded";
+            job.camera.set_ar((float)job.w / (float)job.h);
+            render.begin_job(scene, job, !built, set.tracer);
+            built = true;
+            return "ok";
+        }
+        if(cmd == "cancel") {
+            tracer.cancel();
+            return "ok";
+        }
+        if(cmd == "progress") {
+            if(tracer.in_progress()) return "ok " + std::to_string(tracer.progress()) + " rendering";
+            return "ok 1 idle";
+        }
+        if(cmd == "image") {
+            HDR_Image image = current_image();
+            auto [w, h] = image.dimension();
+            if(!w || !h) return "error nothing rendered yet";
+            std::vector<unsigned char> data;
+            image.tonemap_to(data, job.exp);
+            stbi_flip_vertically_on_write(0);
+            auto append = [](void* out, void* bytes, int n) {
+                auto* str = static_cast<std::string*>(out);
+                str->append(static_cast<const char*>(bytes), n);
+            };
+            if(!stbi_write_png_to_func(append, &payload, (int)w, (int)h, 4, data.data(),
+                                       (int)w * 4))
+                return "error failed to encode the image";
+            return "ok " + std::to_string(payload.size());
+        }
+        if(cmd == "save") {
+            std::string file;
+            std::getline(in >> std::ws, file);
+            if(file.empty()) return "error save takes a file name";
+            HDR_Image image = current_image();
+            auto [w, h] = image.dimension();
+            if(!w || !h) return "error nothing rendered yet";
+            Image_Encoder encoder(set.encoder);
+            if(Image_Encoder::is_stream(set.encoder.format)) {
+                std::string e = encoder.open_stream(file);
+                if(!e.empty()) return "error " + e;
+            }
+            encoder.submit(file, std::move(image), job.exp);
+            std::string e = encoder.finish();
+            return e.empty() ? "ok" : "error " + e;
+        }
+        if(cmd == "quit") {
+            quit = true;
+            return "ok";
+        }
+        return "error unknown request " + cmd;
+    };
+
+    // One client at a time; renders keep going between connections
+    while(!quit) {
+        Socket client = server.accept(1000);
+        if(!client.valid()) continue;
+
+        std::string line;
+        while(!quit && read_line(client, line)) {
+            if(line.empty()) continue;
+            std::string payload;
+            std::string reply = handle(line, payload) + "\n";
+            if(!client.send(reply.data(), reply.size())) break;
+            if(!payload.empty() && !client.send(payload.data(), payload.size())) break;
+        }
+    }
+
+    tracer.cancel();
+    server.close();
+    std::remove(set.serve.c_str());
+    return {};
+}
+
 App::~App() {
     Renderer::shutdown();
 }
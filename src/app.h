@@ -16,22 +16,15 @@ class Platform;
 
 class App {
 public:
-    struct Settings {
+    // If headless is true, the inherited render settings are used too
+    struct Settings : Gui::Headless_Settings {
 
         std::string scene_file;
         std::string env_map_file;
         bool headless = false;
 
-        // If headless is true, use all of these
-        std::string output_file = "out.png";
-        int w = 640;
-        int h = 360;
-        int s = 128;
-        int ls = 16;
-        int d = 4;
-        bool animate = false;
-        float exp = 1.0f;
-        bool w_from_ar = false;
+        std::string jobs;  // JSON list of stills to render instead; see run_jobs
+        std::string serve; // UNIX socket to take render requests on instead; see serve
     };
 
     App(Settings set, Platform* plt = nullptr);
@@ -42,6 +35,8 @@ public:
     void event(SDL_Event e);
 
 private:
+    std::string run_jobs(const Settings& set);
+    std::string serve(const Settings& set, bool loaded);
     void apply_window_dim(Vec2 new_dim);
     Vec3 screen_to_world(Vec2 mouse);
 
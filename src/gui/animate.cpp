@@ -1,6 +1,7 @@
 
 #include "animate.h"
 #include "../scene/renderer.h"
+#include "../util/rand.h"
 #include "manager.h"
 
 #include <tuple>
@@ -43,20 +44,8 @@ Camera Animate::current_camera() const {
     return ui_camera.get();
 }
 
-void Animate::load_cam(Vec3 pos, Vec3 center, float ar, float hfov, float ap, float dist) {
-
-    if(ar == 0.0f) ar = ui_render.wh_ar();
-
-    float fov = 2.0f * std::atan((1.0f / ar) * std::tan(hfov / 2.0f));
-    fov = Degrees(fov);
-
-    Camera c(Vec2{ar, 1.0f});
-    c.look_at(center, pos);
-    c.set_ar(ar);
-    c.set_fov(fov);
-    c.set_ap(ap);
-    c.set_dist(dist);
-    ui_camera.load(c);
+void Animate::load_cam(const Scene::File_Camera& cam) {
+    ui_camera.load(cam.camera(ui_render.wh_ar()));
 }
 
 void Animate::render(Scene& scene, Scene_Maybe obj_opt, Widgets& widgets, Camera& user_cam) {
@@ -634,9 +623,16 @@ void Animate::timeline(Manager& manager, Undo& undo, Scene& scene, Scene_Maybe o
 }
 
 void Animate::step_sim(Scene& scene) {
+    // Particles are emitted at random; drawing each frame's randomness from its
+    // own stream makes a frame's state the same however the shot is split up.
+    RNG::seed(sim_seed, (unsigned long long)current_frame);
     simulate.step(scene, 1.0f / frame_rate);
 }
 
+void Animate::clear_sim(Scene& scene) {
+    simulate.clear_particles(scene);
+}
+
 Camera Animate::set_time(Scene& scene, float time) {
 
     current_frame = (int)time;
@@ -19,7 +19,7 @@ public:
     Camera at(float t) const;
     void set(float t, const Camera& cam);
 
-    Splines<Vec3, Quat, float, float, float, float> splines;
+    Camera_Splines splines;
 
 private:
     Vec2 dim;
@@ -47,8 +47,9 @@ public:
     void clear();
     void update(Scene& scene);
     void refresh(Scene& scene);
-    void load_cam(Vec3 pos, Vec3 front, float ar, float fov, float ap, float dist);
+    void load_cam(const Scene::File_Camera& cam);
     void step_sim(Scene& scene);
+    void clear_sim(Scene& scene);
 
     std::string pump_output(Scene& scene);
     Camera set_time(Scene& scene, float time);
@@ -63,6 +64,8 @@ public:
     void invalidate(Joint* handle);
 
 private:
+    static const unsigned long long sim_seed = 248;
+
     Uint64 last_frame = 0;
     bool playing = false;
     int frame_rate = 24;
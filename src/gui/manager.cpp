@@ -129,7 +129,7 @@ bool Manager::save_scene(Scene& scene, Undo& undo) {
         } else
             return false;
     }
-    std::string error = scene.write(save_file, render.get_cam(), animate);
+    std::string error = write_file(scene, save_file);
     set_error(error);
     if(error.empty()) {
         n_actions_at_last_save = undo.n_actions();
@@ -140,13 +140,13 @@ bool Manager::save_scene(Scene& scene, Undo& undo) {
 bool Manager::write_scene(Scene& scene) {
 
     char* path = nullptr;
-    NFD_SaveDialog("dae", nullptr, &path);
+    NFD_SaveDialog("dae,c3d", nullptr, &path);
     if(path) {
         std::string spath(path);
-        if(!postfix(path, ".dae")) {
+        if(!postfix(path, ".dae") && !Scene::is_binary(spath)) {
             spath += ".dae";
         }
-        std::string error = scene.write(spath, render.get_cam(), animate);
+        std::string error = write_file(scene, spath);
         set_error(error);
         free(path);
         return error.empty();
@@ -158,6 +158,40 @@ void Manager::set_file(std::string save) {
     save_file = save;
 }
 
+std::string Manager::load_file(Scene& scene, Undo& undo, Scene::Load_Opts opt, std::string file) {
+
+    if(opt.new_scene) {
+        scene.clear();
+        undo.reset();
+        animate.clear();
+        rig.clear();
+    }
+
+    Scene::File_Extras extras;
+    std::string error = scene.load(opt, file, extras);
+
+    if(extras.render_cam) render.load_cam(*extras.render_cam);
+    if(extras.anim_cam) animate.load_cam(*extras.anim_cam);
+
+    float ar = render.get_cam().get_ar();
+    for(const auto& [t, p, q, s] : extras.anim_cam_keys) {
+        animate.camera().splines.set(t, p, q, s.x, ar, s.y - 1.0f, s.z);
+    }
+    if(extras.frames > 0) animate.set(extras.frames, extras.fps);
+
+    animate.refresh(scene);
+    return error;
+}
+
+std::string Manager::write_file(Scene& scene, std::string file) {
+    if(Scene::is_binary(file)) {
+        return scene.write_binary(file, render.get_cam(), animate.current_camera(),
+                                  animate.camera().splines, animate.n_frames(), animate.fps());
+    }
+    return scene.write(file, render.get_cam(), animate.current_camera(), animate.camera().splines,
+                       animate.n_frames(), animate.fps());
+}
+
 void Manager::load_scene(Scene& scene, Undo& undo, bool clear) {
 
     after_save = [this, &scene, &undo, clear](bool success) {
@@ -177,7 +211,7 @@ void Manager::load_scene(Scene& scene, Undo& undo, bool clear) {
         }
 
         load_opt.new_scene = clear;
-        std::string error = scene.load(load_opt, undo, *this, std::string(path));
+        std::string error = load_file(scene, undo, load_opt, std::string(path));
         set_error(error);
 
         if(clear && error.empty()) {
@@ -26,21 +26,6 @@ namespace Gui {
 
 enum class Mode { layout, model, render, rig, animate, simulate };
 
-#define RGBv(n, r, g, b) static inline const Vec3 n = Vec3(r##.0f, g##.0f, b##.0f) / 255.0f;
-struct Color {
-    RGBv(black, 0, 0, 0);
-    RGBv(outline, 242, 153, 41);
-    RGBv(hover, 102, 102, 204);
-    RGBv(baseplane, 71, 71, 71);
-    RGBv(background, 58, 58, 58);
-    RGBv(red, 163, 66, 81);
-    RGBv(green, 124, 172, 40);
-    RGBv(blue, 64, 127, 193);
-    RGBv(hoverg, 102, 204, 102);
-    static Vec3 axis(Axis a);
-};
-#undef RGBv
-
 class Manager {
 public:
     Manager(Scene& scene, Vec2 window_dim);
@@ -54,6 +39,9 @@ public:
     Render& get_render();
     Animate& get_animate();
     void set_file(std::string save);
+    // Loads a scene file along with the cameras and animation settings it holds
+    std::string load_file(Scene& scene, Undo& undo, Scene::Load_Opts opt, std::string file);
+    std::string write_file(Scene& scene, std::string file);
     void refresh_anim(Scene& scene, Undo& undo);
 
     // Object interaction
@@ -89,7 +77,7 @@ private:
     void load_image(Scene_Light& image);
     void frame(Scene& scene, Camera& cam);
 
-    static inline const char* scene_file_types = "dae,obj,fbx,glb,gltf,3ds,blend,stl,ply";
+    static inline const char* scene_file_types = "dae,c3d,obj,fbx,glb,gltf,3ds,blend,stl,ply";
     static inline const char* image_file_types = "exr,hdr,hdri,jpg,jpeg,png,tga,bmp,psd,gif";
 
     void render_selected(Scene_Object& obj);
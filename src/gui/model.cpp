@@ -890,7 +890,9 @@ void Model::render(Scene_Maybe obj_opt, Widgets& widgets, Camera& cam) {
 
     Mat4 view = cam.get_view();
 
-    Renderer::HalfedgeOpt opts(*this);
+    Renderer::HalfedgeOpt opts(shapes());
+    opts.sel_id = select_id();
+    opts.hov_id = hover_id();
     opts.modelview = view;
     opts.v_color = v_col;
     opts.f_color = f_col;
@@ -63,20 +63,8 @@ const Camera& Render::get_cam() const {
     return ui_camera.get();
 }
 
-void Render::load_cam(Vec3 pos, Vec3 center, float ar, float hfov, float ap, float dist) {
-
-    if(ar == 0.0f) ar = ui_render.wh_ar();
-
-    float fov = 2.0f * std::atan((1.0f / ar) * std::tan(hfov / 2.0f));
-    fov = Degrees(fov);
-
-    Camera c(Vec2{ar, 1.0f});
-    c.look_at(center, pos);
-    c.set_ar(ar);
-    c.set_fov(fov);
-    c.set_ap(ap);
-    c.set_dist(dist);
-    ui_camera.load(c);
+void Render::load_cam(const Scene::File_Camera& cam) {
+    ui_camera.load(cam.camera(ui_render.wh_ar()));
 }
 
 Mode Render::UIsidebar(Manager& manager, Undo& undo, Scene& scene, Scene_Maybe obj_opt,
@@ -128,12 +116,25 @@ std::pair<float, float> Render::completion_time() const {
     return ui_render.completion_time();
 }
 
-std::string Render::headless_render(Animate& animate, Scene& scene, std::string output, bool a,
-                                    int w, int h, int s, int ls, int d, float exp, bool w_from_ar) {
-    if(w_from_ar) {
-        w = (int)std::ceil(ui_camera.get_ar() * h);
+void Render::begin_job(Scene& scene, const Render_Job& job, bool rebuild,
+                       const PT::Pathtracer::Options& opt) {
+    ui_render.begin_job(scene, job, rebuild, opt);
+}
+
+PT::Pathtracer& Render::tracer() {
+    return ui_render.tracer();
+}
+
+std::string Render::render_job(Scene& scene, const Render_Job& job, bool rebuild, bool aovs,
+                               const PT::Pathtracer::Options& opt, Image_Encoder& encoder) {
+    return ui_render.render_job(scene, job, rebuild, aovs, opt, encoder);
+}
+
+std::string Render::headless_render(Animate& animate, Scene& scene, Headless_Settings set) {
+    if(set.w_from_ar) {
+        set.w = (int)std::ceil(ui_camera.get_ar() * set.h);
     }
-    return ui_render.headless(animate, scene, ui_camera.get(), output, a, w, h, s, ls, d, exp);
+    return ui_render.headless(animate, scene, ui_camera.get(), set);
 }
 
 } // namespace Gui
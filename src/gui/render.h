@@ -20,8 +20,12 @@ class Render {
 public:
     Render(Scene& scene, Vec2 dim);
 
-    std::string headless_render(Animate& animate, Scene& scene, std::string output, bool a, int w,
-                                int h, int s, int ls, int d, float exp, bool w_from_ar);
+    std::string headless_render(Animate& animate, Scene& scene, Headless_Settings set);
+    void begin_job(Scene& scene, const Render_Job& job, bool rebuild,
+                   const PT::Pathtracer::Options& opt);
+    std::string render_job(Scene& scene, const Render_Job& job, bool rebuild, bool aovs,
+                           const PT::Pathtracer::Options& opt, Image_Encoder& encoder);
+    PT::Pathtracer& tracer();
     std::pair<float, float> completion_time() const;
 
     bool keydown(Widgets& widgets, SDL_Keysym key);
@@ -30,7 +34,7 @@ public:
     void render(Scene_Maybe obj, Widgets& widgets, Camera& user_cam);
 
     void update_dim(Vec2 dim);
-    void load_cam(Vec3 pos, Vec3 front, float ar, float fov, float ap, float dist);
+    void load_cam(const Scene::File_Camera& cam);
     const Camera& get_cam() const;
 
 private:
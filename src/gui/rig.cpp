@@ -184,9 +184,11 @@ void Rig::hover(Vec3 cam, Vec2 spos, Vec3 dir) {
         Ray f(cam, dir);
         PT::Trace hit1 = mesh_bvh.hit(f);
         if(!hit1.hit) return;
+        mesh_bvh.compute_interaction(f, hit1);
 
         Ray s(hit1.position + dir * EPS_F, dir);
         PT::Trace hit2 = mesh_bvh.hit(s);
+        if(hit2.hit) mesh_bvh.compute_interaction(s, hit2);
 
         Vec3 pos = hit1.position;
         if(hit2.hit) pos = 0.5f * (hit1.position + hit2.position);
@@ -10,7 +10,7 @@ namespace Gui {
 const char* Solid_Type_Names[(int)Solid_Type::count] = {"Sphere", "Cube", "Cylinder", "Torus",
                                                         "Custom"};
 
-Simulate::Simulate() : thread_pool(std::thread::hardware_concurrency()) {
+Simulate::Simulate() : thread_pool(Thread_Pool::default_threads()) {
     last_update = SDL_GetPerformanceCounter();
 }
 
@@ -3,6 +3,7 @@
 #include <iomanip>
 #include <iostream>
 #include <nfd/nfd.h>
+#include <optional>
 #include <sf_libs/stb_image_write.h>
 #include <sstream>
 
@@ -550,9 +551,11 @@ void Widget_Camera::generate_cage() {
     cam_cage.add(br, bl, Gui::Color::black);
 }
 
-Widget_Render::Widget_Render(Vec2 dim) : pathtracer(*this, dim) {
+Widget_Render::Widget_Render(Vec2 dim) : pathtracer(dim) {
     out_w = (size_t)dim.x / 2;
     out_h = (size_t)dim.y / 2;
+    pathtracer.set_ray_log(
+        [this](const Ray& ray, float t, Spectrum color) { log_ray(ray, t, color); });
 }
 
 void Widget_Render::open() {
@@ -585,6 +588,15 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
         ImGui::InputInt("Area Light Samples", &out_area_samples, 1, 100);
         ImGui::InputInt("Max Ray Depth", &out_depth, 1, 32);
         ImGui::SliderFloat("Exposure", &exposure, 0.01f, 10.0f, "%.2f", 2.5f);
+        ImGui::Checkbox("Path Guiding", &options.guiding);
+
+        int photons = (int)options.caustic_photons;
+        ImGui::InputInt("Caustic Photons", &photons, 10000, 100000);
+        options.caustic_photons = (size_t)std::max(0, photons);
+
+        if(ImGui::Checkbox("Denoise", &options.denoise)) {
+            pathtracer.set_denoise(options.denoise);
+        }
     } else {
         ImGui::Combo("Samples", (int*)&msaa.samples, GL::Sample_Count_Names, msaa.n_options());
         out_samples = msaa.n_samples();
@@ -605,6 +617,38 @@ void Widget_Render::begin(Scene& scene, Widget_Camera& cam, Camera& user_cam) {
     }
 }
 
+// Where the path's extension starts, or its end if it has none
+static size_t extension_at(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path.size();
+    return dot;
+}
+
+// Same path with the extension swapped for .exr
+static std::string exr_path(const std::string& path) {
+    return path.substr(0, extension_at(path)) + ".exr";
+}
+
+// Numbered snapshots go next to the output: out.0001.png
+static std::string snapshot_path(const std::string& path, int n) {
+    std::stringstream str;
+    str << "." << std::setfill('0') << std::setw(4) << n;
+    size_t ext = extension_at(path);
+    return path.substr(0, ext) + str.str() + path.substr(ext);
+}
+
+// Where animation frames are written: folder/NNNN.png
+static std::string frame_path(const std::string& folder, int frame, const char* ext = ".png") {
+    std::stringstream str;
+    str << std::setfill('0') << std::setw(4) << frame;
+#ifdef _WIN32
+    return folder + "\\" + str.str() + ext;
+#else
+    return folder + "/" + str.str() + ext;
+#endif
+}
+
 std::string Widget_Render::step(Animate& animate, Scene& scene) {
 
     if(animating) {
@@ -626,14 +670,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
 
             Renderer::get().save(scene, cam, out_w, out_h, out_samples);
             Renderer::get().saved(data);
-
-            std::stringstream str;
-            str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-            std::string path = folder + "\\" + str.str() + ".png";
-#else
-            std::string path = folder + "/" + str.str() + ".png";
-#endif
+            std::string path = frame_path(folder, next_frame);
 
             stbi_flip_vertically_on_write(true);
             if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -654,13 +691,7 @@ std::string Widget_Render::step(Animate& animate, Scene& scene) {
                 std::vector<unsigned char> data;
 
                 pathtracer.get_output().tonemap_to(data, exposure);
-                std::stringstream str;
-                str << std::setfill('0') << std::setw(4) << next_frame;
-#ifdef _WIN32
-                std::string path = folder + "\\" + str.str() + ".png";
-#else
-                std::string path = folder + "/" + str.str() + ".png";
-#endif
+                std::string path = frame_path(folder, next_frame);
 
                 stbi_flip_vertically_on_write(false);
                 if(!stbi_write_png(path.c_str(), (int)out_w, (int)out_h, 4, data.data(),
@@ -722,6 +753,7 @@ void Widget_Render::animate(Scene& scene, Widget_Camera& cam, Camera& user_cam,
                 init = true;
                 ray_log.clear();
                 pathtracer.set_sizes(out_w, out_h, out_samples, out_area_samples, out_depth);
+                pathtracer.set_options(options);
             }
         }
     }
@@ -775,6 +807,7 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
                 ret = true;
                 ray_log.clear();
                 pathtracer.set_sizes(out_w, out_h, out_samples, out_area_samples, out_depth);
+                pathtracer.set_options(options);
                 pathtracer.begin_render(scene, cam.get());
             } else {
                 Renderer::get().save(scene, cam.get(), out_w, out_h, out_samples);
@@ -812,6 +845,21 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
     }
 
     if(method == 1 && has_rendered) {
+        ImGui::SameLine();
+        if(ImGui::Button("Save AOVs")) {
+            char* path = nullptr;
+            NFD_SaveDialog("exr", nullptr, &path);
+            if(path) {
+                std::string spath(path);
+                if(!postfix(spath, ".exr")) {
+                    spath += ".exr";
+                }
+                std::string aov_err = pathtracer.save_aovs(spath);
+                if(!aov_err.empty()) err = "Failed to write AOVs: " + aov_err;
+                free(path);
+            }
+        }
+
         ImGui::SameLine();
         if(ImGui::Button("Add Samples")) {
             pathtracer.begin_render(scene, cam.get(), true);
@@ -839,71 +887,310 @@ bool Widget_Render::UI(Scene& scene, Widget_Camera& cam, Camera& user_cam, std::
     return ret;
 }
 
+std::string Widget_Render::render_frames(Animate& animate, Scene& scene,
+                                         const std::string& output, int first, int last,
+                                         float exp, bool aovs, const Image_Encoder::Options& enc,
+                                         const std::function<void(float)>& progress) {
+
+    // Two tracers take turns: while one renders frame N, the other builds
+    // frame N+1, and finished frames are encoded in the background. They
+    // share one pool, so the build takes over threads as the render's epochs
+    // run out instead of adding threads of its own.
+    PT::Pathtracer second(Vec2{(float)out_w, (float)out_h}, pathtracer);
+    second.set_ray_log(
+        [this](const Ray& ray, float t, Spectrum color) { log_ray(ray, t, color); });
+    second.set_sizes(out_w, out_h, out_samples, out_area_samples, out_depth);
+    second.set_options(options);
+    PT::Pathtracer* tracers[2] = {&pathtracer, &second};
+
+    // A shard starting mid-shot has to simulate its way there first
+    animate.clear_sim(scene);
+    for(int f = 0; f < first; f++) {
+        animate.set_time(scene, (float)f);
+        animate.step_sim(scene);
+    }
+
+    auto prepare = [&](int frame, PT::Pathtracer& tracer) {
+        Camera cam = animate.set_time(scene, (float)frame);
+        animate.step_sim(scene);
+        tracer.prepare(scene, cam);
+    };
+
+    Image_Encoder::Options enc_opt = enc;
+    enc_opt.fps = (int)std::round(animate.fps());
+    Image_Encoder encoder(enc_opt);
+    const char* ext = Image_Encoder::extension(enc.format);
+    if(Image_Encoder::is_stream(enc.format)) {
+        if(aovs) return "AOVs need one file per frame, not a " + std::string(ext + 1) + " stream.";
+        std::string err = encoder.open_stream(output);
+        if(!err.empty()) return err;
+    }
+    float n_frames = (float)(last - first);
+
+    prepare(first, *tracers[0]);
+    tracers[0]->begin_prepared();
+
+    for(int frame = first; frame < last; frame++) {
+
+        PT::Pathtracer& current = *tracers[(frame - first) % 2];
+        PT::Pathtracer& next = *tracers[(frame - first + 1) % 2];
+
+        if(frame + 1 < last) prepare(frame + 1, next);
+        while(current.in_progress()) {
+            progress((frame - first + current.progress()) / n_frames);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        if(frame + 1 < last) next.begin_prepared();
+
+        // Denoising and copying out overlap the next frame's render
+        HDR_Image image = current.get_output().copy();
+        PT::Feature_Buffer features;
+        if(aovs) features = current.get_features();
+
+        std::string path = frame_path(output, frame, ext);
+        if(aovs) {
+            auto beauty = std::make_shared<HDR_Image>(image.copy());
+            auto passes = std::make_shared<PT::Feature_Buffer>(std::move(features));
+            encoder.run([beauty, passes, path]() {
+                std::string err = PT::write_aovs(exr_path(path), *beauty, *passes);
+                return err.empty() ? err : "Failed to write AOVs: " + err;
+            });
+        }
+        encoder.submit(path, std::move(image), exp);
+    }
+
+    std::string err = encoder.finish();
+    progress(1.0f);
+    return err;
+}
+
+static void print_progress(float f) {
+    std::cout << "Progress: [";
+
+    int width = std::min(Platform::console_width() - 30, 50);
+    if(width) {
+        int bar = (int)(width * f);
+        for(int i = 0; i < bar; i++) std::cout << "-";
+        for(int i = bar; i < width; i++) std::cout << " ";
+        std::cout << "] ";
+    }
+
+    float percent = 100.0f * f;
+    if(percent < 10.0f) std::cout << "0";
+    std::cout << percent << "%\r";
+    std::cout.flush();
+}
+
+void Widget_Render::begin_job(Scene& scene, const Render_Job& job, bool rebuild,
+                              const PT::Pathtracer::Options& opt) {
+    // The last job may still be tracing into the buffers about to be resized
+    pathtracer.cancel();
+    out_w = job.w;
+    out_h = job.h;
+    out_samples = job.s;
+    out_area_samples = job.ls;
+    out_depth = job.d;
+    options = opt;
+    pathtracer.set_options(opt);
+    pathtracer.set_sizes(job.w, job.h, job.s, job.ls, job.d);
+
+    if(rebuild)
+        pathtracer.prepare(scene, job.camera);
+    else
+        pathtracer.set_camera(job.camera);
+    pathtracer.begin_prepared();
+}
+
+std::string Widget_Render::render_job(Scene& scene, const Render_Job& job, bool rebuild,
+                                      bool aovs, const PT::Pathtracer::Options& opt,
+                                      Image_Encoder& encoder) {
+
+    begin_job(scene, job, rebuild, opt);
+
+    std::cout << std::fixed << std::setw(2) << std::setprecision(2) << std::setfill('0');
+    while(pathtracer.in_progress()) {
+        print_progress(pathtracer.progress());
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::cout << std::endl;
+
+    // The image encodes while the next job renders
+    encoder.submit(job.output, pathtracer.get_output().copy(), job.exp);
+    if(aovs) {
+        std::string err = pathtracer.save_aovs(exr_path(job.output));
+        if(!err.empty()) return "Failed to write AOVs: " + err;
+    }
+    return {};
+}
+
 std::string Widget_Render::headless(Animate& animate, Scene& scene, const Camera& cam,
-                                    std::string output, bool a, int w, int h, int s, int ls, int d,
-                                    float exp) {
+                                    const Headless_Settings& set) {
+
+    // Workers take everything else from the coordinator
+    if(!set.farm.worker.empty()) {
+        info("Rendering for %s.", set.farm.worker.c_str());
+        PT::Pathtracer::Options worker_opt = set.tracer;
+        worker_opt.checkpoint.clear();
+        pathtracer.set_sizes(set.w, set.h, set.s, set.ls, set.d);
+        pathtracer.set_options(worker_opt);
+        return PT::work(set.farm, pathtracer, scene, cam, set.w, set.h);
+    }
 
     info("Render settings:");
-    info("\twidth: %d", w);
-    info("\theight: %d", h);
-    info("\tsamples: %d", s);
-    info("\tlight samples: %d", ls);
-    info("\tmax depth: %d", d);
-    info("\texposure: %f", exp);
-    info("\trender threads: %u", std::thread::hardware_concurrency());
-
-    out_w = w;
-    out_h = h;
-    pathtracer.set_sizes(w, h, s, ls, d);
-
-    auto print_progress = [](float f) {
-        std::cout << "Progress: [";
-
-        int width = std::min(Platform::console_width() - 30, 50);
-        if(width) {
-            int bar = (int)(width * f);
-            for(int i = 0; i < bar; i++) std::cout << "-";
-            for(int i = bar; i < width; i++) std::cout << " ";
-            std::cout << "] ";
-        }
-
-        float percent = 100.0f * f;
-        if(percent < 10.0f) std::cout << "0";
-        std::cout << percent << "%\r";
-        std::cout.flush();
-    };
+    info("\twidth: %d", set.w);
+    info("\theight: %d", set.h);
+    info("\tsamples: %d", set.s);
+    info("\tlight samples: %d", set.ls);
+    info("\tmax depth: %d", set.d);
+    info("\texposure: %f", set.exp);
+    info("\tpath guiding: %s", set.tracer.guiding ? "on" : "off");
+    info("\tcaustic photons: %zu (%zu MB)", set.tracer.caustic_photons, set.tracer.photon_memory);
+    info("\tdenoise: %s", set.tracer.denoise ? "on" : "off");
+    info("\tAOVs: %s", set.aovs ? "on" : "off");
+    info("\tencoders: %zu", set.encoder.threads);
+    if(!set.tracer.checkpoint.empty())
+        info("\tcheckpoint: %s every %.0fs%s", set.tracer.checkpoint.c_str(),
+             set.tracer.checkpoint_interval, set.resume ? " (resuming)" : "");
+    info("\trender threads: %zu", Thread_Pool::default_threads());
+    if(set.farm.coordinate) info("\tlocal workers: %zu", set.farm.local_workers);
+    if(set.tracer.tile_size) info("\ttile size: %zu", set.tracer.tile_size);
+    if(set.snapshot_every > 0.0f) info("\tsnapshots: every %.0fs", set.snapshot_every);
+
+    out_w = set.w;
+    out_h = set.h;
+    out_samples = set.s;
+    out_area_samples = set.ls;
+    out_depth = set.d;
+    options = set.tracer;
+    // Options first, so a tiled render never allocates the whole frame
+    pathtracer.set_options(set.tracer);
+    pathtracer.set_sizes(set.w, set.h, set.s, set.ls, set.d);
+
+    if(set.animate && !set.tracer.checkpoint.empty())
+        return "Checkpoints are only supported for still images.";
+    if(set.resume && set.tracer.checkpoint.empty())
+        return "Nothing to resume: no checkpoint file given.";
+    if(set.farm.coordinate && (set.animate || !set.tracer.checkpoint.empty()))
+        return "Distributed rendering only supports still images, without checkpoints.";
+    if(set.tracer.tile_size) {
+        if(set.animate || set.aovs || set.resume || set.farm.coordinate ||
+           !set.tracer.checkpoint.empty())
+            return "Tiled rendering only supports still images, without AOVs, checkpoints, or "
+                   "workers.";
+        if(set.tracer.denoise || set.tracer.guiding || set.tracer.caustic_photons)
+            return "Tiled rendering can't denoise, guide paths, or trace caustic photons.";
+        if(set.encoder.format != Image_Format::png &&
+           set.encoder.format != Image_Format::png_fast &&
+           set.encoder.format != Image_Format::png_raw)
+            return "Tiled renders are only written as PNG.";
+    }
+    if(set.snapshot_every > 0.0f &&
+       (set.animate || set.tracer.tile_size || set.farm.coordinate ||
+        Image_Encoder::is_stream(set.encoder.format)))
+        return "Snapshots are only taken of still images rendered here, to image formats.";
 
     std::cout << std::fixed << std::setw(2) << std::setprecision(2) << std::setfill('0');
-    if(a) {
-
-        method = 1;
-        init = true;
-        animating = true;
-        max_frame = animate.n_frames();
-        next_frame = 0;
-        folder = output;
-        while(next_frame < max_frame) {
-            std::string err = step(animate, scene);
-            if(!err.empty()) return err;
-            print_progress(((float)next_frame + pathtracer.progress()) / (max_frame + 1));
+    if(set.animate) {
+
+        int first = 0, last = animate.n_frames();
+        if(!set.frames.empty()) {
+            size_t colon = set.frames.find(':');
+            if(colon == std::string::npos) return "Expected a frame range like 10:20.";
+            std::string from = set.frames.substr(0, colon), to = set.frames.substr(colon + 1);
+            if(!from.empty()) first = std::atoi(from.c_str());
+            if(!to.empty()) last = std::min(last, std::atoi(to.c_str()));
+            if(first < 0 || first >= last) return "Frame range " + set.frames + " is empty.";
+        }
+        info("\tframes: %d to %d", first, last - 1);
+
+        std::string err = render_frames(animate, scene, set.output_file, first, last, set.exp,
+                                        set.aovs, set.encoder, print_progress);
+        if(!err.empty()) return err;
+        std::cout << std::endl;
+
+    } else if(set.tracer.tile_size) {
+
+        // Finished tiles wait on disk next to the output
+        Scratch_Image film;
+        std::string err = film.open(set.output_file + ".tiles", set.w, set.h);
+        if(!err.empty()) return err;
+
+        pathtracer.begin_tiles(scene, cam, film);
+        while(pathtracer.in_progress()) {
+            print_progress(pathtracer.progress());
             std::this_thread::sleep_for(std::chrono::milliseconds(250));
         }
         std::cout << std::endl;
 
+        err = film.error();
+        if(err.empty()) err = film.write_png(set.output_file, set.exp);
+        if(!err.empty()) return err;
+
     } else {
 
-        pathtracer.begin_render(scene, cam);
+        if(set.farm.coordinate) {
+            // Workers have to match the scene as this process builds it
+            pathtracer.prepare(scene, cam);
+            PT::Checkpoint merged;
+            std::string err = PT::coordinate(set.farm, set.w, set.h, set.s,
+                                             pathtracer.fingerprint(), print_progress, merged);
+            if(!err.empty()) return "Distributed render failed: " + err;
+            pathtracer.restore(std::move(merged));
+        } else if(set.resume) {
+            std::string err = pathtracer.resume_render(scene, cam);
+            if(!err.empty()) return "Failed to resume: " + err;
+        } else {
+            pathtracer.begin_render(scene, cam);
+        }
+
+        // Snapshots only hold up the render threads while the image is copied
+        // out; one encoder thread writes them in turn.
+        std::optional<Image_Encoder> snapshots;
+        if(set.snapshot_every > 0.0f) {
+            Image_Encoder::Options snapshot_opt = set.encoder;
+            snapshot_opt.threads = 1;
+            snapshots.emplace(snapshot_opt);
+        }
+        auto snapshot_time = std::chrono::steady_clock::now();
+        int n_snapshots = 0;
+
         while(pathtracer.in_progress()) {
             print_progress(pathtracer.progress());
             std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+            auto now = std::chrono::steady_clock::now();
+            if(snapshots && pathtracer.in_progress() &&
+               std::chrono::duration<float>(now - snapshot_time).count() >= set.snapshot_every) {
+                snapshot_time = now;
+                std::string path = set.snapshot_numbered
+                                       ? snapshot_path(set.output_file, ++n_snapshots)
+                                       : set.output_file;
+                snapshots->submit(path, pathtracer.preview(), set.exp);
+            }
         }
         std::cout << std::endl;
 
-        std::vector<unsigned char> data;
-        pathtracer.get_output().tonemap_to(data, exp);
-        if(!stbi_write_png(output.c_str(), w, h, 4, data.data(), w * 4)) {
-            return "Failed to write output!";
+        // A late snapshot mustn't replace the final image
+        if(snapshots) {
+            std::string err = snapshots->finish();
+            if(!err.empty()) warn("Failed to write snapshot: %s", err.c_str());
+            snapshots.reset();
+        }
+
+        // The AOVs can be written while the image encodes
+        Image_Encoder encoder(set.encoder);
+        if(Image_Encoder::is_stream(set.encoder.format)) {
+            std::string err = encoder.open_stream(set.output_file);
+            if(!err.empty()) return err;
+        }
+        encoder.submit(set.output_file, pathtracer.get_output().copy(), set.exp);
+
+        if(set.aovs) {
+            std::string err = pathtracer.save_aovs(exr_path(set.output_file));
+            if(!err.empty()) return "Failed to write AOVs: " + err;
         }
+        std::string err = encoder.finish();
+        if(!err.empty()) return err;
     }
 
     return {};
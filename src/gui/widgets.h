@@ -1,39 +1,69 @@
 
 #pragma once
 
+#include <functional>
+
 #include "../lib/mathlib.h"
+#include "../rays/distributed.h"
 #include "../rays/pathtracer.h"
 #include "../scene/scene.h"
+#include "../util/image_encoder.h"
 
 class Undo;
 
 namespace Gui {
 
+// One still of a --jobs queue, or a --serve request
+struct Render_Job {
+    std::string output;
+    Camera camera{Vec2{1.0f}};
+    int w = 640, h = 360, s = 128, ls = 16, d = 4;
+    float exp = 1.0f;
+};
+
+// Everything a headless render from the command line is given
+struct Headless_Settings {
+    std::string output_file = "out.png";
+    int w = 640;
+    int h = 360;
+    int s = 128;
+    int ls = 16;
+    int d = 4;
+    bool animate = false;
+    std::string frames; // "first:end", end exclusive; either may be left out
+    float exp = 1.0f;
+    bool w_from_ar = false;
+    bool aovs = false;
+    bool resume = false;
+    PT::Pathtracer::Options tracer;
+    PT::Farm_Options farm;
+    Image_Encoder::Options encoder;
+    float snapshot_every = 0.0f; // seconds between previews of the render so far; 0 for none
+    bool snapshot_numbered = false;
+};
+
 class Animate;
 
 enum class Axis { X, Y, Z };
 
+#define RGBv(n, r, g, b) static inline const Vec3 n = Vec3(r##.0f, g##.0f, b##.0f) / 255.0f;
+struct Color {
+    RGBv(black, 0, 0, 0);
+    RGBv(outline, 242, 153, 41);
+    RGBv(hover, 102, 102, 204);
+    RGBv(baseplane, 71, 71, 71);
+    RGBv(background, 58, 58, 58);
+    RGBv(red, 163, 66, 81);
+    RGBv(green, 124, 172, 40);
+    RGBv(blue, 64, 127, 193);
+    RGBv(hoverg, 102, 204, 102);
+    static Vec3 axis(Axis a);
+};
+#undef RGBv
+
 enum class Widget_Type { move, rotate, scale, bevel, count };
 static const int n_Widget_Types = (int)Widget_Type::count;
 
-enum class Widget_IDs : Scene_ID {
-    none,
-    x_mov,
-    y_mov,
-    z_mov,
-    xy_mov,
-    yz_mov,
-    xz_mov,
-    x_rot,
-    y_rot,
-    z_rot,
-    x_scl,
-    y_scl,
-    z_scl,
-    count
-};
-static const int n_Widget_IDs = (int)Widget_IDs::count;
-
 class Widget_Camera {
 public:
     Widget_Camera(Vec2 screen_dim)
@@ -83,8 +113,15 @@ public:
     void animate(Scene& scene, Widget_Camera& cam, Camera& user_cam, int max_frame);
     std::string step(Animate& animate, Scene& scene);
 
-    std::string headless(Animate& animate, Scene& scene, const Camera& cam, std::string output,
-                         bool a, int w, int h, int s, int ls, int d, float exp);
+    std::string headless(Animate& animate, Scene& scene, const Camera& cam,
+                         const Headless_Settings& set);
+
+    // Renders a still from the scene as last built, unless told to rebuild it,
+    // and queues it on the encoder. begin_job only starts it.
+    void begin_job(Scene& scene, const Render_Job& job, bool rebuild,
+                   const PT::Pathtracer::Options& opt);
+    std::string render_job(Scene& scene, const Render_Job& job, bool rebuild, bool aovs,
+                           const PT::Pathtracer::Options& opt, Image_Encoder& encoder);
 
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
     void render_log(const Mat4& view) const;
@@ -107,12 +144,17 @@ public:
 
 private:
     void begin(Scene& scene, Widget_Camera& cam, Camera& user_cam);
+    std::string render_frames(Animate& animate, Scene& scene, const std::string& output,
+                              int first, int last, float exp, bool aovs,
+                              const Image_Encoder::Options& enc,
+                              const std::function<void(float)>& progress);
 
     mutable std::mutex log_mut;
     GL::Lines ray_log;
 
     int out_w, out_h, out_samples = 32, out_area_samples = 8, out_depth = 4;
     float exposure = 1.0f;
+    PT::Pathtracer::Options options;
 
     bool has_rendered = false;
     bool render_window = false, render_window_focus = false;
@@ -60,21 +60,17 @@ struct BBox {
 
     /// Transform box by a matrix
     void transform(const Mat4& trans) {
-        Vec3 amin = min, amax = max;
-        min = max = trans[3].xyz();
-        for(int i = 0; i < 3; i++) {
-            for(int j = 0; j < 3; j++) {
-                float a = trans[j][i] * amin[j];
-                float b = trans[j][i] * amax[j];
-                if(a < b) {
-                    min[i] += a;
-                    max[i] += b;
-                } else {
-                    min[i] += b;
-                    max[i] += a;
-                }
-            }
+        // Each axis of the box stretches the result by that column's smaller
+        // and larger images
+        Vec4 lo = trans[3], hi = trans[3];
+        for(int j = 0; j < 3; j++) {
+            Vec4 a = trans[j] * min[j];
+            Vec4 b = trans[j] * max[j];
+            lo += hmin(a, b);
+            hi += hmax(a, b);
         }
+        min = lo.xyz();
+        max = hi.xyz();
     }
 
     // TODO (PathTracer): see student/bbox.cpp
@@ -135,28 +135,31 @@ struct Mat4 {
     }
     Mat4 operator*(const Mat4& m) const {
         Mat4 ret;
-        for(int i = 0; i < 4; i++) {
-            for(int j = 0; j < 4; j++) {
-                ret[i][j] = 0.0f;
-                for(int k = 0; k < 4; k++) {
-                    ret[i][j] += m[i][k] * cols[k][j];
-                }
-            }
-        }
+        for(int i = 0; i < 4; i++) ret.cols[i] = operator*(m.cols[i]);
         return ret;
     }
 
     Vec4 operator*(Vec4 v) const {
-        return v[0] * cols[0] + v[1] * cols[1] + v[2] * cols[2] + v[3] * cols[3];
+        SIMD::f4 s = v.simd();
+        SIMD::f4 r = SIMD::mul(cols[0].simd(), SIMD::splat<0>(s));
+        r = SIMD::madd(cols[1].simd(), SIMD::splat<1>(s), r);
+        r = SIMD::madd(cols[2].simd(), SIMD::splat<2>(s), r);
+        return Vec4(SIMD::madd(cols[3].simd(), SIMD::splat<3>(s), r));
     }
 
     /// Expands v to Vec4(v, 1.0), multiplies, and projects back to 3D
     Vec3 operator*(Vec3 v) const {
-        return operator*(Vec4(v, 1.0f)).project();
+        SIMD::f4 r = SIMD::mul(cols[0].simd(), SIMD::set1(v.x));
+        r = SIMD::madd(cols[1].simd(), SIMD::set1(v.y), r);
+        r = SIMD::madd(cols[2].simd(), SIMD::set1(v.z), r);
+        return Vec4(SIMD::add(r, cols[3].simd())).project();
     }
     /// Expands v to Vec4(v, 0.0), multiplies, and projects back to 3D
     Vec3 rotate(Vec3 v) const {
-        return operator*(Vec4(v, 0.0f)).xyz();
+        SIMD::f4 r = SIMD::mul(cols[0].simd(), SIMD::set1(v.x));
+        r = SIMD::madd(cols[1].simd(), SIMD::set1(v.y), r);
+        r = SIMD::madd(cols[2].simd(), SIMD::set1(v.z), r);
+        return Vec4(r).xyz();
     }
 
     /// Converts rotation (orthonormal 3x3) matrix to equivalent Euler angles
@@ -278,21 +281,88 @@ const inline Mat4 Mat4::Zero = Mat4{Vec4{0.0f, 0.0f, 0.0f, 0.0f}, Vec4{0.0f, 0.0
 
 inline Mat4 outer(Vec4 u, Vec4 v) {
     Mat4 B;
-    for(int i = 0; i < 4; i++)
-        for(int j = 0; j < 4; j++) B[i][j] = u[i] * v[j];
+    for(int i = 0; i < 4; i++) B[i] = v * u[i];
     return B;
 }
 
 inline Mat4 Mat4::transpose(const Mat4& m) {
-    Mat4 r;
-    for(int i = 0; i < 4; i++) {
-        for(int j = 0; j < 4; j++) {
-            r[i][j] = m[j][i];
-        }
-    }
-    return r;
+    SIMD::f4 c0 = m.cols[0].simd(), c1 = m.cols[1].simd();
+    SIMD::f4 c2 = m.cols[2].simd(), c3 = m.cols[3].simd();
+    SIMD::transpose(c0, c1, c2, c3);
+    return Mat4{Vec4(c0), Vec4(c1), Vec4(c2), Vec4(c3)};
+}
+
+#ifdef CARDINAL3D_SSE
+
+// Helpers for the inverse below: 2x2 matrices packed as (a, b, c, d) rows
+#define MAT4_SHUFFLE(l, r, x, y, z, w) _mm_shuffle_ps(l, r, _MM_SHUFFLE(w, z, y, x))
+#define MAT4_SWIZZLE(v, x, y, z, w) MAT4_SHUFFLE(v, v, x, y, z, w)
+
+// A * B
+inline __m128 mat2_mul(__m128 a, __m128 b) {
+    return _mm_add_ps(_mm_mul_ps(a, MAT4_SWIZZLE(b, 0, 3, 0, 3)),
+                      _mm_mul_ps(MAT4_SWIZZLE(a, 1, 0, 3, 2), MAT4_SWIZZLE(b, 2, 1, 2, 1)));
+}
+// adj(A) * B
+inline __m128 mat2_adj_mul(__m128 a, __m128 b) {
+    return _mm_sub_ps(_mm_mul_ps(MAT4_SWIZZLE(a, 3, 3, 0, 0), b),
+                      _mm_mul_ps(MAT4_SWIZZLE(a, 1, 1, 2, 2), MAT4_SWIZZLE(b, 2, 3, 0, 1)));
+}
+// A * adj(B)
+inline __m128 mat2_mul_adj(__m128 a, __m128 b) {
+    return _mm_sub_ps(_mm_mul_ps(a, MAT4_SWIZZLE(b, 3, 0, 3, 0)),
+                      _mm_mul_ps(MAT4_SWIZZLE(a, 1, 0, 3, 2), MAT4_SWIZZLE(b, 2, 1, 2, 1)));
 }
 
+// Inverts by 2x2 blocks: with M = [A B; C D], the inverse's blocks are built
+// from the blocks' adjugates and determinants. Since inverse(M^T) is
+// inverse(M)^T, it doesn't matter that the columns are read as rows.
+inline Mat4 Mat4::inverse(const Mat4& m) {
+
+    __m128 c0 = m.cols[0].simd(), c1 = m.cols[1].simd();
+    __m128 c2 = m.cols[2].simd(), c3 = m.cols[3].simd();
+
+    __m128 A = _mm_movelh_ps(c0, c1);
+    __m128 B = _mm_movehl_ps(c1, c0);
+    __m128 C = _mm_movelh_ps(c2, c3);
+    __m128 D = _mm_movehl_ps(c3, c2);
+
+    // (|A|, |B|, |C|, |D|)
+    __m128 det_sub = _mm_sub_ps(
+        _mm_mul_ps(MAT4_SHUFFLE(c0, c2, 0, 2, 0, 2), MAT4_SHUFFLE(c1, c3, 1, 3, 1, 3)),
+        _mm_mul_ps(MAT4_SHUFFLE(c0, c2, 1, 3, 1, 3), MAT4_SHUFFLE(c1, c3, 0, 2, 0, 2)));
+    __m128 det_A = MAT4_SWIZZLE(det_sub, 0, 0, 0, 0);
+    __m128 det_B = MAT4_SWIZZLE(det_sub, 1, 1, 1, 1);
+    __m128 det_C = MAT4_SWIZZLE(det_sub, 2, 2, 2, 2);
+    __m128 det_D = MAT4_SWIZZLE(det_sub, 3, 3, 3, 3);
+
+    __m128 D_C = mat2_adj_mul(D, C);
+    __m128 A_B = mat2_adj_mul(A, B);
+    __m128 X = _mm_sub_ps(_mm_mul_ps(det_D, A), mat2_mul(B, D_C));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(det_A, D), mat2_mul(C, A_B));
+    __m128 Y = _mm_sub_ps(_mm_mul_ps(det_B, C), mat2_mul_adj(D, A_B));
+    __m128 Z = _mm_sub_ps(_mm_mul_ps(det_C, B), mat2_mul_adj(A, D_C));
+
+    // |M| = |A||D| + |B||C| - tr(adj(A) B adj(D) C)
+    __m128 tr = _mm_mul_ps(A_B, MAT4_SWIZZLE(D_C, 0, 2, 1, 3));
+    __m128 det_M = _mm_add_ps(_mm_mul_ps(det_A, det_D), _mm_mul_ps(det_B, det_C));
+    det_M = _mm_sub_ps(det_M, _mm_set1_ps(SIMD::hsum(tr)));
+
+    __m128 r_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det_M);
+    X = _mm_mul_ps(X, r_det);
+    Y = _mm_mul_ps(Y, r_det);
+    Z = _mm_mul_ps(Z, r_det);
+    W = _mm_mul_ps(W, r_det);
+
+    return Mat4{Vec4(MAT4_SHUFFLE(X, Y, 3, 1, 3, 1)), Vec4(MAT4_SHUFFLE(X, Y, 2, 0, 2, 0)),
+                Vec4(MAT4_SHUFFLE(Z, W, 3, 1, 3, 1)), Vec4(MAT4_SHUFFLE(Z, W, 2, 0, 2, 0))};
+}
+
+#undef MAT4_SHUFFLE
+#undef MAT4_SWIZZLE
+
+#else
+
 inline Mat4 Mat4::inverse(const Mat4& m) {
     Mat4 r;
     r[0][0] = m[1][2] * m[2][3] * m[3][1] - m[1][3] * m[2][2] * m[3][1] +
@@ -347,6 +417,8 @@ inline Mat4 Mat4::inverse(const Mat4& m) {
     return r;
 }
 
+#endif
+
 inline Mat4 Mat4::rotate_to(Vec3 dir) {
 
     dir.normalize();
@@ -0,0 +1,160 @@
+
+#pragma once
+
+// Four-float vectors backing Vec4 and Mat4. Every x86-64 CPU has SSE2, so
+// that's used unless CARDINAL3D_SCALAR_MATH is defined; elsewhere the same
+// functions are plain loops.
+#if !defined(CARDINAL3D_SCALAR_MATH) &&                                                            \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CARDINAL3D_SSE
+#include <immintrin.h>
+#endif
+
+namespace SIMD {
+
+#ifdef CARDINAL3D_SSE
+
+using f4 = __m128;
+
+inline f4 load(const float* p) {
+    return _mm_load_ps(p);
+}
+inline void store(float* p, f4 v) {
+    _mm_store_ps(p, v);
+}
+inline f4 set(float x, float y, float z, float w) {
+    return _mm_setr_ps(x, y, z, w);
+}
+inline f4 set1(float s) {
+    return _mm_set1_ps(s);
+}
+
+inline f4 add(f4 a, f4 b) {
+    return _mm_add_ps(a, b);
+}
+inline f4 sub(f4 a, f4 b) {
+    return _mm_sub_ps(a, b);
+}
+inline f4 mul(f4 a, f4 b) {
+    return _mm_mul_ps(a, b);
+}
+inline f4 div(f4 a, f4 b) {
+    return _mm_div_ps(a, b);
+}
+inline f4 min(f4 a, f4 b) {
+    return _mm_min_ps(a, b);
+}
+inline f4 max(f4 a, f4 b) {
+    return _mm_max_ps(a, b);
+}
+inline f4 neg(f4 a) {
+    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+}
+/// a * b + c
+inline f4 madd(f4 a, f4 b, f4 c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+/// Component i copied to all four
+template<int i> inline f4 splat(f4 v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i));
+}
+
+/// Sum of all four components
+inline float hsum(f4 v) {
+    f4 s = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    s = _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(s);
+}
+
+inline void transpose(f4& a, f4& b, f4& c, f4& d) {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+/// Bit i set where a[i] <= b[i]
+inline int le_mask(f4 a, f4 b) {
+    return _mm_movemask_ps(_mm_cmple_ps(a, b));
+}
+
+#else
+
+struct f4 {
+    float v[4];
+};
+
+inline f4 load(const float* p) {
+    return f4{{p[0], p[1], p[2], p[3]}};
+}
+inline void store(float* p, f4 v) {
+    for(int i = 0; i < 4; i++) p[i] = v.v[i];
+}
+inline f4 set(float x, float y, float z, float w) {
+    return f4{{x, y, z, w}};
+}
+inline f4 set1(float s) {
+    return f4{{s, s, s, s}};
+}
+
+#define SIMD_LANES(expr)                                                                           \
+    f4 r;                                                                                          \
+    for(int i = 0; i < 4; i++) r.v[i] = expr;                                                      \
+    return r;
+
+inline f4 add(f4 a, f4 b) {
+    SIMD_LANES(a.v[i] + b.v[i])
+}
+inline f4 sub(f4 a, f4 b) {
+    SIMD_LANES(a.v[i] - b.v[i])
+}
+inline f4 mul(f4 a, f4 b) {
+    SIMD_LANES(a.v[i] * b.v[i])
+}
+inline f4 div(f4 a, f4 b) {
+    SIMD_LANES(a.v[i] / b.v[i])
+}
+inline f4 min(f4 a, f4 b) {
+    SIMD_LANES(b.v[i] < a.v[i] ? b.v[i] : a.v[i])
+}
+inline f4 max(f4 a, f4 b) {
+    SIMD_LANES(b.v[i] > a.v[i] ? b.v[i] : a.v[i])
+}
+inline f4 neg(f4 a) {
+    SIMD_LANES(-a.v[i])
+}
+/// a * b + c
+inline f4 madd(f4 a, f4 b, f4 c) {
+    SIMD_LANES(a.v[i] * b.v[i] + c.v[i])
+}
+
+#undef SIMD_LANES
+
+/// Component i copied to all four
+template<int i> inline f4 splat(f4 v) {
+    return set1(v.v[i]);
+}
+
+/// Sum of all four components
+inline float hsum(f4 v) {
+    return (v.v[0] + v.v[1]) + (v.v[2] + v.v[3]);
+}
+
+inline void transpose(f4& a, f4& b, f4& c, f4& d) {
+    f4 t[4] = {a, b, c, d};
+    for(int i = 0; i < 4; i++) {
+        a.v[i] = t[i].v[0];
+        b.v[i] = t[i].v[1];
+        c.v[i] = t[i].v[2];
+        d.v[i] = t[i].v[3];
+    }
+}
+
+/// Bit i set where a[i] <= b[i]
+inline int le_mask(f4 a, f4 b) {
+    int m = 0;
+    for(int i = 0; i < 4; i++) m |= (a.v[i] <= b.v[i]) << i;
+    return m;
+}
+
+#endif
+
+} // namespace SIMD
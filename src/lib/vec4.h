@@ -6,9 +6,11 @@
 #include <ostream>
 
 #include "log.h"
+#include "simd.h"
 #include "vec3.h"
 
-struct Vec4 {
+// Aligned so the four floats load straight into a SIMD register
+struct alignas(16) Vec4 {
 
     Vec4() {
         x = 0.0f;
@@ -37,11 +39,18 @@ struct Vec4 {
         z = xyz.z;
         w = _w;
     }
+    explicit Vec4(SIMD::f4 v) {
+        SIMD::store(data, v);
+    }
 
     Vec4(const Vec4&) = default;
     Vec4& operator=(const Vec4&) = default;
     ~Vec4() = default;
 
+    SIMD::f4 simd() const {
+        return SIMD::load(data);
+    }
+
     float& operator[](int idx) {
         assert(idx >= 0 && idx <= 3);
         return data[idx];
@@ -52,87 +61,63 @@ struct Vec4 {
     }
 
     Vec4 operator+=(Vec4 v) {
-        x += v.x;
-        y += v.y;
-        z += v.z;
-        w += v.w;
+        *this = Vec4(SIMD::add(simd(), v.simd()));
         return *this;
     }
     Vec4 operator-=(Vec4 v) {
-        x -= v.x;
-        y -= v.y;
-        z -= v.z;
-        w -= v.w;
+        *this = Vec4(SIMD::sub(simd(), v.simd()));
         return *this;
     }
     Vec4 operator*=(Vec4 v) {
-        x *= v.x;
-        y *= v.y;
-        z *= v.z;
-        w *= v.w;
+        *this = Vec4(SIMD::mul(simd(), v.simd()));
         return *this;
     }
     Vec4 operator/=(Vec4 v) {
-        x /= v.x;
-        y /= v.y;
-        z /= v.z;
-        w /= v.w;
+        *this = Vec4(SIMD::div(simd(), v.simd()));
         return *this;
     }
 
     Vec4 operator+=(float s) {
-        x += s;
-        y += s;
-        z += s;
-        w += s;
+        *this = Vec4(SIMD::add(simd(), SIMD::set1(s)));
         return *this;
     }
     Vec4 operator-=(float s) {
-        x -= s;
-        y -= s;
-        z -= s;
-        w -= s;
+        *this = Vec4(SIMD::sub(simd(), SIMD::set1(s)));
         return *this;
     }
     Vec4 operator*=(float s) {
-        x *= s;
-        y *= s;
-        z *= s;
-        w *= s;
+        *this = Vec4(SIMD::mul(simd(), SIMD::set1(s)));
         return *this;
     }
     Vec4 operator/=(float s) {
-        x /= s;
-        y /= s;
-        z /= s;
-        w /= s;
+        *this = Vec4(SIMD::div(simd(), SIMD::set1(s)));
         return *this;
     }
 
     Vec4 operator+(Vec4 v) const {
-        return Vec4(x + v.x, y + v.y, z + v.z, w + v.w);
+        return Vec4(SIMD::add(simd(), v.simd()));
     }
     Vec4 operator-(Vec4 v) const {
-        return Vec4(x - v.x, y - v.y, z - v.z, w - v.w);
+        return Vec4(SIMD::sub(simd(), v.simd()));
     }
     Vec4 operator*(Vec4 v) const {
-        return Vec4(x * v.x, y * v.y, z * v.z, w * v.w);
+        return Vec4(SIMD::mul(simd(), v.simd()));
     }
     Vec4 operator/(Vec4 v) const {
-        return Vec4(x / v.x, y / v.y, z / v.z, w / v.w);
+        return Vec4(SIMD::div(simd(), v.simd()));
     }
 
     Vec4 operator+(float s) const {
-        return Vec4(x + s, y + s, z + s, w + s);
+        return Vec4(SIMD::add(simd(), SIMD::set1(s)));
     }
     Vec4 operator-(float s) const {
-        return Vec4(x - s, y - s, z - s, w - s);
+        return Vec4(SIMD::sub(simd(), SIMD::set1(s)));
     }
     Vec4 operator*(float s) const {
-        return Vec4(x * s, y * s, z * s, w * s);
+        return Vec4(SIMD::mul(simd(), SIMD::set1(s)));
     }
     Vec4 operator/(float s) const {
-        return Vec4(x / s, y / s, z / s, w / s);
+        return Vec4(SIMD::div(simd(), SIMD::set1(s)));
     }
 
     bool operator==(Vec4 v) const {
@@ -148,7 +133,7 @@ struct Vec4 {
     }
     /// Negation
     Vec4 operator-() const {
-        return Vec4(-x, -y, -z, -w);
+        return Vec4(SIMD::neg(simd()));
     }
     /// Are all members real numbers?
     bool valid() const {
@@ -158,21 +143,16 @@ struct Vec4 {
 
     /// Modify vec to have unit length
     Vec4 normalize() {
-        float n = norm();
-        x /= n;
-        y /= n;
-        z /= n;
-        w /= n;
+        *this = unit();
         return *this;
     }
     /// Return unit length vec in the same direction
     Vec4 unit() const {
-        float n = norm();
-        return Vec4(x / n, y / n, z / n, w / n);
+        return Vec4(SIMD::div(simd(), SIMD::set1(norm())));
     }
 
     float norm_squared() const {
-        return x * x + y * y + z * z + w * w;
+        return SIMD::hsum(SIMD::mul(simd(), simd()));
     }
     float norm() const {
         return std::sqrt(norm_squared());
@@ -184,7 +164,7 @@ struct Vec4 {
     }
     /// Performs perspective division (xyz/w)
     Vec3 project() const {
-        return Vec3(x / w, y / w, z / w);
+        return Vec4(SIMD::div(simd(), SIMD::splat<3>(simd()))).xyz();
     }
 
     union {
@@ -199,30 +179,30 @@ struct Vec4 {
 };
 
 inline Vec4 operator+(float s, Vec4 v) {
-    return Vec4(v.x + s, v.y + s, v.z + s, v.w + s);
+    return v + s;
 }
 inline Vec4 operator-(float s, Vec4 v) {
-    return Vec4(v.x - s, v.y - s, v.z - s, v.w - s);
+    return v - s;
 }
 inline Vec4 operator*(float s, Vec4 v) {
-    return Vec4(v.x * s, v.y * s, v.z * s, v.w * s);
+    return v * s;
 }
 inline Vec4 operator/(float s, Vec4 v) {
-    return Vec4(s / v.x, s / v.y, s / v.z, s / v.w);
+    return Vec4(SIMD::div(SIMD::set1(s), v.simd()));
 }
 
 /// Take minimum of each component
 inline Vec4 hmin(Vec4 l, Vec4 r) {
-    return Vec4(std::min(l.x, r.x), std::min(l.y, r.y), std::min(l.z, r.z), std::min(l.w, r.w));
+    return Vec4(SIMD::min(l.simd(), r.simd()));
 }
 /// Take maximum of each component
 inline Vec4 hmax(Vec4 l, Vec4 r) {
-    return Vec4(std::max(l.x, r.x), std::max(l.y, r.y), std::max(l.z, r.z), std::max(l.w, r.w));
+    return Vec4(SIMD::max(l.simd(), r.simd()));
 }
 
 /// 4D dot product
 inline float dot(Vec4 l, Vec4 r) {
-    return l.x * r.x + l.y * r.y + l.z * r.z + l.w * r.w;
+    return SIMD::hsum(SIMD::mul(l.simd(), r.simd()));
 }
 
 inline std::ostream& operator<<(std::ostream& out, Vec4 v) {
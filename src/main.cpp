@@ -1,6 +1,8 @@
 
 #include "platform/platform.h"
+#include "util/affinity.h"
 #include "util/rand.h"
+#include "util/thread_pool.h"
 #include <sf_libs/CLI11.hpp>
 
 int main(int argc, char** argv) {
@@ -15,6 +17,14 @@ int main(int argc, char** argv) {
     args.add_flag("--headless", settings.headless, "Path-trace scene without opening the GUI");
     args.add_option("-o,--output", settings.output_file, "Image file to write (if headless)");
     args.add_flag("--animate", settings.animate, "Output animation frames (if headless)");
+    args.add_option("--jobs", settings.jobs,
+                    "Render the stills listed in this JSON file, loading each scene once; "
+                    "implies --headless");
+    args.add_option("--serve", settings.serve,
+                    "Keep scenes loaded and render them on request from this UNIX socket path; "
+                    "implies --headless");
+    args.add_option("--frames", settings.frames,
+                    "Only output frames a up to but not including b, given as a:b (if animating)");
     args.add_option("--width", settings.w, "Output image width (if headless)");
     args.add_option("--height", settings.h, "Output image height (if headless)");
     args.add_flag("--use_ar", settings.w_from_ar,
@@ -23,9 +33,74 @@ int main(int argc, char** argv) {
     args.add_option("--samples", settings.s, "Pixel samples (if headless)");
     args.add_option("--exposure", settings.exp, "Output exposure (if headless)");
     args.add_option("--area_samples", settings.ls, "Area light samples (if headless)");
+    args.add_flag("--path_guiding", settings.tracer.guiding,
+                  "Learn where light comes from and importance sample it (if headless)");
+    args.add_option("--caustic_photons", settings.tracer.caustic_photons,
+                    "Caustic photons traced per render epoch, 0 for none (if headless)");
+    args.add_option("--photon_memory", settings.tracer.photon_memory,
+                    "Megabytes of caustic photons kept across render threads (if headless)");
+    args.add_option("--profile", settings.tracer.profile,
+                    "Write scene build phase timings here, as a Chrome trace (if headless)");
+    args.add_option("--tile_size", settings.tracer.tile_size,
+                    "Render in tiles of this many pixels square, kept on disk until written as "
+                    "an uncompressed PNG; for images too big for memory (if headless)");
+    args.add_flag("--denoise", settings.tracer.denoise,
+                  "Filter the output guided by albedo, normals and depth (if headless)");
+    args.add_flag("--aovs", settings.aovs,
+                  "Also write depth, normal, albedo, ID and lighting passes to a multi-layer "
+                  "EXR next to each output image (if headless)");
+    args.add_option("--checkpoint", settings.tracer.checkpoint,
+                    "File to periodically save the render to (if headless)");
+    args.add_option("--checkpoint_every", settings.tracer.checkpoint_interval,
+                    "Seconds between checkpoints (if headless)");
+    args.add_flag("--resume", settings.resume,
+                  "Continue the render saved in the checkpoint file (if headless)");
+    args.add_flag("--coordinate", settings.farm.coordinate,
+                  "Split the render between worker processes (if headless)");
+    args.add_option("--port", settings.farm.port,
+                    "Port the coordinator listens on, 0 for any (if headless)");
+    args.add_option("--local_workers", settings.farm.local_workers,
+                    "Worker processes to start on this machine; implies --coordinate (if headless)");
+    args.add_flag("--remote_workers", settings.farm.remote,
+                  "Also take workers from other machines, as the coordinator always does "
+                  "without --local_workers (if headless)");
+    args.add_option("--chunk_timeout", settings.farm.chunk_timeout,
+                    "Seconds a worker may go quiet before its samples go to another, 0 for "
+                    "never (if headless)");
+    args.add_option("--worker", settings.farm.worker,
+                    "Render for the coordinator at host:port (if headless)");
+
+    std::map<std::string, Image_Format> formats = {
+        {"png", Image_Format::png}, {"png_fast", Image_Format::png_fast},
+        {"png_raw", Image_Format::png_raw}, {"exr", Image_Format::exr},
+        {"y4m", Image_Format::y4m}, {"rgb", Image_Format::rgb}};
+    args.add_option("--format", settings.encoder.format,
+                    "Output format; y4m and rgb write every frame to one stream at --output, "
+                    "which may be a pipe (if headless)")
+        ->transform(CLI::CheckedTransformer(formats, CLI::ignore_case));
+    args.add_option("--encoders", settings.encoder.threads,
+                    "Threads encoding output images (if headless)");
+    args.add_option("--snapshot_every", settings.snapshot_every,
+                    "Seconds between writing the render so far to the output (if headless)");
+    args.add_flag("--snapshot_numbered", settings.snapshot_numbered,
+                  "Write each snapshot to its own numbered file instead (if headless)");
+
+    size_t threads = 0;
+    args.add_option("--threads", threads, "Render threads (default: one per core)");
+    bool pin_threads = false;
+    args.add_flag("--pin_threads", pin_threads,
+                  "Pin render threads to cores and give each NUMA node its own copy of the "
+                  "scene; no effect beyond pinning with one node");
 
     CLI11_PARSE(args, argc, argv);
 
+    Thread_Pool::set_default_threads(threads);
+    Affinity::enable(pin_threads);
+
+    settings.farm.command.assign(argv, argv + argc);
+    if(settings.farm.local_workers) settings.farm.coordinate = true;
+    if(!settings.jobs.empty() || !settings.serve.empty()) settings.headless = true;
+
     if(!settings.headless) {
         Platform plt;
         App app(settings, &plt);
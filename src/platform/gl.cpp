@@ -2,6 +2,7 @@
 #include "gl.h"
 #include "../lib/log.h"
 
+#include <cstddef>
 #include <fstream>
 
 namespace GL {
@@ -361,7 +362,7 @@ void Instances::create() {
     for(int i = 0; i < 4; i++) {
         glEnableVertexAttribArray(base_idx + i);
         glVertexAttribPointer(base_idx + i, 4, GL_FLOAT, GL_FALSE, sizeof(Info),
-                              (void*)(sizeof(GLuint) + sizeof(Vec4) * i));
+                              (void*)(offsetof(Info, transform) + sizeof(Vec4) * i));
         glVertexAttribDivisor(base_idx + i, 1);
     }
     glBindVertexArray(0);
@@ -0,0 +1,313 @@
+
+#include "ipc.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+#ifdef _WIN32
+static void net_init() {
+    static bool once = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    (void)once;
+}
+static void close_socket(unsigned long long s) {
+    closesocket((SOCKET)s);
+}
+#else
+static void net_init() {
+}
+static void close_socket(int s) {
+    ::close(s);
+}
+#endif
+
+Socket::~Socket() {
+    close();
+}
+
+Socket::Socket(Socket&& src) : handle(src.handle) {
+    src.handle = invalid;
+}
+
+Socket& Socket::operator=(Socket&& src) {
+    std::swap(handle, src.handle);
+    src.close();
+    return *this;
+}
+
+void Socket::close() {
+    if(handle != invalid) close_socket(handle);
+    handle = invalid;
+}
+
+bool Socket::valid() const {
+    return handle != invalid;
+}
+
+std::string Socket::listen(unsigned short port, bool loopback) {
+
+    net_init();
+    close();
+
+    handle = (Handle)::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(handle == invalid) return "Failed to create socket.";
+
+    int yes = 1;
+    setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK : INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if(::bind(handle, (sockaddr*)&addr, sizeof(addr)) || ::listen(handle, 16)) {
+        close();
+        return "Failed to listen on port " + std::to_string(port) + ".";
+    }
+    return {};
+}
+
+std::string Socket::listen_local(const std::string& path) {
+
+#ifdef _WIN32
+    return "Local sockets aren't supported on this platform.";
+#else
+    close();
+
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) return "Socket path " + path + " is too long.";
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(handle == invalid) return "Failed to create socket.";
+
+    ::unlink(path.c_str());
+    if(::bind(handle, (sockaddr*)&addr, sizeof(addr)) || ::listen(handle, 16)) {
+        close();
+        return "Failed to listen at " + path + ".";
+    }
+    return {};
+#endif
+}
+
+std::string Socket::connect(const std::string& host, unsigned short port) {
+
+    net_init();
+    close();
+
+    addrinfo hints, *found = nullptr;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) || !found) {
+        return "Failed to resolve " + host + ".";
+    }
+
+    handle = (Handle)::socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    bool ok = handle != invalid && ::connect(handle, found->ai_addr, (int)found->ai_addrlen) == 0;
+    freeaddrinfo(found);
+    if(!ok) {
+        close();
+        return "Failed to connect to " + host + ":" + std::to_string(port) + ".";
+    }
+
+    // Messages are sent header first, which Nagle would hold back
+    int yes = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+    setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&yes, sizeof(yes));
+#endif
+    return {};
+}
+
+Socket Socket::accept(int timeout_ms) {
+
+    Socket ret;
+    if(handle == invalid) return ret;
+
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(handle, &set);
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if(select((int)handle + 1, &set, nullptr, nullptr, &tv) <= 0) return ret;
+
+    ret.handle = (Handle)::accept(handle, nullptr, nullptr);
+    if(ret.handle != invalid) {
+        int yes = 1;
+        setsockopt(ret.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+        setsockopt(ret.handle, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&yes, sizeof(yes));
+#endif
+    }
+    return ret;
+}
+
+unsigned short Socket::port() const {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if(handle == invalid || getsockname(handle, (sockaddr*)&addr, &len)) return 0;
+    return ntohs(addr.sin_port);
+}
+
+bool Socket::send(const void* data, size_t bytes) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char* p = static_cast<const char*>(data);
+    while(bytes) {
+        int chunk = (int)std::min(bytes, (size_t)1 << 30);
+        auto sent = ::send(handle, p, chunk, flags);
+        if(sent <= 0) return false;
+        p += sent;
+        bytes -= sent;
+    }
+    return true;
+}
+
+bool Socket::recv(void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while(bytes) {
+        int chunk = (int)std::min(bytes, (size_t)1 << 30);
+        auto got = ::recv(handle, p, chunk, 0);
+        if(got <= 0) return false;
+        p += got;
+        bytes -= got;
+    }
+    return true;
+}
+
+void Socket::set_timeout(int timeout_ms) {
+#ifdef _WIN32
+    DWORD ms = (DWORD)timeout_ms;
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (const char*)&ms, sizeof(ms));
+#else
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+Process::~Process() {
+    wait();
+}
+
+#ifdef _WIN32
+
+Process::Process(Process&& src) : handle(src.handle) {
+    src.handle = nullptr;
+}
+
+Process& Process::operator=(Process&& src) {
+    std::swap(handle, src.handle);
+    src.wait();
+    return *this;
+}
+
+std::string Process::start(const std::vector<std::string>& args) {
+
+    wait();
+
+    std::string cmd;
+    for(const std::string& arg : args) {
+        if(!cmd.empty()) cmd += ' ';
+        cmd += '"' + arg + '"';
+    }
+
+    STARTUPINFOA startup;
+    PROCESS_INFORMATION info_;
+    std::memset(&startup, 0, sizeof(startup));
+    startup.cb = sizeof(startup);
+    if(!CreateProcessA(nullptr, &cmd[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup,
+                       &info_)) {
+        return "Failed to start " + args[0] + ".";
+    }
+    CloseHandle(info_.hThread);
+    handle = info_.hProcess;
+    return {};
+}
+
+bool Process::running() {
+    return handle && WaitForSingleObject(handle, 0) == WAIT_TIMEOUT;
+}
+
+void Process::wait() {
+    if(!handle) return;
+    WaitForSingleObject(handle, INFINITE);
+    CloseHandle(handle);
+    handle = nullptr;
+}
+
+#else
+
+Process::Process(Process&& src) : pid(src.pid) {
+    src.pid = -1;
+}
+
+Process& Process::operator=(Process&& src) {
+    std::swap(pid, src.pid);
+    src.wait();
+    return *this;
+}
+
+std::string Process::start(const std::vector<std::string>& args) {
+
+    wait();
+
+    std::vector<char*> argv;
+    for(const std::string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t child;
+    if(posix_spawnp(&child, argv[0], nullptr, nullptr, argv.data(), environ)) {
+        return "Failed to start " + args[0] + ".";
+    }
+    pid = (int)child;
+    return {};
+}
+
+bool Process::running() {
+    if(pid < 0) return false;
+    int status;
+    if(waitpid(pid, &status, WNOHANG) == 0) return true;
+    pid = -1;
+    return false;
+}
+
+void Process::wait() {
+    if(pid < 0) return;
+    int status;
+    waitpid(pid, &status, 0);
+    pid = -1;
+}
+
+#endif
@@ -0,0 +1,71 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Blocking TCP or UNIX domain connection, or a listening socket
+class Socket {
+public:
+    Socket() = default;
+    ~Socket();
+
+    Socket(const Socket& src) = delete;
+    Socket& operator=(const Socket& src) = delete;
+    Socket(Socket&& src);
+    Socket& operator=(Socket&& src);
+
+    // Each returns an error message, or an empty string on success
+    // 0 picks a free port; with loopback, only this machine can connect
+    std::string listen(unsigned short port, bool loopback = false);
+    std::string connect(const std::string& host, unsigned short port);
+    // Listens at a path only this machine can reach, replacing any stale socket there
+    std::string listen_local(const std::string& path);
+
+    // Waits up to timeout_ms for a connection; returns an invalid socket if none came
+    Socket accept(int timeout_ms);
+
+    // Send or receive exactly this many bytes; false if the connection is gone
+    bool send(const void* data, size_t bytes);
+    bool recv(void* data, size_t bytes);
+    // recv fails once no data has come for this long; 0 waits forever
+    void set_timeout(int timeout_ms);
+
+    bool valid() const;
+    unsigned short port() const;
+    void close();
+
+private:
+#ifdef _WIN32
+    using Handle = unsigned long long;
+    static const Handle invalid = ~0ull;
+#else
+    using Handle = int;
+    static const Handle invalid = -1;
+#endif
+    Handle handle = invalid;
+};
+
+// Child process running another program
+class Process {
+public:
+    Process() = default;
+    ~Process();
+
+    Process(const Process& src) = delete;
+    Process& operator=(const Process& src) = delete;
+    Process(Process&& src);
+    Process& operator=(Process&& src);
+
+    // args[0] is the program, searched for on the PATH
+    std::string start(const std::vector<std::string>& args);
+    bool running();
+    void wait();
+
+private:
+#ifdef _WIN32
+    void* handle = nullptr;
+#else
+    int pid = -1;
+#endif
+};
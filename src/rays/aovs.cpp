@@ -0,0 +1,117 @@
+
+#include "aovs.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include <sf_libs/tinyexr.h>
+
+namespace PT {
+
+void Feature_Buffer::resize(size_t _w, size_t _h) {
+    w = _w;
+    h = _h;
+    albedo.assign(w * h, Spectrum{});
+    direct.assign(w * h, Spectrum{});
+    indirect.assign(w * h, Spectrum{});
+    normal.assign(w * h, Vec3{});
+    depth.assign(w * h, 0.0f);
+    luma_sq.assign(w * h, 0.0f);
+    object_id.assign(w * h, 0);
+    material_id.assign(w * h, 0);
+}
+
+void Feature_Buffer::clear() {
+    resize(w, h);
+}
+
+std::string write_aovs(const std::string& file, const HDR_Image& beauty,
+                       const Feature_Buffer& features) {
+
+    const auto [w, h] = beauty.dimension();
+    if(w == 0 || h == 0) return "Nothing has been rendered.";
+    if(features.w != w || features.h != h) return "AOV buffers don't match the image size.";
+
+    struct Channel {
+        std::string name;
+        std::vector<float> floats;
+        std::vector<unsigned int> uints;
+    };
+    std::vector<Channel> channels;
+
+    // EXR stores the top row first, our images the bottom row
+    auto add_float = [&, w = w, h = h](std::string name, std::function<float(size_t)> get) {
+        Channel c{name, std::vector<float>(w * h), {}};
+        for(size_t j = 0; j < h; j++)
+            for(size_t i = 0; i < w; i++) c.floats[j * w + i] = get((h - j - 1) * w + i);
+        channels.push_back(std::move(c));
+    };
+    auto add_uint = [&, w = w, h = h](std::string name, const std::vector<unsigned int>& src) {
+        Channel c{name, {}, std::vector<unsigned int>(w * h)};
+        for(size_t j = 0; j < h; j++)
+            for(size_t i = 0; i < w; i++) c.uints[j * w + i] = src[(h - j - 1) * w + i];
+        channels.push_back(std::move(c));
+    };
+    auto add_rgb = [&](std::string layer, const std::function<Spectrum(size_t)>& get) {
+        add_float(layer + "R", [&](size_t i) { return get(i).r; });
+        add_float(layer + "G", [&](size_t i) { return get(i).g; });
+        add_float(layer + "B", [&](size_t i) { return get(i).b; });
+    };
+
+    add_rgb("", [&](size_t i) { return beauty.at(i); });
+    add_rgb("albedo.", [&](size_t i) { return features.albedo[i]; });
+    add_rgb("direct.", [&](size_t i) { return features.direct[i]; });
+    add_rgb("indirect.", [&](size_t i) { return features.indirect[i]; });
+    add_float("normal.X", [&](size_t i) { return features.normal[i].x; });
+    add_float("normal.Y", [&](size_t i) { return features.normal[i].y; });
+    add_float("normal.Z", [&](size_t i) { return features.normal[i].z; });
+    add_float("Z", [&](size_t i) { return features.depth[i]; });
+    add_uint("material_id", features.material_id);
+    add_uint("object_id", features.object_id);
+
+    // Readers expect channels sorted by name
+    std::sort(channels.begin(), channels.end(),
+              [](const Channel& l, const Channel& r) { return l.name < r.name; });
+
+    size_t n = channels.size();
+    std::vector<EXRChannelInfo> channel_info(n);
+    std::vector<int> types(n);
+    std::vector<unsigned char*> images(n);
+    for(size_t c = 0; c < n; c++) {
+        std::memset(&channel_info[c], 0, sizeof(EXRChannelInfo));
+        std::strncpy(channel_info[c].name, channels[c].name.c_str(), 255);
+        if(channels[c].uints.empty()) {
+            types[c] = TINYEXR_PIXELTYPE_FLOAT;
+            images[c] = reinterpret_cast<unsigned char*>(channels[c].floats.data());
+        } else {
+            types[c] = TINYEXR_PIXELTYPE_UINT;
+            images[c] = reinterpret_cast<unsigned char*>(channels[c].uints.data());
+        }
+    }
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = (int)n;
+    header.channels = channel_info.data();
+    header.pixel_types = types.data();
+    header.requested_pixel_types = types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    EXRImage image;
+    InitEXRImage(&image);
+    image.images = images.data();
+    image.width = (int)w;
+    image.height = (int)h;
+    image.num_channels = (int)n;
+
+    const char* err = nullptr;
+    if(SaveEXRImageToFile(&image, &header, file.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::string msg = err ? err : "Unknown failure.";
+        if(err) FreeEXRErrorMessage(err);
+        return msg;
+    }
+    return {};
+}
+
+} // namespace PT
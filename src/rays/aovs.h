@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+#include "../util/hdr_image.h"
+
+namespace PT {
+
+// What a camera sample saw at its first hit. Misses leave the surface fields
+// zero. `direct` is emission plus light sampling at the first hit, without MIS
+// weights, so it is an unbiased estimate of direct lighting on its own; the
+// rest of the sample's radiance is indirect.
+struct Hit_Features {
+    Spectrum albedo, direct;
+    Vec3 normal;
+    float depth = 0.0f;
+    unsigned int object_id = 0;   // Scene_ID of the object, 0 for none
+    unsigned int material_id = 0; // material index + 1, 0 for none
+};
+
+// Per-pixel first-hit features, averaged over samples the same way as the image.
+// IDs can't be averaged, so each pixel keeps the first nonzero ID it sees.
+// luma_sq is the mean squared luminance of each accumulated epoch, from which
+// the denoiser estimates how noisy each pixel still is.
+struct Feature_Buffer {
+
+    void resize(size_t w, size_t h);
+    void clear();
+
+    size_t w = 0, h = 0;
+    std::vector<Spectrum> albedo, direct, indirect;
+    std::vector<Vec3> normal;
+    std::vector<float> depth, luma_sq;
+    std::vector<unsigned int> object_id, material_id;
+};
+
+// Write the image and every feature as one multi-channel float EXR. Returns an
+// error message, or an empty string on success.
+std::string write_aovs(const std::string& file, const HDR_Image& beauty,
+                       const Feature_Buffer& features);
+
+} // namespace PT
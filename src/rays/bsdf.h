@@ -30,9 +30,10 @@ struct BSDF_Lambertian {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum albedo;
-    Samplers::Hemisphere::Uniform sampler;
+    Samplers::Hemisphere::Cosine sampler;
 };
 
 struct BSDF_Mirror {
@@ -42,6 +43,7 @@ struct BSDF_Mirror {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum reflectance;
 };
@@ -54,6 +56,7 @@ struct BSDF_Refract {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum transmittance;
     float index_of_refraction;
@@ -67,6 +70,7 @@ struct BSDF_Glass {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum transmittance;
     Spectrum reflectance;
@@ -80,6 +84,7 @@ struct BSDF_Diffuse {
 
     BSDF_Sample sample(Vec3 out_dir) const;
     Spectrum evaluate(Vec3 out_dir, Vec3 in_dir) const;
+    float pdf(Vec3 out_dir, Vec3 in_dir) const;
 
     Spectrum radiance;
     Samplers::Hemisphere::Uniform sampler;
@@ -114,6 +119,14 @@ public:
             underlying);
     }
 
+    // Solid angle density with which sample(out_dir) returns in_dir. Always
+    // zero for discrete BSDFs.
+    float pdf(Vec3 out_dir, Vec3 in_dir) const {
+        return std::visit(
+            overloaded{[&out_dir, &in_dir](const auto& b) { return b.pdf(out_dir, in_dir); }},
+            underlying);
+    }
+
     bool is_discrete() const {
         return std::visit(overloaded{[](const BSDF_Lambertian&) { return false; },
                                      [](const BSDF_Mirror&) { return true; },
@@ -123,6 +136,14 @@ public:
                           underlying);
     }
 
+    // Surface color, used to guide denoising. Dielectrics and emitters count as white.
+    Spectrum albedo() const {
+        return std::visit(overloaded{[](const BSDF_Lambertian& b) { return b.albedo; },
+                                     [](const BSDF_Mirror& b) { return b.reflectance; },
+                                     [](const auto&) { return Spectrum(1.0f); }},
+                          underlying);
+    }
+
     bool is_sided() const {
         return std::visit(overloaded{[](const BSDF_Lambertian&) { return false; },
                                      [](const BSDF_Mirror&) { return false; },
@@ -4,6 +4,7 @@
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
+#include "packet.h"
 #include "trace.h"
 
 namespace PT {
@@ -25,7 +26,24 @@ public:
     void hit_subtree(const Ray& ray, size_t node_addr, Trace& closest) const;
     Trace hit(const Ray& ray) const;
 
+    // Merges each ray's closest hit in the packet into closest[i]
+    void hit(const Ray_Packet& packet, Trace* closest) const;
+    void hit_subtree(const Ray_Packet& packet, unsigned int mask, size_t node_addr,
+                     Trace* closest) const;
+
     BVH copy() const;
+
+    // Primitives by index, in the order the tree keeps them, so a hit can
+    // refer back to its primitive
+    const Primitive& primitive(size_t i) const {
+        return primitives[i];
+    }
+    size_t n_primitives() const {
+        return primitives.size();
+    }
+    template<typename F> void for_each(F&& f) {
+        for(size_t i = 0; i < primitives.size(); i++) f(primitives[i], i);
+    }
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
     std::vector<Primitive> destructure();
@@ -54,3 +72,5 @@ private:
 #else
 #include "../student/bvh.inl"
 #endif
+
+#include "bvh_packet.inl"
@@ -0,0 +1,50 @@
+
+#include "../rays/bvh.h"
+
+namespace PT {
+
+template<typename Primitive>
+void BVH<Primitive>::hit_subtree(const Ray_Packet& packet, unsigned int mask, size_t node_addr,
+                                 Trace* closest) const {
+
+    const Node& n = nodes[node_addr];
+    mask = packet.hits(n.bbox, mask, closest);
+    if(!mask) return;
+
+    // The rays have diverged: finish this subtree with whichever is left
+    if(Ray_Packet::count(mask) < Ray_Packet::min_active) {
+        for(size_t i = 0; i < packet.size(); i++) {
+            if(mask >> i & 1) hit_subtree(packet[i], node_addr, closest[i]);
+        }
+        return;
+    }
+
+    if(n.is_leaf()) {
+        for(size_t idx = n.start; idx < n.start + n.size && mask; idx++) {
+            Packet_Hit<Primitive>::hit(primitives[idx], packet, mask, closest);
+            mask = packet.pending(mask, closest);
+        }
+        return;
+    }
+
+    // Visit the child nearer along the first ray first, so the other is more
+    // often culled by the hits found there
+    size_t first = 0;
+    while(!(mask >> first & 1)) first++;
+    size_t near = n.l, far = n.r;
+    if(dot(nodes[n.r].bbox.center() - nodes[n.l].bbox.center(), packet[first].dir) < 0.0f) {
+        std::swap(near, far);
+    }
+    hit_subtree(packet, mask, near, closest);
+    mask = packet.pending(mask, closest);
+    if(mask) hit_subtree(packet, mask, far, closest);
+}
+
+template<typename Primitive>
+void BVH<Primitive>::hit(const Ray_Packet& packet, Trace* closest) const {
+    if(nodes.empty()) return;
+    unsigned int mask = packet.pending(packet.all(), closest);
+    if(mask) hit_subtree(packet, mask, root_idx, closest);
+}
+
+} // namespace PT
@@ -0,0 +1,176 @@
+
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace PT {
+
+static const char magic[8] = {'C', '3', 'D', 'C', 'K', 'P', 'T', '1'};
+
+template<typename T> static void put(std::ostream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+template<typename T> static void put(std::ostream& out, const std::vector<T>& v) {
+    out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+template<typename T> static void get(std::istream& in, T& v) {
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+template<typename T> static void get(std::istream& in, std::vector<T>& v, size_t n) {
+    v.resize(n);
+    in.read(reinterpret_cast<char*>(v.data()), n * sizeof(T));
+}
+
+// Header fields after the magic: fingerprint, seed, next stream, w, h, epochs
+// and samples
+static const size_t header_bytes = sizeof(magic) + 7 * sizeof(unsigned long long);
+
+template<typename T> static size_t elem(const std::vector<T>&) {
+    return sizeof(T);
+}
+
+// What save() writes for each pixel
+static size_t pixel_bytes() {
+    const Checkpoint c;
+    const Feature_Buffer& f = c.features;
+    return elem(c.pixels) + elem(c.counts) + elem(f.albedo) + elem(f.direct) + elem(f.indirect) +
+           elem(f.normal) + elem(f.depth) + elem(f.luma_sq) + elem(f.object_id) +
+           elem(f.material_id);
+}
+
+size_t Checkpoint::bytes(size_t w, size_t h) {
+    return header_bytes + w * h * pixel_bytes();
+}
+
+void Checkpoint::save(std::ostream& out) const {
+
+    out.write(magic, sizeof(magic));
+    put(out, fingerprint);
+    put(out, seed);
+    put(out, next_stream);
+    put(out, (unsigned long long)w);
+    put(out, (unsigned long long)h);
+    put(out, (unsigned long long)epochs);
+    put(out, (unsigned long long)samples);
+
+    put(out, pixels);
+    put(out, counts);
+    put(out, features.albedo);
+    put(out, features.direct);
+    put(out, features.indirect);
+    put(out, features.normal);
+    put(out, features.depth);
+    put(out, features.luma_sq);
+    put(out, features.object_id);
+    put(out, features.material_id);
+}
+
+std::string Checkpoint::load(std::istream& in) {
+
+    char header[sizeof(magic)] = {};
+    in.read(header, sizeof(header));
+    if(!std::equal(header, header + sizeof(magic), magic)) return "Not a render checkpoint.";
+
+    unsigned long long _w = 0, _h = 0, _epochs = 0, _samples = 0;
+    get(in, fingerprint);
+    get(in, seed);
+    get(in, next_stream);
+    get(in, _w);
+    get(in, _h);
+    get(in, _epochs);
+    get(in, _samples);
+    if(!in.good()) return "Truncated checkpoint.";
+
+    // The size may come from a corrupt file or a stranger on the network, so
+    // check the stream really holds that many pixels before allocating them
+    std::streampos at = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streampos end = in.tellg();
+    in.seekg(at);
+    if(at < 0 || end < at) return "Truncated checkpoint.";
+    unsigned long long left = (unsigned long long)(end - at);
+    if(_w && _h > left / _w) return "Truncated checkpoint.";
+    if(_w * _h > left / pixel_bytes()) return "Truncated checkpoint.";
+
+    w = _w;
+    h = _h;
+    epochs = _epochs;
+    samples = _samples;
+    size_t n = w * h;
+
+    features.w = w;
+    features.h = h;
+    get(in, pixels, n);
+    get(in, counts, n);
+    get(in, features.albedo, n);
+    get(in, features.direct, n);
+    get(in, features.indirect, n);
+    get(in, features.normal, n);
+    get(in, features.depth, n);
+    get(in, features.luma_sq, n);
+    get(in, features.object_id, n);
+    get(in, features.material_id, n);
+    if(!in.good()) return "Truncated checkpoint.";
+
+    return {};
+}
+
+std::string Checkpoint::write(const std::string& file) const {
+
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if(!out.is_open()) return "Failed to open " + tmp + " for writing.";
+        save(out);
+        if(!out.good()) return "Failed to write " + tmp + ".";
+    }
+
+#ifdef _WIN32
+    std::remove(file.c_str()); // rename() won't replace a file here
+#endif
+    if(std::rename(tmp.c_str(), file.c_str())) return "Failed to move " + tmp + " to " + file + ".";
+    return {};
+}
+
+std::string Checkpoint::read(const std::string& file) {
+    std::ifstream in(file, std::ios::binary);
+    if(!in.is_open()) return "Failed to open " + file + ".";
+    std::string err = load(in);
+    if(!err.empty()) return file + ": " + err;
+    return {};
+}
+
+void Checkpoint::merge(const Checkpoint& part) {
+
+    if(pixels.empty()) {
+        *this = part;
+        return;
+    }
+
+    epochs += part.epochs;
+    samples += part.samples;
+    next_stream = std::max(next_stream, part.next_stream);
+    float t_epoch = epochs ? (float)part.epochs / epochs : 0.0f;
+
+    for(size_t i = 0; i < w * h; i++) {
+        if(!part.counts[i]) continue;
+        counts[i] += part.counts[i];
+        float t = (float)part.counts[i] / counts[i];
+
+        pixels[i] += (part.pixels[i] - pixels[i]) * t;
+        features.albedo[i] += (part.features.albedo[i] - features.albedo[i]) * t;
+        features.direct[i] += (part.features.direct[i] - features.direct[i]) * t;
+        features.indirect[i] += (part.features.indirect[i] - features.indirect[i]) * t;
+        features.normal[i] += (part.features.normal[i] - features.normal[i]) * t;
+        features.depth[i] += (part.features.depth[i] - features.depth[i]) * t;
+        features.luma_sq[i] += (part.features.luma_sq[i] - features.luma_sq[i]) * t_epoch;
+        if(!features.object_id[i]) {
+            features.object_id[i] = part.features.object_id[i];
+            features.material_id[i] = part.features.material_id[i];
+        }
+    }
+}
+
+} // namespace PT
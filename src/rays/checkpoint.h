@@ -0,0 +1,58 @@
+
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+#include "aovs.h"
+
+namespace PT {
+
+// FNV-1a, for fingerprinting what a render was made from
+struct Hasher {
+
+    void add(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < bytes; i++) {
+            value ^= p[i];
+            value *= 1099511628211ull;
+        }
+    }
+    template<typename T> void add(const T& v) {
+        add(&v, sizeof(T));
+    }
+
+    unsigned long long value = 14695981039346656037ull;
+};
+
+// Everything needed to pick an interrupted render back up
+struct Checkpoint {
+
+    unsigned long long fingerprint = 0; // scene, camera and settings of the render
+    unsigned long long seed = 0;        // epoch RNG streams continue from here...
+    unsigned long long next_stream = 0; // ...so resumed epochs never repeat one
+    size_t w = 0, h = 0;
+    size_t epochs = 0;  // epochs accumulated
+    size_t samples = 0; // samples per pixel traced, counting invalid ones
+
+    std::vector<Spectrum> pixels;
+    std::vector<unsigned int> counts; // valid samples per pixel
+    Feature_Buffer features;
+
+    // Writes to a temporary file first, so a crash mid-write keeps the last checkpoint
+    std::string write(const std::string& file) const;
+    std::string read(const std::string& file);
+
+    void save(std::ostream& out) const;
+    std::string load(std::istream& in);
+    // What save() writes for a w by h frame
+    static size_t bytes(size_t w, size_t h);
+
+    // Add the samples of another render of the same frame with different RNG streams
+    void merge(const Checkpoint& part);
+};
+
+} // namespace PT
@@ -0,0 +1,177 @@
+
+#include "denoiser.h"
+#include "../util/thread_pool.h"
+
+namespace PT {
+
+static const int iterations = 5;
+static const float sigma_luma = 4.0f;
+static const float sigma_depth = 1.0f;
+static const float min_albedo = 1e-3f;
+
+// B3 spline taps, widened by 2^iteration on each pass
+static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+static const float gaussian[3] = {0.25f, 0.5f, 0.25f};
+
+// Same weights as Spectrum::luma
+static float luma(float r, float g, float b) {
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// max(0, cos)^128, the normal edge-stopping weight
+static float normal_weight(float c) {
+    c = std::max(c, 0.0f);
+    for(int i = 0; i < 7; i++) c *= c;
+    return c;
+}
+
+void denoise(const HDR_Image& color, const Feature_Buffer& features, size_t epochs,
+             HDR_Image& out) {
+
+    const auto [w, h] = color.dimension();
+    const size_t n = w * h;
+    out.resize(w, h);
+    if(n == 0 || features.w != w || features.h != h) return;
+
+    // Planar float buffers keep the inner loops simple enough to vectorize
+    std::vector<float> ar(n), ag(n), ab(n);
+    std::vector<float> ir(n), ig(n), ib(n), var(n);
+    std::vector<float> nx(n), ny(n), nz(n), z(n), dz(n);
+
+    for(size_t i = 0; i < n; i++) {
+        Spectrum a = features.albedo[i];
+        ar[i] = a.r > min_albedo ? a.r : 1.0f;
+        ag[i] = a.g > min_albedo ? a.g : 1.0f;
+        ab[i] = a.b > min_albedo ? a.b : 1.0f;
+
+        Spectrum c = color.at(i);
+        ir[i] = c.r / ar[i];
+        ig[i] = c.g / ag[i];
+        ib[i] = c.b / ab[i];
+
+        Vec3 normal = features.normal[i];
+        float len = normal.norm();
+        if(len > 0.0f) normal /= len;
+        nx[i] = normal.x;
+        ny[i] = normal.y;
+        nz[i] = normal.z;
+        z[i] = features.depth[i];
+    }
+
+    // Variance of each pixel's lighting. With enough epochs it comes from the
+    // spread between them; before that, from the 3x3 neighbourhood.
+    Thread_Pool::shared().parallel_for(0, h, 1, [&](size_t y) {
+        for(size_t x = 0; x < w; x++) {
+            size_t i = y * w + x;
+            float a = luma(ar[i], ag[i], ab[i]);
+
+            if(epochs >= 4) {
+                float l = color.at(i).luma();
+                float v = std::max(features.luma_sq[i] - l * l, 0.0f) / (epochs - 1);
+                var[i] = v / (a * a);
+            } else {
+                float sum = 0.0f, sum_sq = 0.0f, count = 0.0f;
+                for(size_t yy = y ? y - 1 : 0; yy <= std::min(y + 1, h - 1); yy++) {
+                    for(size_t xx = x ? x - 1 : 0; xx <= std::min(x + 1, w - 1); xx++) {
+                        size_t j = yy * w + xx;
+                        float l = luma(ir[j], ig[j], ib[j]);
+                        sum += l;
+                        sum_sq += l * l;
+                        count += 1.0f;
+                    }
+                }
+                float mean = sum / count;
+                var[i] = std::max(sum_sq / count - mean * mean, 0.0f);
+            }
+
+            // Screen-space depth slope, so depth weights tolerate sloped surfaces
+            float gx = std::abs(z[y * w + std::min(x + 1, w - 1)] - z[y * w + (x ? x - 1 : 0)]);
+            float gy = std::abs(z[std::min(y + 1, h - 1) * w + x] - z[(y ? y - 1 : 0) * w + x]);
+            dz[i] = 0.5f * std::max(gx, gy);
+        }
+    });
+
+    std::vector<float> or_(n), og(n), ob(n), ovar(n), blurred(n);
+
+    // Rows only read the previous pass, so each pass splits rows across threads
+    for(int it = 0; it < iterations; it++) {
+
+        int step = 1 << it;
+
+        // The luminance edge-stop uses a slightly smoothed variance
+        Thread_Pool::shared().parallel_for(0, h, 1, [&](size_t y) {
+            for(size_t x = 0; x < w; x++) {
+                float sum = 0.0f, weight = 0.0f;
+                for(int dy = -1; dy <= 1; dy++) {
+                    for(int dx = -1; dx <= 1; dx++) {
+                        long long yy = (long long)y + dy, xx = (long long)x + dx;
+                        if(yy < 0 || xx < 0 || yy >= (long long)h || xx >= (long long)w) continue;
+                        float k = gaussian[dx + 1] * gaussian[dy + 1];
+                        sum += k * var[yy * w + xx];
+                        weight += k;
+                    }
+                }
+                blurred[y * w + x] = sum / weight;
+            }
+        });
+
+        Thread_Pool::shared().parallel_for(0, h, 1, [&](size_t y) {
+            for(size_t x = 0; x < w; x++) {
+
+                size_t p = y * w + x;
+                bool hit_p = z[p] > 0.0f;
+                float lp = luma(ir[p], ig[p], ib[p]);
+                float luma_scale = sigma_luma * std::sqrt(blurred[p]) + 1e-6f;
+
+                float sr = 0.0f, sg = 0.0f, sb = 0.0f, sv = 0.0f, sw = 0.0f;
+                for(int dy = -2; dy <= 2; dy++) {
+                    long long yy = (long long)y + dy * step;
+                    if(yy < 0 || yy >= (long long)h) continue;
+
+                    for(int dx = -2; dx <= 2; dx++) {
+                        long long xx = (long long)x + dx * step;
+                        if(xx < 0 || xx >= (long long)w) continue;
+
+                        size_t q = yy * w + xx;
+                        float wq = kernel[dx + 2] * kernel[dy + 2];
+
+                        if(q != p) {
+                            bool hit_q = z[q] > 0.0f;
+                            if(hit_p != hit_q) continue;
+                            if(hit_p) {
+                                wq *= normal_weight(nx[p] * nx[q] + ny[p] * ny[q] + nz[p] * nz[q]);
+                                float dist = step * std::sqrt((float)(dx * dx + dy * dy));
+                                float depth_scale = sigma_depth * dz[p] * dist + 0.01f * z[p];
+                                wq *= std::exp(-std::abs(z[p] - z[q]) / depth_scale);
+                            }
+                            float lq = luma(ir[q], ig[q], ib[q]);
+                            wq *= std::exp(-std::abs(lp - lq) / luma_scale);
+                        }
+
+                        sr += wq * ir[q];
+                        sg += wq * ig[q];
+                        sb += wq * ib[q];
+                        sv += wq * wq * var[q];
+                        sw += wq;
+                    }
+                }
+
+                or_[p] = sr / sw;
+                og[p] = sg / sw;
+                ob[p] = sb / sw;
+                ovar[p] = sv / (sw * sw);
+            }
+        });
+
+        std::swap(ir, or_);
+        std::swap(ig, og);
+        std::swap(ib, ob);
+        std::swap(var, ovar);
+    }
+
+    for(size_t i = 0; i < n; i++) {
+        out.at(i) = Spectrum(ir[i] * ar[i], ig[i] * ag[i], ib[i] * ab[i]);
+    }
+}
+
+} // namespace PT
@@ -0,0 +1,16 @@
+
+#pragma once
+
+#include "../util/hdr_image.h"
+#include "aovs.h"
+
+namespace PT {
+
+// Edge-aware a-trous wavelet filter (Dammertz et al. 2010) with the
+// variance-guided luminance weights of SVGF (Schied et al. 2017). Lighting is
+// divided by albedo before filtering, so texture detail is not blurred away.
+// `epochs` is how many independent estimates were averaged into `color`.
+void denoise(const HDR_Image& color, const Feature_Buffer& features, size_t epochs,
+             HDR_Image& out);
+
+} // namespace PT
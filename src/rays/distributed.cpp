@@ -0,0 +1,233 @@
+
+#include "distributed.h"
+#include "../platform/ipc.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace PT {
+
+// Every message is a header followed by `bytes` of payload. Both ends are
+// assumed to share endianness.
+enum class Message : unsigned int { hello, chunk, result, done };
+static const unsigned int protocol_version = 1;
+
+struct Header {
+    unsigned int type = 0;
+    unsigned int version = protocol_version;
+    unsigned long long bytes = 0;
+};
+
+// What a worker has loaded, sent once after connecting
+struct Hello {
+    unsigned long long fingerprint = 0, w = 0, h = 0;
+};
+
+// Samples per pixel to render with RNG streams from `stream` on
+struct Chunk {
+    unsigned long long seed = 0, stream = 0, samples = 0;
+};
+
+static bool send_message(Socket& s, Message type, const void* data, size_t bytes) {
+    Header header;
+    header.type = (unsigned int)type;
+    header.bytes = bytes;
+    return s.send(&header, sizeof(header)) && (!bytes || s.send(data, bytes));
+}
+
+// Payloads over max_bytes are refused before anything is allocated for them
+static bool recv_message(Socket& s, Message& type, std::string& payload, size_t max_bytes) {
+    Header header;
+    if(!s.recv(&header, sizeof(header)) || header.version != protocol_version) return false;
+    if(header.bytes > max_bytes) return false;
+    type = (Message)header.type;
+    payload.resize(header.bytes);
+    return !header.bytes || s.recv(&payload[0], header.bytes);
+}
+
+template<typename T> static bool unpack(const std::string& payload, T& out) {
+    if(payload.size() != sizeof(T)) return false;
+    std::memcpy(&out, payload.data(), sizeof(T));
+    return true;
+}
+
+std::string coordinate(const Farm_Options& opt, size_t w, size_t h, size_t samples,
+                       unsigned long long fingerprint, const std::function<void(float)>& progress,
+                       Checkpoint& result) {
+
+    if(!samples) return "Nothing to render.";
+
+    // Declared before the server so that, on the way out, the socket closes
+    // first and any worker still connecting gives up.
+    std::vector<Process> local(opt.local_workers);
+
+    // Workers aren't authenticated, so only listen beyond this machine if they may be elsewhere
+    Socket server;
+    std::string err = server.listen(opt.port, !opt.remote && opt.local_workers);
+    if(!err.empty()) return err;
+    unsigned short port = server.port();
+    info("Coordinator listening on port %u.", port);
+
+    for(Process& p : local) {
+        std::vector<std::string> args = opt.command;
+        args.push_back("--worker");
+        args.push_back("127.0.0.1:" + std::to_string(port));
+        err = p.start(args);
+        if(!err.empty()) return err;
+    }
+
+    // A few chunks per worker, so faster machines end up doing more of them
+    size_t expected = opt.local_workers ? opt.local_workers : 8;
+    size_t chunk_samples = std::max(size_t(1), samples / (2 * expected));
+
+    std::random_device rd;
+    unsigned long long seed = ((unsigned long long)rd() << 32) | rd();
+
+    // Epochs take one stream each and never span more than their chunk's
+    // samples, so starting each chunk's streams at its sample offset keeps
+    // them disjoint.
+    std::deque<Chunk> todo;
+    for(size_t s = 0; s < samples; s += chunk_samples) {
+        todo.push_back({seed, s, std::min(chunk_samples, samples - s)});
+    }
+
+    std::mutex mut;
+    std::condition_variable cv;
+    size_t merged = 0;
+    std::atomic<size_t> serving{0};
+    result = Checkpoint{};
+
+    // A worker that stays connected but stops answering would keep its chunk forever
+    auto serve = [&](Socket conn) {
+        conn.set_timeout((int)(opt.chunk_timeout * 1000.0f));
+        Message type;
+        std::string payload;
+        Hello hello;
+        if(!recv_message(conn, type, payload, sizeof(Hello)) || type != Message::hello ||
+           !unpack(payload, hello)) {
+            serving--;
+            return;
+        }
+        if(hello.w != w || hello.h != h || hello.fingerprint != fingerprint) {
+            warn("Turned away a worker with a different scene, camera, or settings.");
+            send_message(conn, Message::done, nullptr, 0);
+            serving--;
+            return;
+        }
+
+        for(;;) {
+            Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                cv.wait(lock, [&]() { return !todo.empty() || merged == samples; });
+                if(todo.empty()) break;
+                chunk = todo.front();
+                todo.pop_front();
+            }
+
+            Checkpoint part;
+            bool ok = send_message(conn, Message::chunk, &chunk, sizeof(chunk)) &&
+                      recv_message(conn, type, payload, Checkpoint::bytes(w, h)) &&
+                      type == Message::result;
+            if(ok) {
+                std::istringstream in(payload);
+                ok = part.load(in).empty() && part.w == w && part.h == h &&
+                     part.fingerprint == fingerprint;
+            }
+
+            std::lock_guard<std::mutex> lock(mut);
+            if(!ok) {
+                warn("Lost a worker, or it took too long; its samples go back in the queue.");
+                todo.push_front(chunk);
+                cv.notify_all();
+                serving--;
+                return;
+            }
+            result.merge(part);
+            merged += chunk.samples;
+            cv.notify_all();
+        }
+
+        send_message(conn, Message::done, nullptr, 0);
+        serving--;
+    };
+
+    std::vector<std::thread> threads;
+    for(;;) {
+        size_t done;
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            done = merged;
+        }
+        progress((float)done / samples);
+        if(done == samples) break;
+
+        Socket conn = server.accept(100);
+        if(conn.valid()) {
+            serving++;
+            threads.emplace_back(serve, std::move(conn));
+            continue;
+        }
+
+        // Remote workers may still turn up, but local ones won't come back.
+        // Workers also exit once they're told the frame is done, so only give
+        // up if it isn't.
+        bool any_local = false;
+        for(Process& p : local) any_local = any_local || p.running();
+        std::lock_guard<std::mutex> lock(mut);
+        if(!local.empty() && !any_local && !serving && merged < samples) {
+            err = "Every worker exited before the render finished.";
+            break;
+        }
+    }
+
+    cv.notify_all();
+    for(std::thread& t : threads) t.join();
+    return err;
+}
+
+std::string work(const Farm_Options& opt, Pathtracer& tracer, Scene& scene, const Camera& cam,
+                 size_t w, size_t h) {
+
+    size_t colon = opt.worker.rfind(':');
+    if(colon == std::string::npos) return "Expected a coordinator address like host:port.";
+    std::string host = opt.worker.substr(0, colon);
+    int port = std::atoi(opt.worker.c_str() + colon + 1);
+
+    Socket conn;
+    std::string err = conn.connect(host, (unsigned short)port);
+    if(!err.empty()) return err;
+
+    tracer.prepare(scene, cam);
+    Hello hello{tracer.fingerprint(), w, h};
+    if(!send_message(conn, Message::hello, &hello, sizeof(hello))) return "Lost the coordinator.";
+
+    for(;;) {
+        Message type;
+        std::string payload;
+        Chunk chunk;
+        if(!recv_message(conn, type, payload, sizeof(Chunk))) return "Lost the coordinator.";
+        if(type == Message::done) return {};
+        if(type != Message::chunk || !unpack(payload, chunk)) {
+            return "Unexpected message from the coordinator.";
+        }
+
+        tracer.begin_chunk(chunk.seed, chunk.stream, chunk.samples);
+        while(tracer.in_progress()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        std::ostringstream out;
+        tracer.snapshot().save(out);
+        std::string bytes = out.str();
+        if(!send_message(conn, Message::result, bytes.data(), bytes.size())) {
+            return "Lost the coordinator.";
+        }
+    }
+}
+
+} // namespace PT
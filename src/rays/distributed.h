@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "pathtracer.h"
+
+namespace PT {
+
+// Distributed rendering: a coordinator splits a frame's samples into chunks of
+// RNG streams and hands them to worker processes, here or on other machines.
+// Each worker builds the scene once, renders chunks as they come and sends
+// back the partial accumulator, which the coordinator merges by sample count.
+struct Farm_Options {
+    std::string worker;       // "host:port" of a coordinator to work for, if any
+    bool coordinate = false;  // farm the render out instead of tracing it here
+    unsigned short port = 0;  // where the coordinator listens; 0 picks a free port
+    size_t local_workers = 0; // worker processes the coordinator starts on this machine
+    bool remote = false;      // also take workers from other machines; always if no local ones
+    float chunk_timeout = 600.0f; // seconds a worker may go quiet before its chunk is requeued
+    std::vector<std::string> command; // how this process was started, for local workers
+};
+
+// Renders `samples` per pixel of a w by h frame on whichever workers connect,
+// and returns the merged result. Workers that didn't prepare the scene this
+// process did, with the Pathtracer::fingerprint() given, are turned away.
+// Returns an error message, or an empty string.
+std::string coordinate(const Farm_Options& opt, size_t w, size_t h, size_t samples,
+                       unsigned long long fingerprint, const std::function<void(float)>& progress,
+                       Checkpoint& result);
+
+// Works for the coordinator at opt.worker until it says the frame is done
+std::string work(const Farm_Options& opt, Pathtracer& tracer, Scene& scene, const Camera& cam,
+                 size_t w, size_t h);
+
+} // namespace PT
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <memory>
 #include <variant>
 
 #include "../lib/mathlib.h"
@@ -19,6 +20,7 @@ struct Env_Hemisphere {
 
     Light_Sample sample() const;
     Spectrum sample_direction(Vec3 dir) const;
+    float pdf(Vec3 dir) const;
 
     Spectrum radiance;
     Samplers::Hemisphere::Uniform sampler;
@@ -31,6 +33,7 @@ struct Env_Sphere {
 
     Light_Sample sample() const;
     Spectrum sample_direction(Vec3 dir) const;
+    float pdf(Vec3 dir) const;
 
     Spectrum radiance;
     Samplers::Sphere::Uniform sampler;
@@ -38,14 +41,27 @@ struct Env_Sphere {
 
 struct Env_Map {
 
-    Env_Map(HDR_Image&& img) : image(std::move(img)), sampler(image) {
+    // Preprocessed texels and sampling table for one image. Immutable once built,
+    // and shared by every render that uses the same image (see get()).
+    struct Data {
+        Data(const HDR_Image& image);
+        static std::shared_ptr<const Data> get(const HDR_Image& image);
+
+        size_t w = 0, h = 0;
+        // Row-major lat-long texels with w + 1 columns; the last repeats the first
+        // so bilinear lookups never have to wrap.
+        std::vector<Spectrum> texels;
+        Samplers::Sphere::Image sampler;
+    };
+
+    Env_Map(const HDR_Image& image) : data(Data::get(image)) {
     }
 
     Light_Sample sample() const;
     Spectrum sample_direction(Vec3 dir) const;
+    float pdf(Vec3 dir) const;
 
-    HDR_Image image;
-    Samplers::Sphere::Image sampler;
+    std::shared_ptr<const Data> data;
 };
 
 class Env_Light {
@@ -77,6 +93,11 @@ public:
             underlying);
     }
 
+    // Solid angle density with which sample() returns dir
+    float pdf(Vec3 dir) const {
+        return std::visit(overloaded{[&dir](const auto& h) { return h.pdf(dir); }}, underlying);
+    }
+
     bool is_discrete() const {
         return false;
     }
@@ -0,0 +1,282 @@
+
+#include "guiding.h"
+#include "../util/rand.h"
+
+namespace PT {
+
+// Refine a quadrant holding more than this fraction of a directional tree's energy
+static const float dtree_threshold = 0.01f;
+static const int max_dtree_depth = 20;
+static const int max_stree_depth = 24;
+
+// Split spatial leaves that saw more than c * sqrt(pass samples per pixel) records
+static const float stree_threshold = 12000.0f;
+
+static Vec2 dir_to_square(Vec3 dir) {
+    float phi = std::atan2(dir.z, dir.x);
+    if(phi < 0.0f) phi += 2.0f * PI_F;
+    return Vec2(clamp((dir.y + 1.0f) * 0.5f, 0.0f, 1.0f), clamp(phi / (2.0f * PI_F), 0.0f, 1.0f));
+}
+
+static Vec3 square_to_dir(Vec2 p) {
+    float cos_t = 2.0f * p.x - 1.0f;
+    float sin_t = std::sqrt(std::max(0.0f, 1.0f - cos_t * cos_t));
+    float phi = 2.0f * PI_F * p.y;
+    return Vec3(sin_t * std::cos(phi), cos_t, sin_t * std::sin(phi));
+}
+
+static int quadrant(Vec2& p) {
+    int qx = p.x >= 0.5f, qy = p.y >= 0.5f;
+    p = Vec2(std::min(p.x * 2.0f - qx, 1.0f), std::min(p.y * 2.0f - qy, 1.0f));
+    return qx + 2 * qy;
+}
+
+D_Tree::D_Tree() {
+    nodes.emplace_back();
+}
+
+float D_Tree::total() const {
+    const Node& root = nodes[0];
+    return root.sum[0].get() + root.sum[1].get() + root.sum[2].get() + root.sum[3].get();
+}
+
+void D_Tree::record(Vec3 dir, float value) {
+    Vec2 p = dir_to_square(dir);
+    unsigned int n = 0;
+    for(;;) {
+        int q = quadrant(p);
+        nodes[n].sum[q].add(value);
+        if(!nodes[n].child[q]) break;
+        n = nodes[n].child[q];
+    }
+}
+
+Vec3 D_Tree::sample(float& pdf) const {
+
+    Vec2 origin;
+    float size = 1.0f, density = 1.0f;
+    unsigned int n = 0;
+
+    for(;;) {
+        const Node& node = nodes[n];
+        float s[4], sum = 0.0f;
+        for(int q = 0; q < 4; q++) {
+            s[q] = node.sum[q].get();
+            sum += s[q];
+        }
+
+        int q = 0;
+        if(sum > 0.0f) {
+            // Fall through to the last non-empty quadrant if rounding overshoots
+            float u = RNG::unit() * sum;
+            int last = 0;
+            for(; q < 4; q++) {
+                if(s[q] <= 0.0f) continue;
+                last = q;
+                if(u < s[q]) break;
+                u -= s[q];
+            }
+            if(q == 4) q = last;
+            density *= 4.0f * s[q] / sum;
+        } else {
+            q = RNG::integer(0, 4);
+        }
+
+        size *= 0.5f;
+        origin += Vec2((float)(q & 1), (float)(q >> 1)) * size;
+        if(!node.child[q]) break;
+        n = node.child[q];
+    }
+
+    // The cylindrical map is area preserving, so the square's density spreads over 4 pi
+    pdf = density / (4.0f * PI_F);
+    return square_to_dir(origin + Vec2(RNG::unit(), RNG::unit()) * size);
+}
+
+float D_Tree::pdf(Vec3 dir) const {
+
+    Vec2 p = dir_to_square(dir);
+    float density = 1.0f;
+    unsigned int n = 0;
+
+    for(;;) {
+        const Node& node = nodes[n];
+        float sum = node.sum[0].get() + node.sum[1].get() + node.sum[2].get() + node.sum[3].get();
+        int q = quadrant(p);
+        if(sum > 0.0f) density *= 4.0f * node.sum[q].get() / sum;
+        if(!node.child[q]) break;
+        n = node.child[q];
+    }
+    return density / (4.0f * PI_F);
+}
+
+D_Tree D_Tree::refined(float threshold) const {
+    D_Tree out;
+    float t = total();
+    if(t > 0.0f) refine_node(0, 0.0f, 0, t, threshold, 1, out);
+    return out;
+}
+
+void D_Tree::refine_node(int src, float energy, unsigned int dst, float t, float threshold,
+                         int depth, D_Tree& out) const {
+
+    // Leaves of the source tree spread their energy evenly over any new children
+    for(int q = 0; q < 4; q++) {
+        float e = src >= 0 ? nodes[src].sum[q].get() : energy * 0.25f;
+        if(depth >= max_dtree_depth || e <= t * threshold) continue;
+
+        int child = src >= 0 && nodes[src].child[q] ? (int)nodes[src].child[q] : -1;
+        unsigned int idx = (unsigned int)out.nodes.size();
+        out.nodes.emplace_back();
+        out.nodes[dst].child[q] = idx;
+        refine_node(child, e, idx, t, threshold, depth + 1, out);
+    }
+}
+
+SD_Tree::SD_Tree(BBox bounds) : bounds(bounds) {
+    nodes.emplace_back();
+    dtrees.emplace_back();
+}
+
+const D_Tree& SD_Tree::leaf(Vec3 pos) const {
+
+    Vec3 extent = bounds.max - bounds.min, p;
+    for(int i = 0; i < 3; i++)
+        p[i] = extent[i] > 0.0f ? clamp((pos[i] - bounds.min[i]) / extent[i], 0.0f, 1.0f) : 0.5f;
+
+    unsigned int n = 0;
+    while(nodes[n].child[0]) {
+        int a = nodes[n].axis;
+        int side = p[a] >= 0.5f;
+        p[a] = p[a] * 2.0f - side;
+        n = nodes[n].child[side];
+    }
+    return dtrees[nodes[n].dtree];
+}
+
+D_Tree& SD_Tree::leaf(Vec3 pos) {
+    return const_cast<D_Tree&>(static_cast<const SD_Tree*>(this)->leaf(pos));
+}
+
+void SD_Tree::record(Vec3 pos, Vec3 dir, float value) {
+    if(!std::isfinite(value) || value < 0.0f) return;
+    D_Tree& dtree = leaf(pos);
+    dtree.samples.add(1.0f);
+    if(value > 0.0f) dtree.record(dir, value);
+}
+
+bool SD_Tree::can_sample(Vec3 pos) const {
+    return leaf(pos).total() > 0.0f;
+}
+
+Vec3 SD_Tree::sample(Vec3 pos, float& pdf) const {
+    return leaf(pos).sample(pdf);
+}
+
+float SD_Tree::pdf(Vec3 pos, Vec3 dir) const {
+    return leaf(pos).pdf(dir);
+}
+
+std::shared_ptr<SD_Tree> SD_Tree::refined(float split_threshold) const {
+    auto out = std::make_shared<SD_Tree>(bounds);
+    out->dtrees.clear();
+    refine_node(0, 0, 0, split_threshold, *out);
+    return out;
+}
+
+void SD_Tree::refine_node(unsigned int src, unsigned int dst, int depth, float split_threshold,
+                          SD_Tree& out) const {
+
+    const Node& node = nodes[src];
+    if(!node.child[0]) {
+        const D_Tree& dtree = dtrees[node.dtree];
+        split_leaf(dtree, dtree.samples.get(), dst, depth, split_threshold, out);
+        return;
+    }
+
+    out.nodes[dst].axis = node.axis;
+    for(int side = 0; side < 2; side++) {
+        unsigned int idx = (unsigned int)out.nodes.size();
+        out.nodes.emplace_back();
+        out.nodes[dst].child[side] = idx;
+        refine_node(node.child[side], idx, depth + 1, split_threshold, out);
+    }
+}
+
+void SD_Tree::split_leaf(const D_Tree& dtree, float samples, unsigned int dst, int depth,
+                         float split_threshold, SD_Tree& out) const {
+
+    // Assume samples spread evenly over the halves and keep splitting until
+    // each is under the threshold. Children inherit the parent's directions.
+    if(samples > split_threshold && depth < max_stree_depth) {
+        out.nodes[dst].axis = depth % 3;
+        for(int side = 0; side < 2; side++) {
+            unsigned int idx = (unsigned int)out.nodes.size();
+            out.nodes.emplace_back();
+            out.nodes[dst].child[side] = idx;
+            split_leaf(dtree, samples * 0.5f, idx, depth + 1, split_threshold, out);
+        }
+        return;
+    }
+
+    out.nodes[dst].dtree = (unsigned int)out.dtrees.size();
+    out.dtrees.push_back(dtree.refined(dtree_threshold));
+}
+
+void Path_Guide::reset(BBox bounds, size_t total_samples) {
+    std::lock_guard<std::mutex> lock(mut);
+    pass.sample = nullptr;
+    pass.train = std::make_shared<SD_Tree>(bounds);
+    pass_samples = 0;
+    pass_budget = 1;
+    recording = 0;
+    closing = false;
+    // Always leave at least half of the samples to the final guide
+    training_left = total_samples / 2;
+}
+
+void Path_Guide::clear() {
+    std::lock_guard<std::mutex> lock(mut);
+    pass = {};
+    recording = 0;
+    closing = false;
+}
+
+Path_Guide::Pass Path_Guide::current() {
+    std::lock_guard<std::mutex> lock(mut);
+    Pass ret = pass;
+    if(closing)
+        ret.train = nullptr;
+    else if(ret.train)
+        recording++;
+    return ret;
+}
+
+void Path_Guide::end_epoch(const Pass& used, size_t samples) {
+
+    std::lock_guard<std::mutex> lock(mut);
+    // Epochs that didn't train, or trained a tree since reset, don't count
+    if(!pass.train || used.train != pass.train) return;
+
+    recording--;
+    pass_samples += samples;
+    if(pass_samples >= pass_budget) closing = true;
+    if(!closing || recording) return;
+
+    // Epochs still running keep the trees they started with, and none of them
+    // records into this one any more, so it's done changing
+    training_left -= std::min(training_left, pass_samples);
+    pass.sample = pass.train;
+    closing = false;
+
+    float split_threshold = stree_threshold * std::sqrt((float)pass_budget);
+    pass_samples = 0;
+    pass_budget *= 2;
+
+    if(pass_budget > training_left)
+        pass.train = nullptr;
+    else
+        pass.train = pass.sample->refined(split_threshold);
+}
+
+} // namespace PT
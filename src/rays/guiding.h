@@ -0,0 +1,131 @@
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../lib/mathlib.h"
+
+namespace PT {
+
+// Float that many render threads can accumulate into. Copies are plain loads,
+// so only copy while nobody is writing.
+struct Atomic_Float {
+
+    Atomic_Float(float f = 0.0f) : value(f) {
+    }
+    Atomic_Float(const Atomic_Float& src) : value(src.get()) {
+    }
+    Atomic_Float& operator=(const Atomic_Float& src) {
+        value.store(src.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    float get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+    void add(float f) {
+        float cur = get();
+        while(!value.compare_exchange_weak(cur, cur + f, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::atomic<float> value;
+};
+
+// Directional quadtree over the cylindrical (cos theta, phi) square, which maps
+// onto the sphere preserving area. Nodes hold the energy recorded in each of
+// their four quadrants.
+class D_Tree {
+public:
+    D_Tree();
+
+    void record(Vec3 dir, float value);
+    Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
+    float total() const;
+
+    // Empty tree whose quadrants are subdivided wherever this one recorded more
+    // than `threshold` of its total energy.
+    D_Tree refined(float threshold) const;
+
+    Atomic_Float samples;
+
+private:
+    struct Node {
+        Atomic_Float sum[4];
+        unsigned int child[4] = {}; // 0 means the quadrant is a leaf
+    };
+
+    void refine_node(int src, float energy, unsigned int dst, float total, float threshold,
+                     int depth, D_Tree& out) const;
+
+    std::vector<Node> nodes;
+};
+
+// Spatial binary tree over the scene bounds with a D_Tree in every leaf
+// ("Practical Path Guiding", Mueller et al. 2017).
+class SD_Tree {
+public:
+    SD_Tree(BBox bounds);
+
+    void record(Vec3 pos, Vec3 dir, float value);
+    bool can_sample(Vec3 pos) const;
+    Vec3 sample(Vec3 pos, float& pdf) const;
+    float pdf(Vec3 pos, Vec3 dir) const;
+
+    // Empty tree for the next training pass: leaves that received more than
+    // `split_threshold` samples are split, and every directional tree is refined.
+    std::shared_ptr<SD_Tree> refined(float split_threshold) const;
+
+private:
+    struct Node {
+        int axis = 0;
+        unsigned int child[2] = {}; // 0 means leaf
+        unsigned int dtree = 0;
+    };
+
+    const D_Tree& leaf(Vec3 pos) const;
+    D_Tree& leaf(Vec3 pos);
+    void refine_node(unsigned int src, unsigned int dst, int depth, float split_threshold,
+                     SD_Tree& out) const;
+    void split_leaf(const D_Tree& dtree, float samples, unsigned int dst, int depth,
+                    float split_threshold, SD_Tree& out) const;
+
+    BBox bounds;
+    std::vector<Node> nodes;
+    std::vector<D_Tree> dtrees;
+};
+
+// Schedules training passes of doubling sample counts. Render threads grab the
+// current pass at the start of an epoch, sample from its frozen tree, and record
+// into its training tree; finishing a pass freezes the training tree for
+// sampling and starts a refined one. Once a pass has its samples, epochs that
+// start are no longer given its training tree, and it's only frozen after the
+// last epoch recording into it ends, so a frozen tree never changes.
+class Path_Guide {
+public:
+    struct Pass {
+        std::shared_ptr<const SD_Tree> sample;
+        std::shared_ptr<SD_Tree> train;
+    };
+
+    void reset(BBox bounds, size_t total_samples);
+    void clear();
+
+    // Every pass current() hands out must be given back to end_epoch(), with
+    // the samples its epoch finished
+    Pass current();
+    void end_epoch(const Pass& used, size_t samples);
+
+private:
+    std::mutex mut;
+    Pass pass;
+    size_t pass_samples = 0, pass_budget = 1, training_left = 0;
+    size_t recording = 0; // epochs given pass.train that haven't ended
+    bool closing = false; // pass.train has its samples and is handed out no more
+};
+
+} // namespace PT
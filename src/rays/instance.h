@@ -0,0 +1,622 @@
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../scene/object.h"
+
+#include "bvh.h"
+#include "packet.h"
+#include "shapes.h"
+#include "trace.h"
+#include "tri_mesh.h"
+
+namespace PT {
+
+// The top three rows of an affine Mat4, stored by column. Each column keeps
+// its unused fourth float, so it loads straight into a SIMD register.
+struct Affine {
+
+    Affine() = default;
+    explicit Affine(const Mat4& m) : cols{m[0], m[1], m[2], m[3]} {
+    }
+
+    Vec3 point(Vec3 p) const {
+        return Vec4(SIMD::madd(cols[2].simd(), SIMD::set1(p.z), linear(p.x, p.y))).xyz();
+    }
+    Vec3 vector(Vec3 v) const {
+        SIMD::f4 r = SIMD::mul(cols[0].simd(), SIMD::set1(v.x));
+        r = SIMD::madd(cols[1].simd(), SIMD::set1(v.y), r);
+        return Vec4(SIMD::madd(cols[2].simd(), SIMD::set1(v.z), r)).xyz();
+    }
+    // The linear part transposed, times v: an inverse transform's normal matrix
+    Vec3 transposed(Vec3 v) const {
+        return Vec3(dot(cols[0].xyz(), v), dot(cols[1].xyz(), v), dot(cols[2].xyz(), v));
+    }
+
+    Mat4 matrix() const {
+        return Mat4{Vec4{cols[0].xyz(), 0.0f}, Vec4{cols[1].xyz(), 0.0f},
+                    Vec4{cols[2].xyz(), 0.0f}, Vec4{cols[3].xyz(), 1.0f}};
+    }
+
+    Vec4 cols[4];
+
+private:
+    // Translation plus the first two columns' share of a point
+    SIMD::f4 linear(float x, float y) const {
+        SIMD::f4 r = SIMD::madd(cols[0].simd(), SIMD::set1(x), cols[3].simd());
+        return SIMD::madd(cols[1].simd(), SIMD::set1(y), r);
+    }
+};
+
+// In place of Affine for instances already in scene space
+struct Identity {
+    Identity() = default;
+    explicit Identity(const Mat4&) {
+    }
+    Mat4 matrix() const {
+        return Mat4::I;
+    }
+};
+
+// One kind of shape placed in the scene. Unlike Object, both the shape and
+// whether it's transformed are part of the type, so BVH<Instance<Tri_Mesh>>
+// calls the mesh's hit() directly, and instances with an Identity transform
+// do no transform work at all.
+template<typename Shape, typename Transform = Affine> class Instance {
+public:
+    static constexpr bool placed = !std::is_same_v<Transform, Identity>;
+
+    Instance(Shape&& s, Scene_ID id, unsigned int material, const Mat4& T)
+        : to_world(T), to_local(T.inverse()), _id(id), material(material), shape(std::move(s)) {
+        box = shape.bbox();
+        if constexpr(placed) box.transform(T);
+    }
+
+    Instance(Instance&& src) = default;
+    Instance& operator=(Instance&& src) = default;
+    Instance(const Instance& src) = delete;
+    Instance& operator=(const Instance& src) = delete;
+
+    Instance copy() const {
+        if constexpr(std::is_copy_constructible_v<Shape>) {
+            return Instance(Shape(shape), *this);
+        } else {
+            return Instance(shape.copy(), *this);
+        }
+    }
+
+    Scene_ID id() const {
+        return _id;
+    }
+    BBox bbox() const {
+        return box;
+    }
+
+    // Distances are given in scene space, but everything else is left for
+    // compute_interaction()
+    Trace hit(const Ray& ray) const {
+        Ray local = ray;
+        float scale = to_shape(local);
+        Trace ret = shape.hit(local);
+        ret.distance /= scale;
+        return ret;
+    }
+
+    // Meshes take the packet whole, in their own space; other shapes one ray
+    // at a time. Hits found are given the instance index passed in.
+    void hit(const Ray_Packet& packet, unsigned int mask, Trace* closest,
+             unsigned int index) const {
+
+        if constexpr(!std::is_same_v<Shape, Tri_Mesh>) {
+            for(size_t i = 0; i < packet.size(); i++) {
+                if(!(mask >> i & 1)) continue;
+                Trace found = hit(packet[i]);
+                found.instance = index;
+                closest[i] = Trace::min(closest[i], found);
+            }
+        } else {
+            Ray_Packet local(packet.any_hit());
+            size_t from[Ray_Packet::max_rays];
+            float scale[Ray_Packet::max_rays];
+            for(size_t i = 0; i < packet.size(); i++) {
+                if(!(mask >> i & 1)) continue;
+                Ray ray = packet[i];
+                if(closest[i].hit) {
+                    ray.dist_bounds.y = std::min(ray.dist_bounds.y, closest[i].distance);
+                }
+                scale[local.size()] = to_shape(ray);
+                from[local.size()] = i;
+                local.add(ray);
+            }
+
+            Trace found[Ray_Packet::max_rays];
+            shape.hit(local, found);
+            for(size_t j = 0; j < local.size(); j++) {
+                if(!found[j].hit) continue;
+                found[j].distance /= scale[j];
+                found[j].instance = index;
+                closest[from[j]] = Trace::min(closest[from[j]], found[j]);
+            }
+        }
+    }
+
+    // Fills in the rest of a hit found by hit()
+    void compute_interaction(const Ray& ray, Trace& hit) const {
+        hit.material = material;
+        hit.object = _id;
+        if constexpr(placed) {
+            float distance = hit.distance;
+            Ray local = ray;
+            hit.distance *= to_shape(local);
+            shape.compute_interaction(local, hit);
+            hit.distance = distance;
+            hit.origin = ray.point;
+            hit.position = ray.point + ray.dir * distance;
+            hit.normal = to_local.transposed(hit.normal).unit();
+        } else {
+            shape.compute_interaction(ray, hit);
+        }
+    }
+
+    size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& vtrans) const {
+        if constexpr(std::is_same_v<Shape, Tri_Mesh>) {
+            return shape.visualize(lines, active, level, vtrans * to_world.matrix());
+        } else {
+            return 0;
+        }
+    }
+
+private:
+    Instance(Shape&& s, const Instance& src)
+        : to_world(src.to_world), to_local(src.to_local), box(src.box), _id(src._id),
+          material(src.material), shape(std::move(s)) {
+    }
+
+    // Returns how much longer distances are in shape space
+    float to_shape(Ray& ray) const {
+        if constexpr(placed) {
+            ray.point = to_local.point(ray.point);
+            ray.dir = to_local.vector(ray.dir);
+            float d = ray.dir.norm();
+            ray.dist_bounds *= d;
+            ray.dir /= d;
+            return d;
+        } else {
+            return 1.0f;
+        }
+    }
+
+    Transform to_world, to_local;
+    BBox box;
+    Scene_ID _id;
+    unsigned int material;
+    Shape shape;
+};
+
+// Several kinds of instance, in one array per kind
+template<typename... Instances> class Instance_Lists {
+public:
+    template<typename Shape, typename Transform> void add(Instance<Shape, Transform>&& inst) {
+        get<Instance<Shape, Transform>>().push_back(std::move(inst));
+    }
+    // Adds the shape as the kind of instance that fits it best: untransformed
+    // if T is the identity and that kind is held here
+    template<typename Shape>
+    void add(Shape&& shape, Scene_ID id, unsigned int material, const Mat4& T) {
+        if constexpr((std::is_same_v<Instance<Shape, Identity>, Instances> || ...)) {
+            if(T == Mat4::I) {
+                add(Instance<Shape, Identity>(std::move(shape), id, material, T));
+                return;
+            }
+        }
+        add(Instance<Shape>(std::move(shape), id, material, T));
+    }
+    void append(Instance_Lists&& src) {
+        (append(get<Instances>(), src.get<Instances>()), ...);
+    }
+    Instance_Lists copy() const {
+        Instance_Lists ret;
+        for_each([&ret](const auto& inst) { ret.add(inst.copy()); });
+        return ret;
+    }
+
+    template<typename F> void for_each(F&& f) const {
+        auto each = [&f](const auto& list) {
+            for(const auto& inst : list) f(inst);
+        };
+        (each(get<Instances>()), ...);
+    }
+
+    template<typename Inst> std::vector<Inst>& get() {
+        return std::get<std::vector<Inst>>(lists);
+    }
+    template<typename Inst> const std::vector<Inst>& get() const {
+        return std::get<std::vector<Inst>>(lists);
+    }
+
+private:
+    template<typename T> static void append(std::vector<T>& to, std::vector<T>& from) {
+        for(T& t : from) to.push_back(std::move(t));
+        from.clear();
+    }
+
+    std::tuple<std::vector<Instances>...> lists;
+};
+
+// One BVH over instances of several kinds. Each leaf holds instances of a
+// single kind, kept next to each other in that kind's array: the leaf picks its
+// kind once, then calls the instances' own hit() directly.
+template<typename... Instances> class Instance_BVH {
+public:
+    using Lists = Instance_Lists<Instances...>;
+
+    void build(Lists&& lists, size_t max_leaf_size = 4) {
+        instances = std::move(lists);
+        nodes.clear();
+
+        std::vector<Item> items;
+        unsigned int kind = 0;
+        auto add = [&](const auto& list) {
+            for(unsigned int i = 0; i < list.size(); i++) {
+                BBox box = list[i].bbox();
+                items.push_back({box, box.center(), kind, i});
+            }
+            kind++;
+        };
+        (add(instances.template get<Instances>()), ...);
+        if(items.empty()) return;
+
+        build_node(items, 0, items.size(), max_leaf_size);
+        place(items, std::index_sequence_for<Instances...>{});
+    }
+    void clear() {
+        nodes.clear();
+        instances = {};
+    }
+
+    BBox bbox() const {
+        if(nodes.empty()) return {};
+        return nodes[0].bbox;
+    }
+    Trace hit(const Ray& ray) const {
+        Trace ret;
+        Vec2 times = ray.dist_bounds;
+        if(nodes.empty() || !nodes[0].bbox.hit(ray, times)) return ret;
+        hit_subtree<false>(ray, 0, ret);
+        if(ret.hit) compute_interaction(ray, ret);
+        return ret;
+    }
+    // Whether the ray hits anything, for shadow rays: stops at the first hit
+    // found and skips the interaction
+    bool hits(const Ray& ray) const {
+        Trace ret;
+        Vec2 times = ray.dist_bounds;
+        if(nodes.empty() || !nodes[0].bbox.hit(ray, times)) return false;
+        hit_subtree<true>(ray, 0, ret);
+        return ret.hit;
+    }
+    // Any-hit packets only find out whether each ray hit, nothing more
+    void hit(const Ray_Packet& packet, Trace* closest) const {
+        if(nodes.empty()) return;
+        unsigned int mask = packet.pending(packet.all(), closest);
+        if(mask) hit_subtree(packet, mask, 0, closest);
+        if(packet.any_hit()) return;
+        for(size_t i = 0; i < packet.size(); i++) {
+            if(closest[i].hit) compute_interaction(packet[i], closest[i]);
+        }
+    }
+
+    size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const {
+        size_t max_level = 0;
+        if(!nodes.empty()) visualize(lines, active, level, trans, 0, 0, max_level);
+        return max_level;
+    }
+
+private:
+    static constexpr size_t n_kinds = sizeof...(Instances);
+    template<size_t K> using Kind = std::tuple_element_t<K, std::tuple<Instances...>>;
+
+    struct Item {
+        BBox box;
+        Vec3 center;
+        unsigned int kind, index;
+    };
+
+    struct Node {
+        BBox bbox;
+        unsigned int l = 0, r = 0;        // children, unless a leaf
+        unsigned int start = 0, size = 0; // a leaf's instances, in its kind's array
+        unsigned int kind = 0;
+        bool is_leaf() const {
+            return l == r;
+        }
+    };
+
+    // Binned SAH, as BVH builds, except that a leaf can't mix kinds. Returns
+    // the node's index.
+    unsigned int build_node(std::vector<Item>& items, size_t begin, size_t end,
+                            size_t max_leaf_size) {
+
+        // Instances are much costlier to hit than boxes
+        static constexpr float box_cost = 0.125f;
+        static constexpr int n_bins = 16;
+
+        Node node;
+        BBox centers;
+        bool mixed = false;
+        for(size_t i = begin; i < end; i++) {
+            node.bbox.enclose(items[i].box);
+            centers.enclose(items[i].center);
+            mixed = mixed || items[i].kind != items[begin].kind;
+        }
+        unsigned int idx = (unsigned int)nodes.size();
+        nodes.push_back(node);
+
+        size_t n = end - begin;
+        float best_cost = FLT_MAX;
+        int best_axis = -1, best_split = 0;
+        for(int axis = 0; axis < 3; axis++) {
+            float min = centers.min[axis], extent = centers.max[axis] - min;
+            if(!(extent > 0.0f)) continue;
+            BBox boxes[n_bins];
+            size_t counts[n_bins] = {};
+            auto bin = [&](const Item& item) {
+                int b = (int)((item.center[axis] - min) / extent * n_bins);
+                return std::clamp(b, 0, n_bins - 1);
+            };
+            for(size_t i = begin; i < end; i++) {
+                int b = bin(items[i]);
+                boxes[b].enclose(items[i].box);
+                counts[b]++;
+            }
+            float right_area[n_bins];
+            BBox right;
+            size_t right_count[n_bins];
+            size_t count = 0;
+            for(int b = n_bins - 1; b > 0; b--) {
+                right.enclose(boxes[b]);
+                count += counts[b];
+                right_area[b] = right.surface_area();
+                right_count[b] = count;
+            }
+            BBox left;
+            count = 0;
+            for(int b = 1; b < n_bins; b++) {
+                left.enclose(boxes[b - 1]);
+                count += counts[b - 1];
+                if(!count || !right_count[b]) continue;
+                float cost = left.surface_area() * count + right_area[b] * right_count[b];
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+
+        float area = node.bbox.surface_area();
+        bool leaf = !mixed && n <= max_leaf_size &&
+                    (best_axis < 0 || n * area <= box_cost * area + best_cost);
+        if(leaf) {
+            nodes[idx].start = (unsigned int)begin;
+            nodes[idx].size = (unsigned int)n;
+            nodes[idx].kind = items[begin].kind;
+            return idx;
+        }
+
+        size_t mid;
+        if(best_axis >= 0) {
+            float min = centers.min[best_axis];
+            float extent = centers.max[best_axis] - min;
+            auto split = std::partition(items.begin() + begin, items.begin() + end,
+                                        [&](const Item& i) {
+                                            int b = (int)((i.center[best_axis] - min) /
+                                                          extent * n_bins);
+                                            return std::clamp(b, 0, n_bins - 1) < best_split;
+                                        });
+            mid = split - items.begin();
+        } else if(mixed) {
+            // Nowhere to split in space, so split by kind
+            unsigned int first = items[begin].kind;
+            auto split = std::stable_partition(items.begin() + begin, items.begin() + end,
+                                               [&](const Item& i) { return i.kind == first; });
+            mid = split - items.begin();
+        } else {
+            mid = begin + n / 2;
+        }
+
+        unsigned int l = build_node(items, begin, mid, max_leaf_size);
+        unsigned int r = build_node(items, mid, end, max_leaf_size);
+        nodes[idx].l = l;
+        nodes[idx].r = r;
+        return idx;
+    }
+
+    // Reorders each kind's array so leaves' instances are contiguous, and
+    // points the leaves at them
+    template<size_t... K> void place(const std::vector<Item>& items, std::index_sequence<K...>) {
+        (place<K>(items), ...);
+        unsigned int total = 0;
+        ((first[K] = total, total += (unsigned int)instances.template get<Kind<K>>().size()), ...);
+    }
+    template<size_t K> void place(const std::vector<Item>& items) {
+        auto& list = instances.template get<Kind<K>>();
+        std::remove_reference_t<decltype(list)> placed;
+        placed.reserve(list.size());
+        for(Node& node : nodes) {
+            if(!node.is_leaf() || node.kind != K) continue;
+            unsigned int start = (unsigned int)placed.size();
+            for(size_t i = node.start; i < node.start + node.size; i++) {
+                placed.push_back(std::move(list[items[i].index]));
+            }
+            node.start = start;
+        }
+        list = std::move(placed);
+    }
+
+    template<bool any> void hit_subtree(const Ray& ray, unsigned int idx, Trace& closest) const {
+        const Node& n = nodes[idx];
+        if(n.is_leaf()) {
+            hit_leaf<any>(n, ray, closest);
+            return;
+        }
+        Vec2 times_l = ray.dist_bounds, times_r = ray.dist_bounds;
+        bool hit_l = nodes[n.l].bbox.hit(ray, times_l);
+        bool hit_r = nodes[n.r].bbox.hit(ray, times_r);
+        unsigned int near = n.l, far = n.r;
+        if(hit_l && hit_r && times_r.x < times_l.x) {
+            std::swap(near, far);
+            std::swap(times_l, times_r);
+        } else if(!hit_l) {
+            near = n.r;
+            times_l = times_r;
+            hit_l = hit_r;
+            hit_r = false;
+        }
+        if(hit_l && (!closest.hit || times_l.x < closest.distance)) {
+            hit_subtree<any>(ray, near, closest);
+            if(any && closest.hit) return;
+        }
+        if(hit_r && (!closest.hit || times_r.x < closest.distance)) {
+            hit_subtree<any>(ray, far, closest);
+        }
+    }
+
+    // The leaf's kind is the only thing tested at run time: one branch per
+    // kind before it, not per instance
+    template<bool any, size_t K = 0>
+    void hit_leaf(const Node& n, const Ray& ray, Trace& closest) const {
+        if constexpr(K + 1 < n_kinds) {
+            if(n.kind != K) return hit_leaf<any, K + 1>(n, ray, closest);
+        }
+        const auto& list = instances.template get<Kind<K>>();
+        Ray bounded = ray;
+        for(unsigned int i = n.start; i < n.start + n.size; i++) {
+            // Anything past the closest hit so far can be skipped inside the
+            // instance too
+            if(closest.hit) bounded.dist_bounds.y = std::min(ray.dist_bounds.y, closest.distance);
+            Trace found = list[i].hit(bounded);
+            if(!found.hit) continue;
+            found.instance = first[K] + i;
+            closest = Trace::min(closest, found);
+            if(any) return;
+        }
+    }
+
+    void hit_subtree(const Ray_Packet& packet, unsigned int mask, unsigned int idx,
+                     Trace* closest) const {
+
+        const Node& n = nodes[idx];
+        mask = packet.hits(n.bbox, mask, closest);
+        if(!mask) return;
+
+        // The rays have diverged: finish this subtree with whichever is left
+        if(Ray_Packet::count(mask) < Ray_Packet::min_active) {
+            for(size_t i = 0; i < packet.size(); i++) {
+                if(!(mask >> i & 1)) continue;
+                if(packet.any_hit())
+                    hit_subtree<true>(packet[i], idx, closest[i]);
+                else
+                    hit_subtree<false>(packet[i], idx, closest[i]);
+            }
+            return;
+        }
+
+        if(n.is_leaf()) {
+            hit_leaf(n, packet, mask, closest);
+            return;
+        }
+
+        // Visit the child nearer along the first ray first, so the other is more
+        // often culled by the hits found there
+        size_t first_ray = 0;
+        while(!(mask >> first_ray & 1)) first_ray++;
+        unsigned int near = n.l, far = n.r;
+        if(dot(nodes[n.r].bbox.center() - nodes[n.l].bbox.center(), packet[first_ray].dir) <
+           0.0f) {
+            std::swap(near, far);
+        }
+        hit_subtree(packet, mask, near, closest);
+        mask = packet.pending(mask, closest);
+        if(mask) hit_subtree(packet, mask, far, closest);
+    }
+
+    template<size_t K = 0>
+    void hit_leaf(const Node& n, const Ray_Packet& packet, unsigned int mask,
+                  Trace* closest) const {
+        if constexpr(K + 1 < n_kinds) {
+            if(n.kind != K) return hit_leaf<K + 1>(n, packet, mask, closest);
+        }
+        const auto& list = instances.template get<Kind<K>>();
+        for(unsigned int i = n.start; i < n.start + n.size && mask; i++) {
+            list[i].hit(packet, mask, closest, first[K] + i);
+            mask = packet.pending(mask, closest);
+        }
+    }
+
+    // Fills in the rest of a hit, once traversal has found the closest
+    template<size_t K = 0> void compute_interaction(const Ray& ray, Trace& hit) const {
+        if constexpr(K + 1 < n_kinds) {
+            if(hit.instance >= first[K + 1]) return compute_interaction<K + 1>(ray, hit);
+        }
+        instances.template get<Kind<K>>()[hit.instance - first[K]].compute_interaction(ray, hit);
+    }
+
+    template<size_t K = 0>
+    size_t visualize_leaf(const Node& n, GL::Lines& lines, GL::Lines& active, size_t level,
+                          const Mat4& trans) const {
+        if constexpr(K + 1 < n_kinds) {
+            if(n.kind != K) return visualize_leaf<K + 1>(n, lines, active, level, trans);
+        }
+        const auto& list = instances.template get<Kind<K>>();
+        size_t max_level = 0;
+        for(unsigned int i = n.start; i < n.start + n.size; i++) {
+            max_level = std::max(max_level, list[i].visualize(lines, active, level, trans));
+        }
+        return max_level;
+    }
+
+    void visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans,
+                   unsigned int idx, size_t lvl, size_t& max_level) const {
+
+        const Node& n = nodes[idx];
+        max_level = std::max(max_level, lvl);
+
+        Vec3 color = lvl == level ? Vec3(1.0f, 0.0f, 0.0f) : Vec3(1.0f);
+        GL::Lines& add = lvl == level ? active : lines;
+        BBox box = n.bbox;
+        box.transform(trans);
+        for(int i = 0; i < 8; i++) {
+            Vec3 a((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+                   (i & 4) ? box.max.z : box.min.z);
+            // Each corner to its neighbors with one more coordinate at max
+            for(int axis = 0; axis < 3; axis++) {
+                if(i >> axis & 1) continue;
+                Vec3 b = a;
+                b[axis] = box.max[axis];
+                add.add(a, b, color);
+            }
+        }
+
+        if(n.is_leaf()) {
+            size_t c = visualize_leaf(n, lines, active, level - lvl, trans);
+            max_level = std::max(max_level, c);
+        } else {
+            visualize(lines, active, level, trans, n.l, lvl + 1, max_level);
+            visualize(lines, active, level, trans, n.r, lvl + 1, max_level);
+        }
+    }
+
+    std::vector<Node> nodes; // the root first
+    Lists instances;
+    unsigned int first[n_kinds] = {}; // each kind's first instance index
+};
+
+} // namespace PT
@@ -1,5 +1,6 @@
 
 #include "light.h"
+#include "../util/rand.h"
 
 namespace PT {
 
@@ -12,6 +13,28 @@ Light_Sample Directional_Light::sample(Vec3) const {
     return ret;
 }
 
+Light_Emission Directional_Light::emit(Vec3 dir, const BBox& bounds) const {
+
+    Vec3 center = bounds.center();
+    float r = 0.5f * (bounds.max - bounds.min).norm();
+
+    // Uniform point on the disc, pushed back so it starts outside the bounds
+    float s = r * std::sqrt(RNG::unit());
+    float phi = 2.0f * PI_F * RNG::unit();
+    Vec3 disc = Mat4::rotate_to(dir).rotate(Vec3(s * std::cos(phi), 0.0f, s * std::sin(phi)));
+
+    Light_Emission ret;
+    ret.origin = center + disc - dir * r;
+    ret.direction = dir;
+    ret.power = radiance * (PI_F * r * r);
+    return ret;
+}
+
+float Directional_Light::power(const BBox& bounds) const {
+    float r = 0.5f * (bounds.max - bounds.min).norm();
+    return radiance.luma() * PI_F * r * r;
+}
+
 Light_Sample Point_Light::sample(Vec3 from) const {
     Light_Sample ret;
     ret.direction = -from.unit();
@@ -21,6 +44,19 @@ Light_Sample Point_Light::sample(Vec3 from) const {
     return ret;
 }
 
+Light_Emission Point_Light::emit() const {
+    Light_Emission ret;
+    float pdf;
+    ret.direction = Samplers::Sphere::Uniform().sample(pdf);
+    ret.power = radiance / pdf;
+    ret.no_falloff = true;
+    return ret;
+}
+
+float Point_Light::power() const {
+    return radiance.luma() * 4.0f * PI_F;
+}
+
 Light_Sample Spot_Light::sample(Vec3 from) const {
     Light_Sample ret;
     float angle = std::atan2(Vec2(from.x, from.z).norm(), from.y);
@@ -33,6 +69,24 @@ Light_Sample Spot_Light::sample(Vec3 from) const {
     return ret;
 }
 
+Light_Emission Spot_Light::emit() const {
+    Light_Emission ret;
+    float pdf;
+    ret.direction = Samplers::Sphere::Uniform().sample(pdf);
+    ret.no_falloff = true;
+
+    Vec3 d = ret.direction;
+    float angle = std::abs(Degrees(std::atan2(Vec2(d.x, d.z).norm(), d.y)));
+    ret.power =
+        (1.0f - smoothstep(angle_bounds.x / 2.0f, angle_bounds.y / 2.0f, angle)) * radiance / pdf;
+    return ret;
+}
+
+float Spot_Light::power() const {
+    // Upper bound; only used to share photons between lights
+    return radiance.luma() * 4.0f * PI_F;
+}
+
 Light_Sample Rect_Light::sample(Vec3 from) const {
     Light_Sample ret;
 
@@ -40,9 +94,9 @@ Light_Sample Rect_Light::sample(Vec3 from) const {
     Vec3 point(sample.x - size.x / 2.0f, 0.0f, sample.y - size.y / 2.0f);
     Vec3 dir = point - from;
 
-    float cos_theta = dir.y;
     float squared_dist = dir.norm_squared();
     float dist = std::sqrt(squared_dist);
+    float cos_theta = dir.y / dist;
 
     ret.direction = dir / dist;
     ret.distance = dist;
@@ -51,4 +105,126 @@ Light_Sample Rect_Light::sample(Vec3 from) const {
     return ret;
 }
 
+float Rect_Light::pdf(Vec3 from, Vec3 to) const {
+    // Samples from behind the light carry no radiance, so treat them as never taken
+    Vec3 dir = to - from;
+    float cos_theta = dir.y / dir.norm();
+    if(cos_theta <= 0.0f) return 0.0f;
+    return dir.norm_squared() / (size.x * size.y * cos_theta);
+}
+
+Light_Emission Rect_Light::emit() const {
+    Light_Emission ret;
+
+    // The rectangle faces -y; cosine-weighted directions cancel the cosine in the flux
+    float pdf;
+    Vec2 sample = sampler.sample(pdf);
+    Vec3 dir = Samplers::Hemisphere::Cosine().sample(pdf);
+    ret.origin = Vec3(sample.x - size.x / 2.0f, 0.0f, sample.y - size.y / 2.0f);
+    ret.direction = Vec3(dir.x, -dir.y, dir.z);
+    ret.power = radiance * (PI_F * size.x * size.y);
+    return ret;
+}
+
+float Rect_Light::power() const {
+    return radiance.luma() * PI_F * size.x * size.y;
+}
+
+void Mesh_Light::add(const Tri_Mesh& mesh, unsigned int id, const Mat4& T, Spectrum r) {
+
+    objects[id] = {normals.size(), mesh.n_triangles(), r.luma()};
+
+    for(size_t i = 0; i < mesh.n_triangles(); i++) {
+        auto [a, b, c] = mesh.corners(i);
+        Tri tri;
+        tri.v0 = T * a;
+        tri.e1 = T * b - tri.v0;
+        tri.e2 = T * c - tri.v0;
+
+        Vec3 n = cross(tri.e1, tri.e2);
+        float len = n.norm();
+        normals.push_back(len == 0.0f ? Vec3{} : n / len);
+        if(len == 0.0f) continue;
+
+        tri.normal = n / len;
+        tri.area = 0.5f * len;
+        tri.radiance = r;
+        tris.push_back(tri);
+    }
+}
+
+void Mesh_Light::build() {
+    std::vector<float> power(tris.size());
+    for(size_t i = 0; i < tris.size(); i++) {
+        power[i] = tris[i].area * tris[i].radiance.luma();
+    }
+    sampler = Samplers::Alias(power);
+}
+
+Light_Sample Mesh_Light::sample(Vec3 from) const {
+    Light_Sample ret;
+
+    float pmf;
+    const Tri& tri = tris[sampler.sample(pmf)];
+
+    // Uniform point on the triangle
+    float su = std::sqrt(RNG::unit());
+    float v = RNG::unit();
+    Vec3 point = tri.v0 + tri.e1 * (su * (1.0f - v)) + tri.e2 * (su * v);
+    Vec3 dir = point - from;
+
+    float squared_dist = dir.norm_squared();
+    float dist = std::sqrt(squared_dist);
+
+    ret.direction = dir / dist;
+    ret.distance = dist;
+
+    // Emitters are two-sided, matching BSDF_Diffuse
+    float cos_theta = std::abs(dot(tri.normal, ret.direction));
+    ret.pdf = (pmf / tri.area) * squared_dist / cos_theta;
+    ret.radiance = tri.radiance;
+    return ret;
+}
+
+float Mesh_Light::pdf(Vec3 from, const Trace& hit) const {
+
+    // Triangles are picked proportionally to area * luma, so the area density
+    // of any point is its luma over the total power. The cosine is taken with
+    // the triangle's geometric normal, as in sample(), not the shading normal.
+    auto entry = objects.find(hit.object);
+    if(entry == objects.end() || sampler.total <= 0.0f) return 0.0f;
+    const Object_Tris& obj = entry->second;
+    if(hit.primitive >= obj.count) return 0.0f;
+
+    Vec3 dir = hit.position - from;
+    float squared_dist = dir.norm_squared();
+    Vec3 normal = normals[obj.first + hit.primitive];
+    float cos_theta = std::abs(dot(normal, dir)) / std::sqrt(squared_dist);
+    if(cos_theta == 0.0f) return 0.0f;
+    return (obj.luma / sampler.total) * squared_dist / cos_theta;
+}
+
+Light_Emission Mesh_Light::emit() const {
+    Light_Emission ret;
+
+    float pmf;
+    const Tri& tri = tris[sampler.sample(pmf)];
+
+    float su = std::sqrt(RNG::unit());
+    float v = RNG::unit();
+    ret.origin = tri.v0 + tri.e1 * (su * (1.0f - v)) + tri.e2 * (su * v);
+
+    // Two-sided: pick a side, then a cosine-weighted direction about it
+    float pdf;
+    Vec3 dir = Samplers::Hemisphere::Cosine().sample(pdf);
+    Vec3 normal = RNG::coin_flip() ? tri.normal : -tri.normal;
+    ret.direction = Mat4::rotate_to(normal).rotate(dir);
+    ret.power = tri.radiance * (2.0f * PI_F * tri.area / pmf);
+    return ret;
+}
+
+float Mesh_Light::power() const {
+    return 2.0f * PI_F * sampler.total;
+}
+
 } // namespace PT
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <unordered_map>
 #include <variant>
 
 #include "../lib/mathlib.h"
@@ -9,6 +10,8 @@
 #include "../util/hdr_image.h"
 
 #include "samplers.h"
+#include "trace.h"
+#include "tri_mesh.h"
 
 namespace PT {
 
@@ -26,12 +29,31 @@ struct Light_Sample {
     }
 };
 
+// A photon leaving a light. Power is the light's flux over the density with
+// which this origin and direction were chosen.
+struct Light_Emission {
+
+    Vec3 origin, direction;
+    Spectrum power;
+
+    // Point and spot lights don't fall off with distance in this renderer, so their
+    // photons are scaled by the squared length of the first segment to match.
+    bool no_falloff = false;
+
+    void transform(const Mat4& T) {
+        origin = T * origin;
+        direction = T.rotate(direction).unit();
+    }
+};
+
 struct Directional_Light {
 
     Directional_Light(Spectrum r) : radiance(r), sampler(Vec3(0.0f, 1.0f, 0.0f)) {
     }
 
     Light_Sample sample(Vec3 from) const;
+    Light_Emission emit(Vec3 dir, const BBox& bounds) const;
+    float power(const BBox& bounds) const;
 
     Spectrum radiance;
     Samplers::Direction sampler;
@@ -43,6 +65,8 @@ struct Point_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    Light_Emission emit() const;
+    float power() const;
 
     Spectrum radiance;
     Samplers::Point sampler;
@@ -54,6 +78,8 @@ struct Spot_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    Light_Emission emit() const;
+    float power() const;
 
     Spectrum radiance;
     Vec2 angle_bounds;
@@ -66,13 +92,56 @@ struct Rect_Light {
     }
 
     Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, Vec3 to) const;
     bool on_light(Vec3 from, Vec3 hit) const;
+    Light_Emission emit() const;
+    float power() const;
 
     Spectrum radiance;
     Vec2 size;
     Samplers::Rect::Uniform sampler;
 };
 
+// All emissive triangles in the scene, stored in world space. Triangles are
+// picked proportionally to their emitted power, so the area density of a sample
+// only depends on the radiance of the triangle it landed on.
+struct Mesh_Light {
+
+    Mesh_Light() = default;
+
+    // Adds object `id`'s triangles, transformed by T
+    void add(const Tri_Mesh& mesh, unsigned int id, const Mat4& T, Spectrum r);
+    void build();
+
+    // Only meaningful after build(); true if nothing emits
+    bool empty() const {
+        return sampler.empty();
+    }
+
+    Light_Sample sample(Vec3 from) const;
+    float pdf(Vec3 from, const Trace& hit) const;
+    Light_Emission emit() const;
+    float power() const;
+
+    struct Tri {
+        Vec3 v0, e1, e2, normal;
+        float area;
+        Spectrum radiance;
+    };
+
+    // Where each object's geometric normals start in `normals`, how many
+    // there are and the luma they emit, so pdf() can find the triangle hit
+    struct Object_Tris {
+        size_t first = 0, count = 0;
+        float luma = 0.0f;
+    };
+
+    std::vector<Tri> tris;
+    std::vector<Vec3> normals; // of every triangle, by its primitive index in its mesh
+    std::unordered_map<unsigned int, Object_Tris> objects;
+    Samplers::Alias sampler;
+};
+
 class Light {
 public:
     Light(Directional_Light&& l, Scene_ID id, const Mat4& T = Mat4::I)
@@ -91,6 +160,10 @@ public:
         : trans(T), itrans(T.inverse()), _id(id), underlying(std::move(l)) {
         has_trans = trans != Mat4::I;
     }
+    Light(Mesh_Light&& l, Scene_ID id, const Mat4& T = Mat4::I)
+        : trans(T), itrans(T.inverse()), _id(id), underlying(std::move(l)) {
+        has_trans = trans != Mat4::I;
+    }
 
     Light(const Light& src) = delete;
     Light& operator=(const Light& src) = delete;
@@ -105,11 +178,45 @@ public:
         return ret;
     }
 
+    // Solid angle density with which sample(from) picks the point on this light
+    // that was found by tracing a ray from `from`. Zero for discrete lights.
+    float pdf(Vec3 from, const Trace& hit) const {
+        return std::visit(overloaded{[&](const Rect_Light& l) {
+                                         if(!has_trans) return l.pdf(from, hit.position);
+                                         return l.pdf(itrans * from, itrans * hit.position);
+                                     },
+                                     [&](const Mesh_Light& l) { return l.pdf(from, hit); },
+                                     [](const auto&) { return 0.0f; }},
+                          underlying);
+    }
+
+    // Emit a photon. Directional lights cover the disc facing them that holds `bounds`.
+    Light_Emission emit(const BBox& bounds) const {
+        return std::visit(overloaded{[&](const Directional_Light& l) {
+                                         Vec3 dir = trans.rotate(Vec3(0.0f, -1.0f, 0.0f)).unit();
+                                         return l.emit(dir, bounds);
+                                     },
+                                     [&](const auto& l) {
+                                         Light_Emission ret = l.emit();
+                                         if(has_trans) ret.transform(trans);
+                                         return ret;
+                                     }},
+                          underlying);
+    }
+
+    // Total emitted flux (luma), used to share photons between lights
+    float power(const BBox& bounds) const {
+        return std::visit(overloaded{[&](const Directional_Light& l) { return l.power(bounds); },
+                                     [](const auto& l) { return l.power(); }},
+                          underlying);
+    }
+
     bool is_discrete() const {
         return std::visit(overloaded{[](const Directional_Light&) { return true; },
                                      [](const Point_Light&) { return true; },
                                      [](const Spot_Light&) { return true; },
-                                     [](const Rect_Light&) { return false; }},
+                                     [](const Rect_Light&) { return false; },
+                                     [](const Mesh_Light&) { return false; }},
                           underlying);
     }
 
@@ -126,7 +233,7 @@ private:
     bool has_trans;
     Mat4 trans, itrans;
     Scene_ID _id;
-    std::variant<Directional_Light, Point_Light, Spot_Light, Rect_Light> underlying;
+    std::variant<Directional_Light, Point_Light, Spot_Light, Rect_Light, Mesh_Light> underlying;
 };
 
 } // namespace PT
@@ -45,10 +45,20 @@ public:
 
     Trace hit(Ray ray) const {
         if(has_trans) ray.transform(itrans);
-        Trace ret =
-            std::visit(overloaded{[&ray](const auto& o) { return o.hit(ray); }}, underlying);
+        // Lists and BVHs of objects return finished hits; shapes and meshes
+        // leave the interaction to be computed here
+        Trace ret = std::visit(
+            overloaded{[&ray](const BVH<Object>& o) { return o.hit(ray); },
+                       [&ray](const List<Object>& o) { return o.hit(ray); },
+                       [&ray](const auto& o) {
+                           Trace t = o.hit(ray);
+                           if(t.hit) o.compute_interaction(ray, t);
+                           return t;
+                       }},
+            underlying);
         if(ret.hit) {
             ret.material = material;
+            ret.object = _id;
             if(has_trans) ret.transform(trans, itrans.T());
         }
         return ret;
@@ -64,6 +74,19 @@ public:
             underlying);
     }
 
+    // Deep copy. Only shapes and meshes are copied; the scene never nests lists
+    // or BVHs of objects.
+    Object copy() const {
+        return std::visit(
+            overloaded{[this](const Shape& s) { return Object(Shape(s), _id, material, trans); },
+                       [this](const Tri_Mesh& m) { return Object(m.copy(), _id, material, trans); },
+                       [this](const auto&) {
+                           assert(false);
+                           return Object(Shape(), _id, material, trans);
+                       }},
+            underlying);
+    }
+
     Scene_ID id() const {
         return _id;
     }
@@ -0,0 +1,172 @@
+
+#pragma once
+
+#include <bitset>
+#include <cassert>
+#include <limits>
+#include <type_traits>
+
+#include "../lib/mathlib.h"
+#include "../lib/simd.h"
+#include "trace.h"
+
+namespace PT {
+
+// Up to 16 rays traced through a BVH together, e.g. the camera rays of a 4x4
+// block of pixels. Each box is tested against all of them at once, four at a
+// time, and the packet only splits up once a single ray is left in a subtree.
+// Rays are selected by bit masks: bit i stands for ray i.
+class Ray_Packet {
+public:
+    static constexpr size_t max_rays = 16;
+    // Below this many rays still in a subtree, traversal goes on ray by ray
+    static constexpr size_t min_active = 2;
+
+    // With any_hit set, a ray is done as soon as it hits anything, which is
+    // all shadow rays need to know
+    explicit Ray_Packet(bool any_hit = false) : any(any_hit) {
+    }
+
+    void add(const Ray& ray) {
+        assert(n < max_rays);
+        Vec3 inv(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+        ox[n] = ray.point.x, oy[n] = ray.point.y, oz[n] = ray.point.z;
+        ix[n] = inv.x, iy[n] = inv.y, iz[n] = inv.z;
+
+        if(!n) {
+            o_min = o_max = ray.point;
+            i_min = i_max = inv;
+        } else {
+            o_min = hmin(o_min, ray.point), o_max = hmax(o_max, ray.point);
+            i_min = hmin(i_min, inv), i_max = hmax(i_max, inv);
+        }
+        for(int a = 0; a < 3; a++) {
+            coherent = coherent && std::isfinite(inv[a]) && (i_min[a] > 0.0f) == (i_max[a] > 0.0f);
+        }
+        rays[n++] = ray;
+    }
+
+    size_t size() const {
+        return n;
+    }
+    bool full() const {
+        return n == max_rays;
+    }
+    bool any_hit() const {
+        return any;
+    }
+    const Ray& operator[](size_t i) const {
+        return rays[i];
+    }
+
+    // Mask of every ray in the packet
+    unsigned int all() const {
+        return (1u << n) - 1;
+    }
+    static size_t count(unsigned int mask) {
+        return std::bitset<max_rays>(mask).count();
+    }
+
+    // Rays in mask that still need hits, given the closest found so far
+    unsigned int pending(unsigned int mask, const Trace* closest) const {
+        if(!any) return mask;
+        for(size_t i = 0; i < n; i++) {
+            if(closest[i].hit) mask &= ~(1u << i);
+        }
+        return mask;
+    }
+
+    // Rays in mask that enter the box before their closest hit so far
+    unsigned int hits(const BBox& box, unsigned int mask, const Trace* closest) const {
+
+        alignas(16) float near[max_rays], far[max_rays];
+        const float inf = std::numeric_limits<float>::infinity();
+        float t0 = inf, t1 = -inf;
+        for(size_t i = 0; i < max_rays; i++) {
+            near[i] = 0.0f;
+            far[i] = -inf;
+            if(!(mask >> i & 1)) continue;
+            near[i] = rays[i].dist_bounds.x;
+            far[i] = rays[i].dist_bounds.y;
+            if(closest[i].hit) far[i] = any ? -inf : std::min(far[i], closest[i].distance);
+            t0 = std::min(t0, near[i]);
+            t1 = std::max(t1, far[i]);
+        }
+
+        // Entry and exit intervals over the whole packet: if even the latest
+        // any ray could leave the box is before the earliest it could enter
+        // it, none of them hit it. Needs every ray headed the same way.
+        if(coherent) {
+            for(int a = 0; a < 3; a++) {
+                bool neg = i_min[a] < 0.0f;
+                float enter = neg ? box.max[a] : box.min[a], exit = neg ? box.min[a] : box.max[a];
+                t0 = std::max(t0, interval_mul(a, enter - o_max[a], enter - o_min[a]).x);
+                t1 = std::min(t1, interval_mul(a, exit - o_max[a], exit - o_min[a]).y);
+            }
+            if(t0 > t1) return 0;
+        }
+
+        using namespace SIMD;
+        f4 x0 = set1(box.min.x), y0 = set1(box.min.y), z0 = set1(box.min.z);
+        f4 x1 = set1(box.max.x), y1 = set1(box.max.y), z1 = set1(box.max.z);
+
+        unsigned int ret = 0;
+        for(size_t g = 0; g < n; g += 4) {
+            if(!(mask >> g & 0xf)) continue;
+            f4 o = load(ox + g), i = load(ix + g);
+            f4 a = mul(sub(x0, o), i), b = mul(sub(x1, o), i);
+            f4 t_near = max(load(near + g), min(a, b)), t_far = min(load(far + g), max(a, b));
+            o = load(oy + g), i = load(iy + g);
+            a = mul(sub(y0, o), i), b = mul(sub(y1, o), i);
+            t_near = max(t_near, min(a, b)), t_far = min(t_far, max(a, b));
+            o = load(oz + g), i = load(iz + g);
+            a = mul(sub(z0, o), i), b = mul(sub(z1, o), i);
+            t_near = max(t_near, min(a, b)), t_far = min(t_far, max(a, b));
+            ret |= (unsigned int)le_mask(t_near, t_far) << g;
+        }
+        return ret & mask;
+    }
+
+private:
+    // Range of [lo, hi] times the packet's inverse directions on axis a
+    Vec2 interval_mul(int a, float lo, float hi) const {
+        float p0 = lo * i_min[a], p1 = lo * i_max[a], p2 = hi * i_min[a], p3 = hi * i_max[a];
+        return Vec2(std::min(std::min(p0, p1), std::min(p2, p3)),
+                    std::max(std::max(p0, p1), std::max(p2, p3)));
+    }
+
+    Ray rays[max_rays];
+    size_t n = 0;
+    bool any = false;
+
+    // Ray origins and inverse directions, lane i for ray i
+    alignas(16) float ox[max_rays] = {}, oy[max_rays] = {}, oz[max_rays] = {};
+    alignas(16) float ix[max_rays] = {}, iy[max_rays] = {}, iz[max_rays] = {};
+
+    // Bounds of the same over the packet, and whether every ray has the same
+    // direction signs, so the bounds can be used to cull boxes
+    Vec3 o_min, o_max, i_min, i_max;
+    bool coherent = true;
+};
+
+// Hands a BVH leaf the rays that reach it: all at once to primitives that take
+// packets themselves, one by one to those that don't
+template<typename Primitive, typename = void> struct Packet_Hit {
+    static void hit(const Primitive& prim, const Ray_Packet& packet, unsigned int mask,
+                    Trace* closest) {
+        for(size_t i = 0; i < packet.size(); i++) {
+            if(mask >> i & 1) closest[i] = Trace::min(closest[i], prim.hit(packet[i]));
+        }
+    }
+};
+
+template<typename Primitive>
+struct Packet_Hit<Primitive, std::void_t<decltype(std::declval<const Primitive&>().hit(
+                                 std::declval<const Ray_Packet&>(), 0u, (Trace*)nullptr))>> {
+    static void hit(const Primitive& prim, const Ray_Packet& packet, unsigned int mask,
+                    Trace* closest) {
+        prim.hit(packet, mask, closest);
+    }
+};
+
+} // namespace PT
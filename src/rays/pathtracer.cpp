@@ -1,29 +1,60 @@
 
 #include "pathtracer.h"
 #include "../geometry/util.h"
-#include "../gui/render.h"
+#include "../util/rand.h"
+#include "../util/task_graph.h"
 
-#include <SDL2/SDL.h>
+#include <chrono>
+#include <random>
 #include <thread>
 
 namespace PT {
 
-Pathtracer::Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim)
-    : thread_pool(std::thread::hardware_concurrency()), gui(gui), camera(screen_dim) {
+thread_local Path_Guide::Pass Pathtracer::guide_pass;
+thread_local const Photon_Map* Pathtracer::caustics = nullptr;
+
+// Render timings are kept in steady clock ticks
+static unsigned long long now_ticks() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+static double ticks_per_second() {
+    using Period = std::chrono::steady_clock::period;
+    return (double)Period::den / (double)Period::num;
+}
+
+// Pixels on a side of the blocks whose camera rays are traced as one packet
+static const size_t block_size = 4;
+static_assert(block_size * block_size <= Ray_Packet::max_rays);
+
+Pathtracer::Pathtracer(Vec2 screen_dim)
+    : Pathtracer(screen_dim, std::make_shared<Thread_Pool>(Thread_Pool::default_threads())) {
+}
+
+Pathtracer::Pathtracer(Vec2 screen_dim, const Pathtracer& share)
+    : Pathtracer(screen_dim, share.thread_pool) {
+}
+
+Pathtracer::Pathtracer(Vec2 screen_dim, std::shared_ptr<Thread_Pool> pool)
+    : thread_pool(std::move(pool)), camera(screen_dim) {
     accumulator_samples = 0;
     total_epochs = 0;
     completed_epochs = 0;
     out_w = out_h = 0;
     n_samples = 0;
     n_area_samples = 0;
+    samples_done = 0;
+    next_stream = 0;
+    denoised_stale = true;
 }
 
 Pathtracer::~Pathtracer() {
     cancel();
-    thread_pool.stop();
+    std::lock_guard<std::mutex> lock(checkpoint_mut);
+    if(checkpoint_write.valid()) checkpoint_write.wait();
 }
 
-void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
+void Pathtracer::build_lights(Scene& layout_scene, Scene_BVH::Objects& objs) {
 
     lights.clear();
     env_light.reset();
@@ -40,7 +71,7 @@ void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
             } break;
             case Light_Type::sphere: {
                 if(light.opt.has_emissive_map) {
-                    env_light = Env_Light(Env_Map(light.emissive_copy()));
+                    env_light = Env_Light(Env_Map(light.emissive_image()));
                 } else {
                     env_light = Env_Light(Env_Sphere(r));
                 }
@@ -69,9 +100,8 @@ void Pathtracer::build_lights(Scene& layout_scene, std::vector<Object>& objs) {
                     mat_cache[light.id()] = materials.size();
                     materials.push_back(BSDF(BSDF_Diffuse(r)));
                 }
-                objs.push_back(
-                    Object(std::move(Util::quad_mesh(light.opt.size.x, light.opt.size.y)),
-                           light.id(), idx, light.pose.transform()));
+                Tri_Mesh quad(Util::quad_mesh(light.opt.size.x, light.opt.size.y));
+                objs.add(std::move(quad), light.id(), idx, light.pose.transform());
             } break;
             default: return;
             }
@@ -92,10 +122,16 @@ void Pathtracer::build_scene(Scene& layout_scene) {
     // We could also do instancing instead of duplicating the bvh
     // for big meshes, but that's something to add in the future
 
-    // Yeah this could just be a list of futures but future wanted a
-    // default constructor for Object so whatever
+    // Mesh BVHs, the lights and the environment map's sampling tables build
+    // side by side; the top-level BVH and light sampling wait on what they use.
+    Task_Graph graph(*thread_pool);
+    std::vector<Task_Graph::Node> meshes;
+
     std::mutex obj_mut;
-    std::vector<Object> obj_list;
+    Scene_BVH::Objects obj_list, light_objs;
+    Mesh_Light emissive;
+    std::vector<unsigned int> emissive_mats;
+    std::vector<float> light_power;
     materials.clear();
     mat_cache.clear();
 
@@ -120,24 +156,26 @@ void Pathtracer::build_scene(Scene& layout_scene) {
                 materials.push_back(BSDF(BSDF_Glass(opt.transmittance, opt.reflectance, opt.ior)));
             } break;
             case Material_Type::diffuse_light: {
+                if(!obj.is_shape()) emissive_mats.push_back(idx);
                 materials.push_back(BSDF(BSDF_Diffuse(obj.material.emissive())));
             } break;
             default: return;
             }
 
-            thread_pool.enqueue([&, idx]() {
+            meshes.push_back(graph.add("object " + std::to_string(obj.id()), [&, idx]() {
                 if(obj.is_shape()) {
-                    Shape shape(obj.opt.shape);
+                    Sphere sphere(obj.opt.shape.get<Sphere>());
                     std::lock_guard<std::mutex> lock(obj_mut);
-                    obj_list.push_back(
-                        Object(std::move(shape), obj.id(), idx, obj.pose.transform()));
+                    obj_list.add(std::move(sphere), obj.id(), idx, obj.pose.transform());
                 } else {
                     Tri_Mesh mesh(obj.posed_mesh());
                     std::lock_guard<std::mutex> lock(obj_mut);
-                    obj_list.push_back(
-                        Object(std::move(mesh), obj.id(), idx, obj.pose.transform()));
+                    if(obj.material.opt.type == Material_Type::diffuse_light) {
+                        emissive.add(mesh, obj.id(), obj.pose.transform(), obj.material.emissive());
+                    }
+                    obj_list.add(std::move(mesh), obj.id(), idx, obj.pose.transform());
                 }
-            });
+            }));
 
         } else if(item.is<Scene_Particles>()) {
 
@@ -145,7 +183,7 @@ void Pathtracer::build_scene(Scene& layout_scene) {
             unsigned int idx = (unsigned int)materials.size();
             materials.push_back(BSDF(BSDF_Diffuse(particles.opt.color)));
 
-            thread_pool.enqueue([&, idx]() {
+            meshes.push_back(graph.add("particles " + std::to_string(particles.id()), [&, idx]() {
                 Tri_Mesh mesh(particles.mesh());
 
                 const auto& parts = particles.get_particles();
@@ -154,16 +192,90 @@ void Pathtracer::build_scene(Scene& layout_scene) {
                     Mat4 T = Mat4::translate(p.pos) * Mat4::scale(Vec3{particles.opt.scale});
 
                     std::lock_guard<std::mutex> lock(obj_mut);
-                    obj_list.push_back(Object(std::move(copy), particles.id(), idx, T));
+                    obj_list.add(std::move(copy), particles.id(), idx, T);
                 }
-            });
+            }));
         }
     });
 
-    thread_pool.wait();
-    build_lights(layout_scene, obj_list);
+    // Only adds materials for rectangle lights, which no object task reads
+    Task_Graph::Node light_node =
+        graph.add("lights", [&, this]() { build_lights(layout_scene, light_objs); });
+
+    std::vector<Task_Graph::Node> geometry = meshes;
+    geometry.push_back(light_node);
+
+    Task_Graph::Node emissive_node = graph.add(
+        "emissive lights",
+        [&, this]() {
+            // Remember which light samples each emissive material, so paths that
+            // hit it by chance can be weighted against light sampling.
+            emitter_lights.assign(materials.size(), -1);
+            for(size_t i = 0; i < lights.size(); i++) {
+                auto entry = mat_cache.find(lights[i].id());
+                if(entry != mat_cache.end()) emitter_lights[entry->second] = (int)i;
+            }
+
+            emissive.build();
+            if(!emissive.empty()) {
+                for(unsigned int idx : emissive_mats) emitter_lights[idx] = (int)lights.size();
+                lights.push_back(Light(std::move(emissive), 0));
+            }
+        },
+        geometry);
+
+    unsigned long long object_hash = 0;
+    Task_Graph::Node scene_node = graph.add(
+        "top-level bvh",
+        [&, this]() {
+            obj_list.append(std::move(light_objs));
+
+            // Objects arrive in whatever order the threads built them, so their
+            // hashes are combined with a sum
+            obj_list.for_each([&](const auto& obj) {
+                Hasher h;
+                h.add(obj.id());
+                h.add(obj.bbox().min);
+                h.add(obj.bbox().max);
+                object_hash += h.value;
+            });
+
+            scene.build(std::move(obj_list));
+            scene_bounds = scene.bbox();
+        },
+        geometry);
+
+    graph.add(
+        "light power",
+        [&, this]() {
+            for(const Light& light : lights) light_power.push_back(light.power(scene_bounds));
+            photon_lights = Samplers::Alias(light_power);
+        },
+        {emissive_node, scene_node});
+
+    graph.run();
+
+    if(!options.profile.empty()) {
+        std::string err = graph.write_trace(options.profile);
+        if(!err.empty()) warn("Profile failed: %s", err.c_str());
+    }
 
-    scene.build(std::move(obj_list));
+    Hasher h;
+    h.add(object_hash);
+    for(const BSDF& bsdf : materials) {
+        h.add(bsdf.albedo());
+        h.add(bsdf.is_discrete());
+    }
+    for(size_t i = 0; i < lights.size(); i++) {
+        h.add(lights[i].id());
+        h.add(light_power[i]);
+    }
+    if(env_light) {
+        for(Vec3 dir : {Vec3{1.0f, 0.0f, 0.0f}, Vec3{-1.0f, 0.0f, 0.0f}, Vec3{0.0f, 1.0f, 0.0f},
+                        Vec3{0.0f, -1.0f, 0.0f}, Vec3{0.0f, 0.0f, 1.0f}, Vec3{0.0f, 0.0f, -1.0f}})
+            h.add(env_light->sample_direction(dir));
+    }
+    scene_hash = h.value;
 }
 
 void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_samples, size_t depth) {
@@ -172,48 +284,287 @@ void Pathtracer::set_sizes(size_t w, size_t h, size_t samples, size_t area_sampl
     n_samples = samples;
     n_area_samples = area_samples;
     max_depth = depth;
-    accumulator.resize(out_w, out_h);
+    resize_buffers();
+}
+
+void Pathtracer::set_options(const Options& opt) {
+    bool resize = opt.tile_size != options.tile_size;
+    options = opt;
+    if(resize) resize_buffers();
+    denoised_stale = true;
+}
+
+void Pathtracer::resize_buffers() {
+    // Tiled renders never hold the whole frame
+    size_t w = options.tile_size ? 0 : out_w;
+    size_t h = options.tile_size ? 0 : out_h;
+    accumulator.resize(w, h);
+    features.resize(w, h);
+    pixel_samples.assign(w * h, 0);
+    denoised_stale = true;
+}
+
+void Pathtracer::set_denoise(bool enable) {
+    options.denoise = enable;
+    denoised_stale = true;
+}
+
+void Pathtracer::set_ray_log(std::function<void(const Ray&, float, Spectrum)> log) {
+    ray_log = std::move(log);
 }
 
 void Pathtracer::log_ray(const Ray& ray, float t, Spectrum color) {
-    gui.log_ray(ray, t, color);
+    if(ray_log) ray_log(ray, t, color);
 }
 
-void Pathtracer::accumulate(const HDR_Image& sample) {
+void Pathtracer::accumulate(const HDR_Image& sample, const std::vector<unsigned int>& counts,
+                            const Feature_Buffer& sample_features, size_t samples,
+                            Cancel_Source::Token token) {
 
     std::lock_guard<std::mutex> lock(accumulator_mut);
+    if(token.cancelled()) return;
 
     accumulator_samples++;
+    samples_done += samples;
+    float t_epoch = 1.0f / accumulator_samples;
     for(size_t j = 0; j < out_h; j++) {
         for(size_t i = 0; i < out_w; i++) {
+
+            // Weight by valid samples, so epochs that threw some away count for less
+            size_t idx = j * out_w + i;
+            if(!counts[idx]) continue;
+            pixel_samples[idx] += counts[idx];
+            float t = (float)counts[idx] / pixel_samples[idx];
+
             Spectrum& s = accumulator.at(i, j);
             const Spectrum& n = sample.at(i, j);
-            s += (n - s) * (1.0f / accumulator_samples);
+            s += (n - s) * t;
+
+            float luma = n.luma();
+            features.albedo[idx] += (sample_features.albedo[idx] - features.albedo[idx]) * t;
+            features.normal[idx] += (sample_features.normal[idx] - features.normal[idx]) * t;
+            features.depth[idx] += (sample_features.depth[idx] - features.depth[idx]) * t;
+            features.luma_sq[idx] += (luma * luma - features.luma_sq[idx]) * t_epoch;
+            features.direct[idx] += (sample_features.direct[idx] - features.direct[idx]) * t;
+            features.indirect[idx] += (sample_features.indirect[idx] - features.indirect[idx]) * t;
+            if(!features.object_id[idx]) {
+                features.object_id[idx] = sample_features.object_id[idx];
+                features.material_id[idx] = sample_features.material_id[idx];
+            }
         }
     }
+    denoised_stale = true;
 }
 
-void Pathtracer::do_trace(size_t samples) {
+void Pathtracer::do_trace(size_t samples, size_t stream, Cancel_Source::Token token) {
+
+    if(options.guiding) guide_pass = guide.current();
+
+    // Every epoch shoots its own caustic photons, gathered with a radius that
+    // shrinks from epoch to epoch. Averaging the epochs then converges like
+    // progressive photon mapping (Knaus & Zwicker 2011) without sharing a map
+    // between threads.
+    size_t threads = thread_pool->size();
+    Photon_Map caustic_map(options.photon_memory * 1024 * 1024 / (threads * sizeof(Photon)));
+    if(options.caustic_photons && !photon_lights.empty() && !scene_bounds.empty()) {
+        emit_photons(caustic_map, photon_radius(stream), token);
+        caustics = &caustic_map;
+    }
 
     HDR_Image sample(out_w, out_h);
+    Feature_Buffer sample_features;
+    sample_features.resize(out_w, out_h);
+    std::vector<unsigned int> counts(out_w * out_h, 0);
+
+    auto add = [&](size_t i, size_t j, Spectrum p, const Hit_Features& hit) {
+        if(!p.valid()) return;
+        size_t idx = j * out_w + i;
+        sample.at(i, j) += p;
+        sample_features.albedo[idx] += hit.albedo;
+        sample_features.normal[idx] += hit.normal;
+        sample_features.depth[idx] += hit.depth;
+        sample_features.direct[idx] += hit.direct;
+        sample_features.indirect[idx] += p - hit.direct;
+        if(!sample_features.object_id[idx]) {
+            sample_features.object_id[idx] = hit.object_id;
+            sample_features.material_id[idx] = hit.material_id;
+        }
+        counts[idx]++;
+    };
+
+    for(size_t y0 = 0; y0 < out_h; y0 += block_size) {
+        for(size_t x0 = 0; x0 < out_w; x0 += block_size) {
+            size_t x1 = std::min(x0 + block_size, out_w), y1 = std::min(y0 + block_size, out_h);
+            for(size_t s = 0; s < samples; s++) {
+                trace_block(x0, y0, x1, y1, add);
+                if(token.cancelled()) {
+                    if(options.guiding) guide.end_epoch(guide_pass, 0);
+                    guide_pass = {};
+                    caustics = nullptr;
+                    return;
+                }
+            }
+        }
+    }
+
     for(size_t j = 0; j < out_h; j++) {
         for(size_t i = 0; i < out_w; i++) {
+            size_t idx = j * out_w + i;
+            if(!counts[idx]) continue;
+            float inv = 1.0f / counts[idx];
+            sample.at(i, j) *= inv;
+            sample_features.albedo[idx] *= inv;
+            sample_features.normal[idx] *= inv;
+            sample_features.depth[idx] *= inv;
+            sample_features.direct[idx] *= inv;
+            sample_features.indirect[idx] *= inv;
+        }
+    }
+    accumulate(sample, counts, sample_features, samples, token);
+    caustics = nullptr;
 
-            size_t sampled = 0;
-            for(size_t s = 0; s < samples; s++) {
+    if(options.guiding) {
+        guide.end_epoch(guide_pass, samples);
+        guide_pass = {};
+    }
+}
 
-                Spectrum p = trace_pixel(i, j);
-                if(p.valid()) {
-                    sample.at(i, j) += p;
-                    sampled++;
-                }
+void Pathtracer::do_tile(size_t x0, size_t y0, size_t x1, size_t y1,
+                         Cancel_Source::Token token) {
+
+    std::vector<Spectrum> pixels((x1 - x0) * (y1 - y0));
+    std::vector<unsigned int> counts(pixels.size(), 0);
+
+    auto add = [&](size_t i, size_t j, Spectrum p, const Hit_Features&) {
+        if(!p.valid()) return;
+        size_t idx = (j - y0) * (x1 - x0) + (i - x0);
+        pixels[idx] += p;
+        counts[idx]++;
+    };
+
+    for(size_t by = y0; by < y1; by += block_size) {
+        for(size_t bx = x0; bx < x1; bx += block_size) {
+            for(size_t s = 0; s < n_samples; s++) {
+                trace_block(bx, by, std::min(bx + block_size, x1), std::min(by + block_size, y1),
+                            add);
+                if(token.cancelled()) return;
+            }
+        }
+    }
+    for(size_t idx = 0; idx < pixels.size(); idx++) {
+        if(counts[idx]) pixels[idx] *= 1.0f / counts[idx];
+    }
+    film->write(x0, y0, x1 - x0, y1 - y0, pixels);
+}
 
-                if(cancel_flag) return;
+// Camera rays through neighbouring pixels are nearly parallel, so one sample
+// for each pixel of a block finds its first hits as a packet. Shadow rays from
+// those hits to each point, spot or directional light then go as a packet
+// too, and trace_ray goes on from there for each pixel.
+void Pathtracer::trace_block(
+    size_t x0, size_t y0, size_t x1, size_t y1,
+    const std::function<void(size_t, size_t, Spectrum, const Hit_Features&)>& f) {
+
+    Ray_Packet packet;
+    for(size_t j = y0; j < y1; j++) {
+        for(size_t i = x0; i < x1; i++) packet.add(pixel_ray(i, j));
+    }
+    Trace hits[Ray_Packet::max_rays];
+    scene.hit(packet, hits);
+
+    std::vector<Shadow> shadows;
+    for(size_t l = 0; l < lights.size(); l++) {
+
+        const Light& light = lights[l];
+        if(!light.is_discrete()) continue;
+        if(shadows.empty()) shadows.resize(packet.size() * lights.size(), Shadow::unknown);
+
+        // Same shadow ray trace_ray would cast, skipping lights behind the surface
+        Ray_Packet shadow(true);
+        size_t from[Ray_Packet::max_rays];
+        for(size_t k = 0; k < packet.size(); k++) {
+            const Trace& hit = hits[k];
+            if(!hit.hit) continue;
+            const BSDF& bsdf = materials[hit.material];
+            if(bsdf.is_discrete()) continue;
+            Vec3 normal = hit.normal;
+            if(!bsdf.is_sided() && dot(normal, packet[k].dir) > 0.0f) normal = -normal;
+
+            Light_Sample sample = light.sample(hit.position);
+            if(dot(normal, sample.direction) <= 0.0f) continue;
+            Ray ray(hit.position, sample.direction);
+            ray.dist_bounds = Vec2(EPS_F, sample.distance - EPS_F);
+            from[shadow.size()] = k;
+            shadow.add(ray);
+        }
+
+        Trace blocked[Ray_Packet::max_rays];
+        scene.hit(shadow, blocked);
+        for(size_t s = 0; s < shadow.size(); s++) {
+            Shadow& known = shadows[from[s] * lights.size() + l];
+            known = blocked[s].hit ? Shadow::blocked : Shadow::visible;
+        }
+    }
+
+    size_t w = x1 - x0;
+    for(size_t k = 0; k < packet.size(); k++) {
+        Primary_Hit primary{hits[k], shadows.empty() ? nullptr : &shadows[k * lights.size()]};
+        Hit_Features features;
+        Spectrum p = trace_ray(packet[k], 0.0f, false, &features, &primary);
+        f(x0 + k % w, y0 + k / w, p, features);
+    }
+}
+
+void Pathtracer::emit_photons(Photon_Map& map, float radius, Cancel_Source::Token token) {
+
+    // Only photons that reach a diffuse surface through at least one delta
+    // bounce are stored; trace_ray finds every other path by itself.
+    size_t emitted = 0;
+    for(; emitted < options.caustic_photons && !map.full() && !token.cancelled(); emitted++) {
+
+        float pmf;
+        const Light& light = lights[photon_lights.sample(pmf)];
+        Light_Emission emission = light.emit(scene_bounds);
+        Spectrum power = emission.power / pmf;
+
+        Ray ray(emission.origin, emission.direction);
+        bool specular = false;
+        for(size_t depth = 0; depth <= max_depth; depth++) {
+
+            Trace hit = scene.hit(ray);
+            if(!hit.hit) break;
+            if(depth == 0 && emission.no_falloff) power *= hit.distance * hit.distance;
+
+            const BSDF& bsdf = materials[hit.material];
+            if(!bsdf.is_discrete()) {
+                if(specular) map.add({hit.position, -ray.dir, power});
+                break;
             }
-            sample.at(i, j) *= (1.0f / sampled);
+
+            if(!bsdf.is_sided() && dot(hit.normal, ray.dir) > 0.0f) hit.normal = -hit.normal;
+            Mat4 object_to_world = Mat4::rotate_to(hit.normal);
+            Vec3 out_dir = object_to_world.T().rotate(-ray.dir);
+
+            BSDF_Sample sample = bsdf.sample(out_dir);
+            if(sample.pdf <= 0.0f) break;
+            power *= sample.attenuation * (1.0f / sample.pdf);
+            if(power.luma() <= 0.0f) break;
+
+            ray = Ray(hit.position, object_to_world.rotate(sample.direction));
+            ray.dist_bounds.x = EPS_F;
+            specular = true;
         }
     }
-    accumulate(sample);
+    map.build(radius, emitted);
+}
+
+float Pathtracer::photon_radius(size_t pass) const {
+    // r_k^2 = r_0^2 * prod_{j=1..k} (j - 1 + alpha) / j
+    const float alpha = 2.0f / 3.0f;
+    float k = (float)pass;
+    float r0 = 0.005f * (scene_bounds.max - scene_bounds.min).norm();
+    return r0 * std::sqrt(
+                    std::exp(std::lgamma(k + alpha) - std::lgamma(alpha) - std::lgamma(k + 1.0f)));
 }
 
 bool Pathtracer::in_progress() const {
@@ -221,7 +572,7 @@ bool Pathtracer::in_progress() const {
 }
 
 std::pair<float, float> Pathtracer::completion_time() const {
-    double freq = (double)SDL_GetPerformanceFrequency();
+    double freq = ticks_per_second();
     return {(float)(build_time / freq), (float)(render_time / freq)};
 }
 
@@ -233,53 +584,325 @@ size_t Pathtracer::visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t dep
     return scene.visualize(lines, active, depth, Mat4::I);
 }
 
+void Pathtracer::reset_accumulator() {
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    accumulator.clear({});
+    features.clear();
+    pixel_samples.assign(out_w * out_h, 0);
+    accumulator_samples = 0;
+    samples_done = 0;
+    denoised_stale = true;
+}
+
 void Pathtracer::begin_render(Scene& layout_scene, const Camera& cam, bool add_samples) {
 
-    size_t n_threads = std::thread::hardware_concurrency();
-    size_t samples_per_epoch = std::max(size_t(1), n_samples / (n_threads * 10));
+    if(!add_samples) {
+        prepare(layout_scene, cam);
+        begin_prepared();
+        return;
+    }
 
     cancel();
-    total_epochs = n_samples / samples_per_epoch + !!(n_samples % samples_per_epoch);
+    camera = cam;
+    enqueue_epochs(n_samples);
+}
 
-    if(!add_samples) {
-        accumulator.clear({});
-        accumulator_samples = 0;
-        build_time = SDL_GetPerformanceCounter();
-        build_scene(layout_scene);
-        build_time = SDL_GetPerformanceCounter() - build_time;
-    }
-    render_time = SDL_GetPerformanceCounter();
-    
+void Pathtracer::begin_prepared() {
+
+    reset_accumulator();
+
+    std::random_device rd;
+    render_seed = ((unsigned long long)rd() << 32) | rd();
+    next_stream = 0;
+
+    if(options.guiding)
+        guide.reset(scene.bbox(), n_samples);
+    else
+        guide.clear();
+
+    enqueue_epochs(n_samples);
+}
+
+void Pathtracer::prepare(Scene& layout_scene, const Camera& cam) {
+    cancel();
+    build_time = now_ticks();
+    build_scene(layout_scene);
+    build_time = now_ticks() - build_time;
+    camera = cam;
+}
+
+void Pathtracer::set_camera(const Camera& cam) {
+    cancel();
     camera = cam;
+}
+
+void Pathtracer::begin_chunk(unsigned long long seed, unsigned long long first_stream,
+                             size_t samples) {
+
+    cancel();
+    reset_accumulator();
+    render_seed = seed;
+    next_stream = first_stream;
+
+    if(options.guiding)
+        guide.reset(scene.bbox(), samples);
+    else
+        guide.clear();
 
-    for(size_t s = 0; s < n_samples; s += samples_per_epoch) {
-        size_t samples = (s + samples_per_epoch) > n_samples ? n_samples - s : samples_per_epoch;
-        thread_pool.enqueue([samples, this]() {
-            do_trace(samples);
+    enqueue_epochs(samples);
+}
+
+void Pathtracer::begin_tiles(Scene& layout_scene, const Camera& cam, Scratch_Image& target) {
+
+    prepare(layout_scene, cam);
+    guide.clear();
+    film = &target;
+
+    std::random_device rd;
+    render_seed = ((unsigned long long)rd() << 32) | rd();
+
+    Cancel_Source::Token token = cancel_source.token();
+    size_t tile = options.tile_size;
+    size_t cols = (out_w + tile - 1) / tile, rows = (out_h + tile - 1) / tile;
+    total_epochs = cols * rows;
+    render_time = now_ticks();
+
+    for(size_t ty = 0; ty < rows; ty++) {
+        for(size_t tx = 0; tx < cols; tx++) {
+            size_t x0 = tx * tile, y0 = ty * tile;
+            size_t x1 = std::min(x0 + tile, out_w), y1 = std::min(y0 + tile, out_h);
+            size_t stream = ty * cols + tx;
+            enqueue(token, [=]() {
+                RNG::seed(render_seed, stream);
+                do_tile(x0, y0, x1, y1, token);
+                if(completed_epochs.fetch_add(1) + 1 == total_epochs) {
+                    render_time = now_ticks() - render_time;
+                }
+            });
+        }
+    }
+}
+
+std::string Pathtracer::resume_render(Scene& layout_scene, const Camera& cam) {
+
+    Checkpoint saved;
+    std::string err = saved.read(options.checkpoint);
+    if(!err.empty()) return err;
+
+    prepare(layout_scene, cam);
+    if(saved.w != out_w || saved.h != out_h || saved.fingerprint != fingerprint()) {
+        return "The checkpoint was rendered from a different scene, camera, or settings.";
+    }
+    restore(std::move(saved));
+
+    size_t remaining = n_samples > samples_done ? n_samples - samples_done : 0;
+    info("Resuming from %zu of %zu samples.", samples_done, n_samples);
+
+    // The learned guide isn't saved, so it starts training again
+    if(options.guiding)
+        guide.reset(scene.bbox(), remaining);
+    else
+        guide.clear();
+
+    enqueue_epochs(remaining);
+    return {};
+}
+
+void Pathtracer::enqueue_epochs(size_t samples) {
+
+    size_t n_threads = thread_pool->size();
+    size_t samples_per_epoch = std::max(size_t(1), samples / (n_threads * 10));
+    total_epochs = samples / samples_per_epoch + !!(samples % samples_per_epoch);
+
+    render_fingerprint = fingerprint();
+    render_time = now_ticks();
+    checkpoint_time = render_time;
+
+    Cancel_Source::Token token = cancel_source.token();
+    for(size_t s = 0; s < samples; s += samples_per_epoch) {
+        size_t n = (s + samples_per_epoch) > samples ? samples - s : samples_per_epoch;
+        size_t stream = next_stream++;
+        enqueue(token, [n, stream, token, this]() {
+            RNG::seed(render_seed, stream);
+            do_trace(n, stream, token);
             size_t completed = completed_epochs.fetch_add(1);
-            if(completed + 1 == total_epochs) {
-                Uint64 done = SDL_GetPerformanceCounter();
+            bool last = completed + 1 == total_epochs;
+            if(last) {
+                unsigned long long done = now_ticks();
                 render_time = done - render_time;
             }
+            if(!token.cancelled()) write_checkpoint(last);
         });
     }
 }
 
+unsigned long long Pathtracer::fingerprint() const {
+    Hasher h;
+    h.add(scene_hash);
+    h.add(camera.get_view());
+    h.add(camera.get_fov());
+    h.add(camera.get_ar());
+    h.add(camera.get_ap());
+    h.add(camera.get_dist());
+    h.add(out_w);
+    h.add(out_h);
+    h.add(n_area_samples);
+    h.add(max_depth);
+    h.add(options.guiding);
+    h.add(options.caustic_photons);
+    return h.value;
+}
+
+Checkpoint Pathtracer::snapshot() {
+
+    Checkpoint c;
+    c.fingerprint = render_fingerprint;
+    c.seed = render_seed;
+    c.w = out_w;
+    c.h = out_h;
+    c.pixels.resize(out_w * out_h);
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    // Streams handed to unfinished epochs are skipped, not reused
+    c.next_stream = next_stream;
+    c.epochs = accumulator_samples;
+    c.samples = samples_done;
+    for(size_t i = 0; i < out_w * out_h; i++) c.pixels[i] = accumulator.at(i);
+    c.counts = pixel_samples;
+    c.features = features;
+    return c;
+}
+
+void Pathtracer::restore(Checkpoint&& saved) {
+
+    cancel();
+
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    out_w = saved.w;
+    out_h = saved.h;
+    accumulator.resize(out_w, out_h);
+    for(size_t i = 0; i < out_w * out_h; i++) accumulator.at(i) = saved.pixels[i];
+    pixel_samples = std::move(saved.counts);
+    features = std::move(saved.features);
+    accumulator_samples = saved.epochs;
+    samples_done = saved.samples;
+    render_seed = saved.seed;
+    next_stream = saved.next_stream;
+    render_fingerprint = saved.fingerprint;
+    denoised_stale = true;
+}
+
+void Pathtracer::write_checkpoint(bool force) {
+
+    if(options.checkpoint.empty()) return;
+
+    // Render threads never wait here: if another thread is already checkpointing,
+    // or the last file is still being written, the next epoch tries again.
+    std::unique_lock<std::mutex> lock(checkpoint_mut, std::defer_lock);
+    if(force)
+        lock.lock();
+    else if(!lock.try_lock())
+        return;
+
+    unsigned long long now = now_ticks();
+    auto interval = (unsigned long long)(options.checkpoint_interval * ticks_per_second());
+    if(!force && now - checkpoint_time < interval) return;
+
+    if(checkpoint_write.valid()) {
+        if(!force && checkpoint_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        checkpoint_write.wait();
+    }
+    checkpoint_time = now;
+
+    // Copying the buffers only holds the accumulator for a moment; the disk
+    // write happens on its own thread.
+    checkpoint_write = std::async(std::launch::async,
+                                  [c = snapshot(), file = options.checkpoint]() {
+                                      std::string err = c.write(file);
+                                      if(!err.empty()) warn("Checkpoint failed: %s", err.c_str());
+                                  });
+}
+
+void Pathtracer::enqueue(Cancel_Source::Token token, std::function<void()>&& task) {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mut);
+        tasks++;
+    }
+    thread_pool->enqueue([this, token, task = std::move(task)]() {
+        if(!token.cancelled()) task();
+        std::lock_guard<std::mutex> lock(tasks_mut);
+        if(--tasks == 0) tasks_cv.notify_all();
+    });
+}
+
 void Pathtracer::cancel() {
-    cancel_flag = true;
-    thread_pool.clear();
+    // Queued epochs return as soon as they're dequeued and running ones give
+    // up within a sample, so this only waits for traces already underway.
+    // Their scene and camera may be about to change, so they have to be out
+    // before it returns. The pool may be shared, so only this tracer's tasks
+    // are waited for.
+    cancel_source.cancel();
+    std::unique_lock<std::mutex> lock(tasks_mut);
+    tasks_cv.wait(lock, [this]() { return tasks == 0; });
+    lock.unlock();
     completed_epochs = 0;
     total_epochs = 0;
-    cancel_flag = false;
     build_time = 0;
-    render_time = SDL_GetPerformanceCounter() - render_time;
+    render_time = now_ticks() - render_time;
+}
+
+void Pathtracer::update_denoised(bool force) {
+
+    if(!denoised_stale) return;
+
+    // While rendering, only refresh twice a second: denoising competes with the
+    // render threads for the CPU.
+    unsigned long long now = now_ticks();
+    if(!force && in_progress() && now - denoise_time < ticks_per_second() / 2) return;
+
+    HDR_Image color;
+    Feature_Buffer snapshot;
+    size_t epochs;
+    {
+        std::lock_guard<std::mutex> lock(accumulator_mut);
+        color = accumulator.copy();
+        snapshot = features;
+        epochs = accumulator_samples;
+        denoised_stale = false;
+    }
+
+    denoise(color, snapshot, epochs, denoised);
+    denoise_time = now_ticks();
 }
 
 const HDR_Image& Pathtracer::get_output() {
-    return accumulator;
+    if(!options.denoise) return accumulator;
+    update_denoised(true);
+    return denoised;
+}
+
+HDR_Image Pathtracer::preview() {
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    return accumulator.copy();
+}
+
+Feature_Buffer Pathtracer::get_features() {
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    return features;
+}
+
+std::string Pathtracer::save_aovs(const std::string& file) {
+    const HDR_Image& beauty = get_output();
+    std::lock_guard<std::mutex> lock(accumulator_mut);
+    return write_aovs(file, beauty, features);
 }
 
 const GL::Tex2D& Pathtracer::get_output_texture(float exposure) {
+    if(options.denoise) {
+        update_denoised(false);
+        return denoised.get_texture(exposure);
+    }
     std::lock_guard<std::mutex> lock(accumulator_mut);
     return accumulator.get_texture(exposure);
 }
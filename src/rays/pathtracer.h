@@ -2,68 +2,175 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 
 #include "../lib/mathlib.h"
 #include "../scene/scene.h"
 #include "../util/hdr_image.h"
+#include "../util/scratch_image.h"
 #include "../util/thread_pool.h"
 
+#include "aovs.h"
 #include "bsdf.h"
+#include "checkpoint.h"
+#include "denoiser.h"
 #include "env_light.h"
+#include "guiding.h"
 #include "light.h"
 #include "object.h"
-
-namespace Gui {
-class Widget_Render;
-}
+#include "photon_map.h"
+#include "scene_bvh.h"
 
 namespace PT {
 
 class Pathtracer {
 public:
-    Pathtracer(Gui::Widget_Render& gui, Vec2 screen_dim);
+    Pathtracer(Vec2 screen_dim);
+    // Traces on share's threads instead of starting its own
+    Pathtracer(Vec2 screen_dim, const Pathtracer& share);
     ~Pathtracer();
 
+    // Optional integrator features, all off by default
+    struct Options {
+        bool guiding = false;
+        size_t caustic_photons = 0; // photons traced per epoch; 0 turns the caustic map off
+        size_t photon_memory = 256; // megabytes of stored photons across all render threads
+        bool denoise = false;
+        std::string checkpoint;           // file to periodically save the render to, if any
+        float checkpoint_interval = 300.0f; // seconds between checkpoints
+        size_t tile_size = 0; // if set, render tiles straight to a file; see begin_tiles
+        std::string profile;  // Chrome trace of each scene build's phases, if any
+    };
+
     void set_sizes(size_t w, size_t h, size_t pixel_samples, size_t area_samples, size_t depth);
+    void set_options(const Options& opt);
+    void set_denoise(bool enable); // may change mid-render
+    // Where log_ray() sends the rays it's given; they're dropped if unset
+    void set_ray_log(std::function<void(const Ray&, float, Spectrum)> log);
 
     const HDR_Image& get_output();
+    HDR_Image preview(); // copy of the render so far, safe to take while it runs
+    Feature_Buffer get_features();
+    std::string save_aovs(const std::string& file);
     const GL::Tex2D& get_output_texture(float exposure);
     size_t visualize_bvh(GL::Lines& lines, GL::Lines& active, size_t level);
 
     void begin_render(Scene& scene, const Camera& camera, bool add_samples = false);
+    // Same as begin_render, but in two steps, so the scene can be built while
+    // something else renders
+    void prepare(Scene& scene, const Camera& camera);
+    void begin_prepared();
+    // Look at the scene from the last prepare() through another camera
+    void set_camera(const Camera& camera);
+    // Renders the frame in tiles of options.tile_size, each taking every sample
+    // before it's written to film. Only the tiles being traced are in memory,
+    // so there's no accumulator, and nothing that needs the whole frame:
+    // denoising, path guiding and caustic photons are left out.
+    void begin_tiles(Scene& scene, const Camera& camera, Scratch_Image& film);
+    // Continue the render saved in options.checkpoint up to the current sample count
+    std::string resume_render(Scene& scene, const Camera& camera);
+
+    // For distributed rendering: after prepare(), render sample ranges from
+    // given RNG streams into a cleared image
+    void begin_chunk(unsigned long long seed, unsigned long long first_stream, size_t samples);
+
+    // The render so far, as saved to checkpoints
+    Checkpoint snapshot();
+    void restore(Checkpoint&& saved);
+    unsigned long long fingerprint() const; // of the scene, camera and settings
     void cancel();
     bool in_progress() const;
     float progress() const;
     std::pair<float, float> completion_time() const;
 
 private:
+    Pathtracer(Vec2 screen_dim, std::shared_ptr<Thread_Pool> pool);
+
     // Internal
     void build_scene(Scene& scene);
-    void build_lights(Scene& scene, std::vector<Object>& objs);
-    void do_trace(size_t samples);
-    void accumulate(const HDR_Image& sample);
+    void build_lights(Scene& scene, Scene_BVH::Objects& objs);
+    void resize_buffers();
+    void reset_accumulator();
+    void enqueue_epochs(size_t samples);
+    void do_trace(size_t samples, size_t stream, Cancel_Source::Token token);
+    void do_tile(size_t x0, size_t y0, size_t x1, size_t y1, Cancel_Source::Token token);
+    void trace_block(size_t x0, size_t y0, size_t x1, size_t y1,
+                     const std::function<void(size_t, size_t, Spectrum, const Hit_Features&)>& f);
+    void emit_photons(Photon_Map& map, float radius, Cancel_Source::Token token);
+    float photon_radius(size_t pass) const;
+    void accumulate(const HDR_Image& sample, const std::vector<unsigned int>& counts,
+                    const Feature_Buffer& sample_features, size_t samples,
+                    Cancel_Source::Token token);
+    void enqueue(Cancel_Source::Token token, std::function<void()>&& task);
+    void write_checkpoint(bool force);
+    void update_denoised(bool force);
     bool tonemap();
 
-    Gui::Widget_Render& gui;
+    std::function<void(const Ray&, float, Spectrum)> ray_log;
     unsigned long long render_time, build_time;
-    Thread_Pool thread_pool;
-    bool cancel_flag = false;
+    std::shared_ptr<Thread_Pool> thread_pool; // may be another tracer's too
+    Cancel_Source cancel_source; // tasks check their token every sample
+
+    // This tracer's tasks in the pool, so cancel() can wait for just its own
+    size_t tasks = 0;
+    std::mutex tasks_mut;
+    std::condition_variable tasks_cv;
 
     HDR_Image accumulator;
     std::mutex accumulator_mut;
     size_t total_epochs, accumulator_samples;
     std::atomic<size_t> completed_epochs;
+    std::vector<unsigned int> pixel_samples; // valid samples accumulated into each pixel
+    size_t samples_done;                     // samples per pixel traced so far
+
+    // Epoch k seeds its RNG with (render_seed, k), so a render can be resumed
+    // without repeating samples
+    unsigned long long render_seed = 0, render_fingerprint = 0, scene_hash = 0;
+    std::atomic<unsigned long long> next_stream;
+
+    std::mutex checkpoint_mut;
+    std::future<void> checkpoint_write;
+    unsigned long long checkpoint_time = 0;
+
+    Scratch_Image* film = nullptr; // where begin_tiles renders to
+
+    Feature_Buffer features;
+    HDR_Image denoised;
+    std::atomic<bool> denoised_stale;
+    unsigned long long denoise_time = 0;
+
+    Options options;
+    Path_Guide guide;
+    static thread_local Path_Guide::Pass guide_pass; // trees used by this thread's epoch
+
+    BBox scene_bounds;
+    Samplers::Alias photon_lights; // picks lights by emitted power
+    static thread_local const Photon_Map* caustics; // this thread's epoch's photons, if any
+
+    // What trace_block found for a camera ray by tracing it in a packet with its
+    // neighbours: the first hit, and whether the way from there to each light
+    // is blocked, for the discrete lights it traced shadow rays to
+    enum class Shadow : unsigned char { unknown, visible, blocked };
+    struct Primary_Hit {
+        Trace hit;
+        const Shadow* shadows = nullptr; // one per light
+    };
 
     /// Relevant to student
-    Spectrum trace_pixel(size_t x, size_t y);
-    Spectrum trace_ray(const Ray& ray);
+    Ray pixel_ray(size_t x, size_t y);
+    Spectrum trace_ray(const Ray& ray, float bsdf_pdf = 0.0f, bool caustic_path = false,
+                       Hit_Features* features = nullptr, const Primary_Hit* primary = nullptr);
     void log_ray(const Ray& ray, float t, Spectrum color = Spectrum{1.0f});
 
-    BVH<Object> scene;
+    Scene_BVH scene;
     std::vector<Light> lights;
     std::vector<BSDF> materials;
+    std::vector<int> emitter_lights; // per material: index of the light sampling it, or -1
     std::optional<Env_Light> env_light; // only one of these per scene
     std::unordered_map<Scene_ID, size_t> mat_cache;
 
@@ -0,0 +1,45 @@
+
+#include "photon_map.h"
+
+namespace PT {
+
+Photon_Map::Photon_Map(size_t capacity) : capacity(capacity) {
+}
+
+size_t Photon_Map::bucket(int x, int y, int z) const {
+    size_t h = (size_t)((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^
+                        (unsigned int)z * 83492791u);
+    return h & (starts.size() - 2);
+}
+
+void Photon_Map::build(float r, size_t emitted) {
+
+    radius = r;
+
+    // Power-of-two bucket count, at least one bucket per photon
+    size_t n_buckets = 1;
+    while(n_buckets < photons.size()) n_buckets *= 2;
+    starts.assign(n_buckets + 1, 0);
+
+    float cell = 2.0f * radius;
+    std::vector<size_t> buckets(photons.size());
+    for(size_t i = 0; i < photons.size(); i++) {
+        Vec3 c = photons[i].position / cell;
+        buckets[i] = bucket((int)std::floor(c.x), (int)std::floor(c.y), (int)std::floor(c.z));
+        starts[buckets[i] + 1]++;
+    }
+    for(size_t b = 0; b < n_buckets; b++) starts[b + 1] += starts[b];
+
+    // Counting sort into bucket order
+    float scale = emitted ? 1.0f / emitted : 0.0f;
+    std::vector<unsigned int> next(starts.begin(), starts.end() - 1);
+    std::vector<Photon> sorted(photons.size());
+    for(size_t i = 0; i < photons.size(); i++) {
+        Photon& p = sorted[next[buckets[i]]++];
+        p = photons[i];
+        p.power *= scale;
+    }
+    photons = std::move(sorted);
+}
+
+} // namespace PT
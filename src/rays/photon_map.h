@@ -0,0 +1,81 @@
+
+#pragma once
+
+#include <vector>
+
+#include "../lib/mathlib.h"
+#include "../lib/spectrum.h"
+
+namespace PT {
+
+struct Photon {
+    Vec3 position;
+    Vec3 direction; // towards where the photon came from
+    Spectrum power;
+};
+
+// Photons hashed into a uniform grid with cells twice the gather radius, so a
+// gather only has to visit the 2x2x2 cells its sphere overlaps.
+class Photon_Map {
+public:
+    Photon_Map(size_t capacity);
+
+    bool full() const {
+        return photons.size() >= capacity;
+    }
+    void add(const Photon& photon) {
+        if(!full()) photons.push_back(photon);
+    }
+    size_t size() const {
+        return photons.size();
+    }
+
+    // Sort photons into the grid and divide their power by the number of
+    // photons emitted (including those that were never stored).
+    void build(float radius, size_t emitted);
+
+    // Radiance estimate at pos: sum of f(photon) over photons within the
+    // gather radius, divided by the disc area. f returns BSDF * photon power.
+    template<typename F> Spectrum gather(Vec3 pos, F&& f) const {
+
+        Spectrum ret;
+        if(photons.empty()) return ret;
+
+        float cell = 2.0f * radius;
+        Vec3 lo = (pos - Vec3(radius)) / cell, hi = (pos + Vec3(radius)) / cell;
+        int x0 = (int)std::floor(lo.x), y0 = (int)std::floor(lo.y), z0 = (int)std::floor(lo.z);
+        int x1 = (int)std::floor(hi.x), y1 = (int)std::floor(hi.y), z1 = (int)std::floor(hi.z);
+
+        size_t visited[8];
+        int n_visited = 0;
+        for(int z = z0; z <= z1; z++) {
+            for(int y = y0; y <= y1; y++) {
+                for(int x = x0; x <= x1; x++) {
+
+                    // Distinct cells can share a bucket; only scan each bucket once
+                    size_t b = bucket(x, y, z);
+                    bool seen = false;
+                    for(int i = 0; i < n_visited; i++) seen = seen || visited[i] == b;
+                    if(seen) continue;
+                    visited[n_visited++] = b;
+
+                    for(unsigned int i = starts[b]; i < starts[b + 1]; i++) {
+                        const Photon& p = photons[i];
+                        if((p.position - pos).norm_squared() <= radius * radius) ret += f(p);
+                    }
+                }
+            }
+        }
+        return ret * (1.0f / (PI_F * radius * radius));
+    }
+
+private:
+    size_t bucket(int x, int y, int z) const;
+
+    float radius = 1.0f;
+    size_t capacity;
+    std::vector<Photon> photons;
+    std::vector<unsigned int> starts;
+};
+
+} // namespace PT
@@ -27,6 +27,22 @@ struct Two_Points {
 using Direction = Point;
 using Two_Directions = Two_Points;
 
+// Vose alias table over a list of non-negative weights. Samples an index in O(1).
+struct Alias {
+    Alias() = default;
+    Alias(const std::vector<float>& weights);
+
+    size_t sample(float& pmf) const;
+    float pmf(size_t i) const;
+    bool empty() const {
+        return probs.empty();
+    }
+
+    std::vector<float> probs, accept;
+    std::vector<size_t> alias;
+    float total = 0.0f;
+};
+
 // These are continuous. Note they output a probabilty _density_ function
 namespace Rect {
 
@@ -61,13 +77,20 @@ struct Uniform {
     Hemisphere::Uniform hemi;
 };
 
+// Lat-long parameterization shared by environment maps: u follows phi around
+// the Y axis, v goes from the -Y pole (v = 0) to the +Y pole (v = 1).
+Vec2 to_uv(Vec3 dir);
+Vec3 from_uv(Vec2 uv);
+
+// Importance samples pixels of a lat-long image by luma * sin(theta) through an
+// alias table, so each sample costs O(1) regardless of resolution.
 struct Image {
     Image(const HDR_Image& image);
     Vec3 sample(float& pdf) const;
+    float pdf(Vec3 dir) const;
 
     size_t w = 0, h = 0;
-    std::vector<float> pdf, cdf;
-    float total = 0.0f;
+    Alias pixels;
 };
 
 } // namespace Sphere
@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include "../util/affinity.h"
+
+#include "instance.h"
+
+namespace PT {
+
+// The top-level BVH, read by every render thread. With Affinity enabled on a
+// machine with several NUMA nodes, each node gets its own copy built in its own
+// memory, and threads pinned there trace against that one.
+class Scene_BVH {
+public:
+    // Every kind of instance the path tracer places in the scene
+    using Tree =
+        Instance_BVH<Instance<Tri_Mesh, Identity>, Instance<Tri_Mesh>, Instance<Sphere>>;
+    using Objects = Tree::Lists;
+
+    Scene_BVH() = default;
+
+    Scene_BVH(const Scene_BVH& src) = delete;
+    Scene_BVH& operator=(const Scene_BVH& src) = delete;
+
+    void build(Objects&& objects) {
+        copies.clear();
+        if(!Affinity::enabled() || Affinity::nodes().size() < 2) {
+            main.build(std::move(objects));
+            return;
+        }
+        main.clear();
+        copies.resize(Affinity::nodes().size());
+        Affinity::on_each_node([&](size_t node) { copies[node].build(objects.copy()); });
+        objects = {};
+    }
+
+    BBox bbox() const {
+        return local().bbox();
+    }
+    Trace hit(const Ray& ray) const {
+        return local().hit(ray);
+    }
+    bool hits(const Ray& ray) const {
+        return local().hits(ray);
+    }
+    void hit(const Ray_Packet& packet, Trace* closest) const {
+        local().hit(packet, closest);
+    }
+    size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const {
+        return local().visualize(lines, active, level, trans);
+    }
+
+private:
+    const Tree& local() const {
+        if(copies.empty()) return main;
+        return copies[std::min(Affinity::current_node(), copies.size() - 1)];
+    }
+
+    Tree main;
+    std::vector<Tree> copies; // one per node, if any
+};
+
+} // namespace PT
@@ -18,6 +18,7 @@ public:
 
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    void compute_interaction(const Ray& ray, Trace& hit) const;
 
     float radius = 1.0f;
 
@@ -44,6 +45,10 @@ public:
     Trace hit(Ray ray) const {
         return std::visit(overloaded{[&ray](const auto& o) { return o.hit(ray); }}, underlying);
     }
+    void compute_interaction(const Ray& ray, Trace& hit) const {
+        std::visit(overloaded{[&](const auto& o) { o.compute_interaction(ray, hit); }},
+                   underlying);
+    }
 
     template<typename T> T& get() {
         return std::get<T>(underlying);
@@ -5,12 +5,21 @@
 
 namespace PT {
 
+// A ray's hit. Traversal only fills in which surface was hit and where on it:
+// hit, distance, uv, primitive and instance. The rest is worked out once
+// traversal is done, by compute_interaction() on whatever was hit, rather than
+// for every closer candidate found along the way.
 struct Trace {
 
     bool hit = false;
     float distance = 0.0f;
+    Vec2 uv;                    // barycentric coordinates, on a triangle
+    unsigned int primitive = 0; // index of the triangle hit in its mesh's BVH
+    unsigned int instance = 0;  // index of the instance hit in the scene's BVH
+
     Vec3 position, normal, origin;
     int material = 0;
+    unsigned int object = 0; // Scene_ID of the object hit
 
     static Trace min(const Trace& l, const Trace& r) {
         if(l.hit && r.hit) {
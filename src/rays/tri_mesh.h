@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <array>
+
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 
@@ -18,6 +20,7 @@ class Triangle {
 public:
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    void compute_interaction(const Ray& ray, Trace& hit) const;
 
     size_t visualize(GL::Lines&, GL::Lines&, size_t, const Mat4&) const {
         return size_t(0);
@@ -27,6 +30,7 @@ private:
     Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2);
 
     unsigned int v0, v1, v2;
+    unsigned int id = 0; // index in the mesh's BVH
     Tri_Mesh_Vert* vertex_list;
     friend class Tri_Mesh;
 };
@@ -45,6 +49,22 @@ public:
 
     BBox bbox() const;
     Trace hit(const Ray& ray) const;
+    void hit(const Ray_Packet& packet, Trace* closest) const {
+        triangles.hit(packet, closest);
+    }
+    // Position and normal of a hit found by hit(), in the mesh's space
+    void compute_interaction(const Ray& ray, Trace& hit) const {
+        triangles.primitive(hit.primitive).compute_interaction(ray, hit);
+    }
+
+    // Triangles by the same index hits give as their primitive
+    size_t n_triangles() const {
+        return triangles.n_primitives();
+    }
+    std::array<Vec3, 3> corners(size_t i) const {
+        const Triangle& tri = triangles.primitive(i);
+        return {verts[tri.v0].position, verts[tri.v1].position, verts[tri.v2].position};
+    }
 
     size_t visualize(GL::Lines& lines, GL::Lines& active, size_t level, const Mat4& trans) const;
 
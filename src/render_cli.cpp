@@ -0,0 +1,208 @@
+
+// Path-traces one still from a scene file, without any window, GL context or
+// GUI state, so it runs as-is on display-less render nodes. Animation, job
+// lists, serving and distributed rendering stay in Cardinal3D --headless.
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "lib/log.h"
+#include "rays/pathtracer.h"
+#include "scene/scene.h"
+#include "util/affinity.h"
+#include "util/image_encoder.h"
+#include "util/rand.h"
+#include "util/thread_pool.h"
+#include <sf_libs/CLI11.hpp>
+
+struct Settings {
+    std::string scene_file;
+    std::string env_map_file;
+    std::string output_file = "out.png";
+    std::string convert_file;
+    int w = 640;
+    int h = 360;
+    int s = 128;
+    int ls = 16;
+    int d = 4;
+    float exp = 1.0f;
+    bool w_from_ar = false;
+    bool aovs = false;
+    PT::Pathtracer::Options tracer;
+    Image_Encoder::Options encoder;
+};
+
+// Writes the scene back out as a .c3d, keeping its cameras and timeline
+static std::string convert(const Settings& set) {
+
+    Scene scene(Gui::n_Widget_IDs);
+    Scene::Load_Opts opts;
+    opts.new_scene = true;
+    Scene::File_Extras extras;
+
+    info("Loading scene file...");
+    std::string err = scene.load(opts, set.scene_file, extras);
+    if(!err.empty()) warn("%s", err.c_str());
+
+    Vec2 dim{(float)set.w, (float)set.h};
+    Camera render_cam(dim), anim_cam(dim);
+    if(extras.render_cam) render_cam = extras.render_cam->camera(dim.x / dim.y);
+    if(extras.anim_cam) anim_cam = extras.anim_cam->camera(dim.x / dim.y);
+
+    Camera_Splines anim_splines;
+    for(const auto& [t, p, q, s] : extras.anim_cam_keys) {
+        anim_splines.set(t, p, q, s.x, render_cam.get_ar(), s.y - 1.0f, s.z);
+    }
+
+    info("Writing %s...", set.convert_file.c_str());
+    return scene.write_binary(set.convert_file, render_cam, anim_cam, anim_splines,
+                              extras.frames, (float)extras.fps);
+}
+
+static std::string render(const Settings& set) {
+
+    Scene scene(Gui::n_Widget_IDs);
+    Scene::Load_Opts opts;
+    opts.new_scene = true;
+    opts.editable = false;
+    Scene::File_Extras extras;
+
+    info("Loading scene file...");
+    auto start = std::chrono::steady_clock::now();
+    std::string err = scene.load(opts, set.scene_file, extras);
+    if(!err.empty()) warn("%s", err.c_str());
+    std::chrono::duration<double> load = std::chrono::steady_clock::now() - start;
+    info("Loaded scene in %.3fs", load.count());
+
+    if(!set.env_map_file.empty()) {
+        info("Loading environment map...");
+        err = scene.set_env_map(set.env_map_file);
+        if(!err.empty()) warn("Error loading environment map: %s", err.c_str());
+    }
+
+    int w = set.w, h = set.h;
+    Camera cam(Vec2{(float)w, (float)h});
+    if(extras.render_cam) cam = extras.render_cam->camera((float)w / (float)h);
+    if(set.w_from_ar) w = (int)std::ceil(cam.get_ar() * h);
+
+    info("Render settings:");
+    info("\twidth: %d", w);
+    info("\theight: %d", h);
+    info("\tsamples: %d", set.s);
+    info("\tlight samples: %d", set.ls);
+    info("\tmax depth: %d", set.d);
+    info("\texposure: %f", set.exp);
+    info("\trender threads: %zu", Thread_Pool::default_threads());
+
+    PT::Pathtracer tracer(Vec2{(float)w, (float)h});
+    tracer.set_options(set.tracer);
+    tracer.set_sizes(w, h, set.s, set.ls, set.d);
+
+    info("Rendering scene...");
+    tracer.begin_render(scene, cam);
+    while(tracer.in_progress()) {
+        printf("Progress: %05.2f%%\r", 100.0f * tracer.progress());
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    printf("\n");
+
+    Image_Encoder encoder(set.encoder);
+    if(Image_Encoder::is_stream(set.encoder.format)) {
+        err = encoder.open_stream(set.output_file);
+        if(!err.empty()) return err;
+    }
+    encoder.submit(set.output_file, tracer.get_output().copy(), set.exp);
+
+    if(set.aovs) {
+        std::string path = set.output_file.substr(0, set.output_file.find_last_of('.')) + ".exr";
+        err = tracer.save_aovs(path);
+        if(!err.empty()) return "Failed to write AOVs: " + err;
+    }
+    err = encoder.finish();
+    if(!err.empty()) return err;
+
+    auto [build, render] = tracer.completion_time();
+    info("Built scene in %.2fs, rendered in %.2fs", build, render);
+    return {};
+}
+
+int main(int argc, char** argv) {
+
+    RNG::seed();
+
+    Settings settings;
+    CLI::App args{"Cardinal3D - CS248 renderer"};
+
+    args.add_option("-s,--scene", settings.scene_file, "Scene file to render")->required();
+    args.add_option("--env_map", settings.env_map_file, "Override scene environment map");
+    args.add_option("-o,--output", settings.output_file, "Image file to write");
+    args.add_option("--convert", settings.convert_file,
+                    "Instead of rendering, write the scene to this .c3d file, which loads "
+                    "much faster");
+    args.add_option("--width", settings.w, "Output image width");
+    args.add_option("--height", settings.h, "Output image height");
+    args.add_flag("--use_ar", settings.w_from_ar,
+                  "Compute output image width based on camera AR");
+    args.add_option("--depth", settings.d, "Maximum ray depth");
+    args.add_option("--samples", settings.s, "Pixel samples");
+    args.add_option("--exposure", settings.exp, "Output exposure");
+    args.add_option("--area_samples", settings.ls, "Area light samples");
+    args.add_flag("--path_guiding", settings.tracer.guiding,
+                  "Learn where light comes from and importance sample it");
+    args.add_option("--caustic_photons", settings.tracer.caustic_photons,
+                    "Caustic photons traced per render epoch, 0 for none");
+    args.add_option("--photon_memory", settings.tracer.photon_memory,
+                    "Megabytes of caustic photons kept across render threads");
+    args.add_option("--profile", settings.tracer.profile,
+                    "Write scene build phase timings here, as a Chrome trace");
+    args.add_flag("--denoise", settings.tracer.denoise,
+                  "Filter the output guided by albedo, normals and depth");
+    args.add_flag("--aovs", settings.aovs,
+                  "Also write depth, normal, albedo, ID and lighting passes to a multi-layer "
+                  "EXR next to the output image");
+
+    std::map<std::string, Image_Format> formats = {
+        {"png", Image_Format::png}, {"png_fast", Image_Format::png_fast},
+        {"png_raw", Image_Format::png_raw}, {"exr", Image_Format::exr},
+        {"y4m", Image_Format::y4m}, {"rgb", Image_Format::rgb}};
+    args.add_option("--format", settings.encoder.format,
+                    "Output format; y4m and rgb write to a stream at --output, which may be a "
+                    "pipe")
+        ->transform(CLI::CheckedTransformer(formats, CLI::ignore_case));
+
+    size_t threads = 0;
+    args.add_option("--threads", threads, "Render threads (default: one per core)");
+    bool pin_threads = false;
+    args.add_flag("--pin_threads", pin_threads,
+                  "Pin render threads to cores and give each NUMA node its own copy of the "
+                  "scene; no effect beyond pinning with one node");
+
+    CLI11_PARSE(args, argc, argv);
+
+    Thread_Pool::set_default_threads(threads);
+    Affinity::enable(pin_threads);
+
+    if(!settings.convert_file.empty()) {
+        if(!Scene::is_binary(settings.convert_file)) {
+            warn("Converted scenes must be written to a .c3d file.");
+            return 1;
+        }
+        std::string err = convert(settings);
+        if(!err.empty()) {
+            warn("Error converting scene: %s", err.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    std::string err = render(settings);
+    if(!err.empty()) {
+        warn("Error rendering scene: %s", err.c_str());
+        return 1;
+    }
+    return 0;
+}
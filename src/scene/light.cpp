@@ -45,6 +45,10 @@ HDR_Image Scene_Light::emissive_copy() const {
     return _emissive.copy();
 }
 
+const HDR_Image& Scene_Light::emissive_image() const {
+    return _emissive;
+}
+
 std::string Scene_Light::emissive_load(std::string file) {
     std::string err = _emissive.load_from(file);
     if(err.empty()) {
@@ -36,6 +36,7 @@ public:
     std::string emissive_load(std::string file);
     std::string emissive_loaded() const;
     HDR_Image emissive_copy() const;
+    const HDR_Image& emissive_image() const;
 
     const GL::Tex2D& emissive_texture() const;
     void emissive_clear();
@@ -5,7 +5,6 @@
 #include "renderer.h"
 
 #include "../geometry/util.h"
-#include "../gui/render.h"
 
 Scene_Object::Scene_Object(Scene_ID id, Pose p, GL::Mesh&& m, std::string n)
     : pose(p), _id(id), armature(id), _mesh(std::move(m)) {
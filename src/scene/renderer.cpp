@@ -1,8 +1,6 @@
 
-#include <imgui/imgui.h>
-
 #include "../geometry/util.h"
-#include "../gui/manager.h"
+#include "../gui/widgets.h"
 #include "../lib/mathlib.h"
 
 #include "renderer.h"
@@ -309,16 +307,16 @@ void Renderer::instances(Renderer::MeshOpt opt, GL::Instances& inst) {
 
 void Renderer::halfedge_editor(Renderer::HalfedgeOpt opt) {
 
-    auto [faces, spheres, cylinders, arrows] = opt.editor.shapes();
+    auto [faces, spheres, cylinders, arrows] = opt.shapes;
 
     MeshOpt fopt = MeshOpt();
     fopt.modelview = opt.modelview;
     fopt.color = opt.f_color;
     fopt.per_vert_id = true;
     fopt.sel_color = Gui::Color::outline;
-    fopt.sel_id = opt.editor.select_id();
+    fopt.sel_id = opt.sel_id;
     fopt.hov_color = Gui::Color::hover;
-    fopt.hov_id = opt.editor.hover_id();
+    fopt.hov_id = opt.hov_id;
     Renderer::mesh(faces, fopt);
 
     inst_shader.bind();
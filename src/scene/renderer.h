@@ -1,16 +1,13 @@
 
 #pragma once
 
+#include <tuple>
 #include <variant>
 
 #include "../lib/bbox.h"
 #include "../platform/gl.h"
 #include "scene.h"
 
-namespace Gui {
-class Model;
-}
-
 // Singleton
 class Renderer {
 public:
@@ -41,9 +38,12 @@ public:
     };
 
     struct HalfedgeOpt {
-        HalfedgeOpt(Gui::Model& e) : editor(e) {
+        HalfedgeOpt(std::tuple<GL::Mesh&, GL::Instances&, GL::Instances&, GL::Instances&> shapes)
+            : shapes(shapes) {
         }
-        Gui::Model& editor;
+        // Faces, vertices, edges and halfedges
+        std::tuple<GL::Mesh&, GL::Instances&, GL::Instances&, GL::Instances&> shapes;
+        unsigned int sel_id = 0, hov_id = 0;
         Mat4 modelview;
         Vec3 f_color = Vec3{1.0f};
         Vec3 v_color = Vec3{1.0f};
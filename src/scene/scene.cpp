@@ -5,13 +5,11 @@
 #include <assimp/scene.h>
 #include <sstream>
 
-#include "../gui/manager.h"
-#include "../gui/render.h"
 #include "../lib/log.h"
+#include "../lib/mathlib.h"
 
 #include "renderer.h"
 #include "scene.h"
-#include "undo.h"
 
 namespace std {
 template<typename T1, typename T2> struct hash<pair<T1, T2>> {
@@ -277,11 +275,25 @@ Scene_Particles& Scene::get_particles(Scene_ID id) {
     return entry->second.get<Scene_Particles>();
 }
 
-void Scene::clear(Undo& undo) {
+void Scene::clear() {
     next_id = first_id;
     objs.clear();
     erased.clear();
-    undo.reset();
+}
+
+Camera Scene::File_Camera::camera(float default_ar) const {
+
+    float aspect = ar == 0.0f ? default_ar : ar;
+    float fov = 2.0f * std::atan((1.0f / aspect) * std::tan(hfov / 2.0f));
+    fov = Degrees(fov);
+
+    Camera c(Vec2{aspect, 1.0f});
+    c.look_at(center, pos);
+    c.set_ar(aspect);
+    c.set_fov(fov);
+    c.set_ap(aperture);
+    c.set_dist(focal_dist);
+    return c;
 }
 
 //////////////////////////////////////////////////////////////
@@ -699,13 +711,9 @@ static unsigned int load_flags(Scene::Load_Opts opt) {
     return flags;
 }
 
-std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui, std::string file) {
+std::string Scene::load(Scene::Load_Opts loader, std::string file, File_Extras& extras) {
 
-    if(loader.new_scene) {
-        clear(undo);
-        gui.get_animate().clear();
-        gui.get_rig().clear();
-    }
+    if(is_binary(file)) return load_binary(loader, file, extras);
 
     Assimp::Importer importer;
     const aiScene* scene = importer.ReadFile(file.c_str(), load_flags(loader));
@@ -733,13 +741,15 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
             Vec3 pos = cam_transform * aiVec(aiCam.mPosition);
             Vec3 center = cam_transform * aiVec(aiCam.mLookAt);
 
+            // The aperture and focal distance are kept in the clip planes
+            File_Camera cam{pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
+                            aiCam.mClipPlaneNear, aiCam.mClipPlaneFar};
+
             std::string name(aiCam.mName.C_Str());
             if(name.find(ANIM_CAM_NAME) != std::string::npos) {
-                gui.get_animate().load_cam(pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
-                                           aiCam.mClipPlaneNear, aiCam.mClipPlaneFar);
+                extras.anim_cam = cam;
             } else {
-                gui.get_render().load_cam(pos, center, aiCam.mAspect, aiCam.mHorizontalFOV,
-                                          aiCam.mClipPlaneNear, aiCam.mClipPlaneFar);
+                extras.render_cam = cam;
             }
         };
 
@@ -883,9 +893,6 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
         return entry->second;
     };
 
-    Gui::Anim_Camera& cam = gui.get_animate().camera();
-    float ar = gui.get_render().get_cam().get_ar();
-
     // Load animation data
     for(unsigned int i = 0; i < scene->mNumAnimations; i++) {
 
@@ -896,8 +903,8 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
             loaded = false;
 
             // Load animated camera
-            load_anim(node, ANIM_CAM_NODE, [&cam, ar](float t, Vec3 p, Quat q, Vec3 s) {
-                cam.splines.set(t, p, q, s.x, ar, s.y - 1.0f, s.z);
+            load_anim(node, ANIM_CAM_NODE, [&extras](float t, Vec3 p, Quat q, Vec3 s) {
+                extras.anim_cam_keys.push_back({t, p, q, s});
             });
 
             // Load animated bones
@@ -969,11 +976,10 @@ std::string Scene::load(Scene::Load_Opts loader, Undo& undo, Gui::Manager& gui,
         }
 
         if(anim->mDuration > 0.0f) {
-            gui.get_animate().set((int)std::ceil(anim->mDuration),
-                                  (int)std::round(anim->mTicksPerSecond));
+            extras.frames = (int)std::ceil(anim->mDuration);
+            extras.fps = (int)std::round(anim->mTicksPerSecond);
         }
     }
-    gui.get_animate().refresh(*this);
 
     std::stringstream stream;
     if(errors.size()) {
@@ -1209,7 +1215,7 @@ static void add_fake_mesh(aiScene* scene) {
     scene->mMaterials[0] = new aiMaterial();
 }
 
-Scene::Stats Scene::get_stats(const Gui::Animate& animation) {
+Scene::Stats Scene::get_stats(const Camera_Splines& anim_splines) {
 
     Stats s;
     for_items([&](Scene_Item& item) {
@@ -1272,7 +1278,7 @@ Scene::Stats Scene::get_stats(const Gui::Animate& animation) {
         }
     });
 
-    if(animation.camera().splines.any()) {
+    if(anim_splines.any()) {
         s.anims++;
     }
 
@@ -1280,11 +1286,11 @@ Scene::Stats Scene::get_stats(const Gui::Animate& animation) {
     return s;
 }
 
-std::string Scene::write(std::string file, const Camera& render_cam,
-                         const Gui::Animate& animation) {
+std::string Scene::write(std::string file, const Camera& render_cam, const Camera& anim_cam,
+                         const Camera_Splines& anim_splines, int frames, float fps) {
 
     size_t mesh_idx = 0, light_idx = 0, node_idx = 0, anim_idx = 0;
-    Stats N = get_stats(animation);
+    Stats N = get_stats(anim_splines);
 
     bool fake_mesh = N.meshes == 0;
     if(fake_mesh) {
@@ -1321,8 +1327,8 @@ std::string Scene::write(std::string file, const Camera& render_cam,
 
         aiAnimation* ai_anim = scene.mAnimations[0];
         ai_anim->mName = aiString(ANIM_NAME);
-        ai_anim->mDuration = (double)animation.n_frames();
-        ai_anim->mTicksPerSecond = (double)animation.fps();
+        ai_anim->mDuration = (double)frames;
+        ai_anim->mTicksPerSecond = (double)fps;
         ai_anim->mNumChannels = N.anims;
         ai_anim->mChannels = new aiNodeAnim*[N.anims];
     }
@@ -1334,7 +1340,7 @@ std::string Scene::write(std::string file, const Camera& render_cam,
         scene.mCameras[0] = ar_cam;
         scene.mCameras[1] = aa_cam;
         write_cam(ar_cam, render_cam, RENDER_CAM_NODE);
-        write_cam(aa_cam, animation.current_camera(), ANIM_CAM_NODE);
+        write_cam(aa_cam, anim_cam, ANIM_CAM_NODE);
         scene.mNumCameras = 2;
 
         size_t r_cam_idx = N.nodes - 1;
@@ -1346,7 +1352,7 @@ std::string Scene::write(std::string file, const Camera& render_cam,
         scene.mRootNode->mChildren[r_cam_idx]->mName = aiString(RENDER_CAM_NODE);
         scene.mRootNode->mChildren[r_cam_idx]->mTransformation = matMat(view);
 
-        view = animation.current_camera().get_view().inverse();
+        view = anim_cam.get_view().inverse();
         scene.mRootNode->mChildren[a_cam_idx] = new aiNode();
         scene.mRootNode->mChildren[a_cam_idx]->mNumMeshes = 0;
         scene.mRootNode->mChildren[a_cam_idx]->mName = aiString(ANIM_CAM_NODE);
@@ -1620,10 +1626,9 @@ std::string Scene::write(std::string file, const Camera& render_cam,
             }
         };
 
-        const auto& anim_cam = animation.camera();
-        write_anim(ANIM_CAM_NODE, anim_cam.splines,
-                   [&anim_cam](float t) -> std::tuple<Vec3, Quat, Vec3> {
-                       auto [p, r, fov, ar, ap, d] = anim_cam.splines.at(t);
+        write_anim(ANIM_CAM_NODE, anim_splines,
+                   [&anim_splines](float t) -> std::tuple<Vec3, Quat, Vec3> {
+                       auto [p, r, fov, ar, ap, d] = anim_splines.at(t);
                        (void)ar;
                        return {p, r, Vec3{fov, ap + 1.0f, d}};
                    });
@@ -4,8 +4,10 @@
 #include <functional>
 #include <map>
 #include <optional>
+#include <tuple>
 
 #include "../geometry/halfedge.h"
+#include "../geometry/spline.h"
 #include "../lib/mathlib.h"
 #include "../platform/gl.h"
 #include "../util/camera.h"
@@ -14,11 +16,33 @@
 #include "object.h"
 #include "particles.h"
 
-class Undo;
 class Halfedge_Editor;
+
+// Position, rotation, fov, aspect ratio, aperture, focal distance
+using Camera_Splines = Splines<Vec3, Quat, float, float, float, float>;
+
 namespace Gui {
-class Manager;
-class Animate;
+
+// The editor's widgets take the lowest IDs, so scene items are numbered from
+// n_Widget_IDs
+enum class Widget_IDs : Scene_ID {
+    none,
+    x_mov,
+    y_mov,
+    z_mov,
+    xy_mov,
+    yz_mov,
+    xz_mov,
+    x_rot,
+    y_rot,
+    z_rot,
+    x_scl,
+    y_scl,
+    z_scl,
+    count
+};
+static const int n_Widget_IDs = (int)Widget_IDs::count;
+
 } // namespace Gui
 
 class Scene_Item {
@@ -77,11 +101,39 @@ public:
         bool gen_smooth_normals = false;
         bool fix_infacing_normals = false;
         bool debone = false;
+        // Only .c3d files can skip building half-edge meshes: without this,
+        // their meshes load straight into render buffers but can't be edited
+        bool editable = true;
     };
 
-    std::string write(std::string file, const Camera& cam, const Gui::Animate& animation);
-    std::string load(Load_Opts opt, Undo& undo, Gui::Manager& gui, std::string file);
-    void clear(Undo& undo);
+    // A camera as stored in a scene file
+    struct File_Camera {
+        Vec3 pos, center;
+        float ar = 0.0f, hfov = 0.0f, aperture = 0.0f, focal_dist = 0.0f;
+        Camera camera(float default_ar) const; // used if the file has no aspect ratio
+    };
+
+    // What a file holds besides the scene itself. Cameras only come with new
+    // scenes; animated camera keys are (time, position, rotation,
+    // (fov, aperture + 1, focal distance)).
+    struct File_Extras {
+        std::optional<File_Camera> render_cam, anim_cam;
+        std::vector<std::tuple<float, Vec3, Quat, Vec3>> anim_cam_keys;
+        int frames = 0, fps = 0; // of the timeline, if it's animated
+    };
+
+    // Adds what's in the file; the scene is only cleared by the caller
+    std::string load(Load_Opts opt, std::string file, File_Extras& extras);
+    std::string write(std::string file, const Camera& render_cam, const Camera& anim_cam,
+                      const Camera_Splines& anim_splines, int frames, float fps);
+
+    // Cardinal3D's own binary format, which load() reads without assimp: meshes
+    // are stored as the buffers they're drawn from, and the file is mapped
+    // rather than parsed, so loading is about as fast as reading the file.
+    std::string write_binary(std::string file, const Camera& render_cam, const Camera& anim_cam,
+                             const Camera_Splines& anim_splines, int frames, float fps);
+    static bool is_binary(const std::string& file); // by its .c3d extension
+    void clear();
 
     bool empty();
     size_t size();
@@ -119,7 +171,8 @@ private:
         unsigned int objs = 0;
         unsigned int nodes = 0;
     };
-    Stats get_stats(const Gui::Animate& animation);
+    Stats get_stats(const Camera_Splines& anim_splines);
+    std::string load_binary(Load_Opts opt, std::string file, File_Extras& extras);
 
     std::map<Scene_ID, Scene_Item> objs;
     std::map<Scene_ID, Scene_Item> erased;
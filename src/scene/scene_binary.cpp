@@ -0,0 +1,597 @@
+
+// The .c3d scene format. Everything is written in native byte order, one
+// field after another with no padding:
+//
+//   "C3DSCENE", version
+//   render camera, animation camera, animation camera keys, frames, fps
+//   item count, then per item its kind and:
+//     object:    name, pose, pose keys, smooth normals, wireframe, shape type,
+//                sphere radius, material, material keys, mesh, skeleton
+//     light:     name, options, emissive map path, pose, pose keys, light keys
+//     particles: name, options, pose, pose keys, particle keys, vertices, indices
+//
+// Arrays and strings are a 64-bit count followed by their elements. Meshes
+// are the GL::Mesh vertex and index arrays, copied out and back in whole;
+// editable meshes also keep their polygons, so they can be rebuilt as
+// half-edge meshes. Animation keys are a count, then per key its time and the
+// value of each spline there.
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+#include <unordered_map>
+
+#include "../util/mapped_file.h"
+#include "scene.h"
+
+static const char magic[8] = {'C', '3', 'D', 'S', 'C', 'E', 'N', 'E'};
+static const unsigned int version = 1;
+
+enum class Item_Kind : unsigned char { object, light, particles, count };
+
+namespace {
+
+class Writer {
+public:
+    explicit Writer(std::ostream& out) : out(out) {
+    }
+
+    template<typename T> void put(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+    template<typename T> void put(const std::vector<T>& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        put((unsigned long long)v.size());
+        out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+    }
+    void put(const std::string& s) {
+        put((unsigned long long)s.size());
+        out.write(s.data(), s.size());
+    }
+
+    template<typename T> void put(const Spline<T>& spline) {
+        std::set<float> keys = spline.keys();
+        put((unsigned long long)keys.size());
+        for(float t : keys) {
+            put(t);
+            put(spline.at(t));
+        }
+    }
+    template<typename... Ts> void put(const Splines<Ts...>& splines) {
+        std::set<float> keys = splines.keys();
+        put((unsigned long long)keys.size());
+        for(float t : keys) {
+            put(t);
+            std::apply([this](const auto&... v) { (put(v), ...); }, splines.at(t));
+        }
+    }
+
+private:
+    std::ostream& out;
+};
+
+// Reads the same back from memory. Past the end, reads give zeroes and ok()
+// turns false.
+class Reader {
+public:
+    Reader(const unsigned char* data, size_t size) : at(data), end(data + size) {
+    }
+
+    bool ok() const {
+        return !failed;
+    }
+    void fail() {
+        failed = true;
+        at = end;
+    }
+    size_t left() const {
+        return (size_t)(end - at);
+    }
+
+    // Bools must be 0 or 1 and enums below their count, else reading fails
+    template<typename T> T get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if constexpr(std::is_same_v<T, bool>) {
+            unsigned char b = get<unsigned char>();
+            if(b > 1) fail();
+            return b == 1;
+        } else if constexpr(std::is_enum_v<T>) {
+            long long e = (long long)get<std::underlying_type_t<T>>();
+            if(e < 0 || e >= (long long)T::count) {
+                fail();
+                return T{};
+            }
+            return (T)e;
+        } else {
+            T v{};
+            read(&v, sizeof(T));
+            return v;
+        }
+    }
+    template<typename T> void get(std::vector<T>& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        unsigned long long n = get<unsigned long long>();
+        if(n > (unsigned long long)(end - at) / sizeof(T)) {
+            fail();
+            return;
+        }
+        v.resize((size_t)n);
+        read(v.data(), v.size() * sizeof(T));
+    }
+    template<typename T> void skip_vector() {
+        unsigned long long n = get<unsigned long long>();
+        if(n > (unsigned long long)(end - at) / sizeof(T)) {
+            fail();
+            return;
+        }
+        at += n * sizeof(T);
+    }
+    std::string string() {
+        unsigned long long n = get<unsigned long long>();
+        if(n > (unsigned long long)(end - at)) {
+            fail();
+            return {};
+        }
+        std::string s(reinterpret_cast<const char*>(at), (size_t)n);
+        at += n;
+        return s;
+    }
+
+    template<typename T> void get(Spline<T>& spline) {
+        unsigned long long n = get<unsigned long long>();
+        for(unsigned long long i = 0; i < n && ok(); i++) {
+            float t = get<float>();
+            spline.set(t, get<T>());
+        }
+    }
+    template<typename... Ts> void get(Splines<Ts...>& splines) {
+        unsigned long long n = get<unsigned long long>();
+        for(unsigned long long i = 0; i < n && ok(); i++) {
+            float t = get<float>();
+            std::tuple<Ts...> v{get<Ts>()...};
+            std::apply([&](const Ts&... args) { splines.set(t, args...); }, v);
+        }
+    }
+
+private:
+    void read(void* to, size_t bytes) {
+        if(bytes > (size_t)(end - at)) {
+            fail();
+            return;
+        }
+        std::memcpy(to, at, bytes);
+        at += bytes;
+    }
+
+    const unsigned char* at;
+    const unsigned char* end;
+    bool failed = false;
+};
+
+} // namespace
+
+static void put_camera(Writer& out, const Camera& cam) {
+    out.put(cam.pos());
+    out.put(cam.center());
+    out.put(cam.get_ar());
+    out.put(Radians(cam.get_h_fov()));
+    out.put(cam.get_ap());
+    out.put(cam.get_dist());
+}
+
+static Scene::File_Camera get_camera(Reader& in) {
+    Scene::File_Camera cam;
+    cam.pos = in.get<Vec3>();
+    cam.center = in.get<Vec3>();
+    cam.ar = in.get<float>();
+    cam.hfov = in.get<float>();
+    cam.aperture = in.get<float>();
+    cam.focal_dist = in.get<float>();
+    return cam;
+}
+
+static void put_mesh(Writer& out, const GL::Mesh& mesh) {
+    out.put(mesh.verts());
+    out.put(mesh.indices());
+}
+
+static GL::Mesh get_mesh(Reader& in) {
+    std::vector<GL::Mesh::Vert> verts;
+    std::vector<GL::Mesh::Index> idxs;
+    in.get(verts);
+    in.get(idxs);
+    for(GL::Mesh::Index i : idxs) {
+        if(i >= verts.size()) {
+            in.fail();
+            return GL::Mesh();
+        }
+    }
+    return GL::Mesh(std::move(verts), std::move(idxs));
+}
+
+// Vertex positions, then each face's degree and its vertices in order
+static void put_polygons(Writer& out, const Halfedge_Mesh& mesh) {
+
+    std::vector<Vec3> verts;
+    std::unordered_map<unsigned int, unsigned int> id_to_idx;
+    for(auto v = mesh.vertices_begin(); v != mesh.vertices_end(); v++) {
+        id_to_idx[v->id()] = (unsigned int)verts.size();
+        verts.push_back(v->pos);
+    }
+
+    std::vector<unsigned int> degrees, corners;
+    for(auto f = mesh.faces_begin(); f != mesh.faces_end(); f++) {
+        if(f->is_boundary()) continue;
+        degrees.push_back(f->degree());
+        auto h = f->halfedge();
+        do {
+            corners.push_back(id_to_idx[h->vertex()->id()]);
+            h = h->next();
+        } while(h != f->halfedge());
+    }
+
+    out.put(verts);
+    out.put(degrees);
+    out.put(corners);
+}
+
+static void skip_polygons(Reader& in) {
+    in.skip_vector<Vec3>();
+    in.skip_vector<unsigned int>();
+    in.skip_vector<unsigned int>();
+}
+
+static std::string get_polygons(Reader& in, Halfedge_Mesh& mesh) {
+
+    std::vector<Vec3> verts;
+    std::vector<unsigned int> degrees, corners;
+    in.get(verts);
+    in.get(degrees);
+    in.get(corners);
+    if(!in.ok()) return {};
+    for(unsigned int i : corners) {
+        if(i >= verts.size()) return "Corrupt polygons.";
+    }
+
+    std::vector<std::vector<Halfedge_Mesh::Index>> polys(degrees.size());
+    size_t c = 0;
+    for(size_t f = 0; f < degrees.size(); f++) {
+        if(degrees[f] > corners.size() - c) return "Corrupt polygons.";
+        polys[f].assign(corners.begin() + c, corners.begin() + c + degrees[f]);
+        c += degrees[f];
+    }
+    return mesh.from_poly(polys, verts);
+}
+
+static void put_material(Writer& out, const Material& mat) {
+    out.put(mat.opt.type);
+    out.put(mat.opt.albedo);
+    out.put(mat.opt.reflectance);
+    out.put(mat.opt.transmittance);
+    out.put(mat.opt.emissive);
+    out.put(mat.opt.intensity);
+    out.put(mat.opt.ior);
+    out.put(mat.anim.splines);
+}
+
+static void get_material(Reader& in, Material& mat) {
+    mat.opt.type = in.get<Material_Type>();
+    mat.opt.albedo = in.get<Spectrum>();
+    mat.opt.reflectance = in.get<Spectrum>();
+    mat.opt.transmittance = in.get<Spectrum>();
+    mat.opt.emissive = in.get<Spectrum>();
+    mat.opt.intensity = in.get<float>();
+    mat.opt.ior = in.get<float>();
+    in.get(mat.anim.splines);
+}
+
+bool Scene::is_binary(const std::string& file) {
+    static const std::string ext = ".c3d";
+    return file.size() >= ext.size() &&
+           file.compare(file.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+std::string Scene::write_binary(std::string file, const Camera& render_cam,
+                                const Camera& anim_cam, const Camera_Splines& anim_splines,
+                                int frames, float fps) {
+
+    std::string tmp = file + ".tmp";
+    std::ofstream stream(tmp, std::ios::binary | std::ios::trunc);
+    if(!stream.is_open()) return "Failed to open " + tmp + " for writing.";
+    Writer out(stream);
+
+    stream.write(magic, sizeof(magic));
+    out.put(version);
+
+    put_camera(out, render_cam);
+    put_camera(out, anim_cam);
+    out.put(anim_splines);
+    out.put(frames);
+    out.put((int)std::round(fps));
+
+    out.put((unsigned long long)objs.size());
+    for(auto& [id, item] : objs) {
+
+        if(item.is<Scene_Object>()) {
+
+            Scene_Object& obj = item.get<Scene_Object>();
+            out.put(Item_Kind::object);
+            out.put(std::string(obj.opt.name));
+            out.put(obj.pose);
+            out.put(obj.anim.splines);
+            out.put(obj.opt.smooth_normals);
+            out.put(obj.opt.wireframe);
+            out.put(obj.opt.shape_type);
+            float radius = 0.0f;
+            if(obj.opt.shape_type == PT::Shape_Type::sphere) {
+                radius = obj.opt.shape.get<PT::Sphere>().radius;
+            }
+            out.put(radius);
+            put_material(out, obj.material);
+
+            if(!obj.is_shape()) {
+                put_mesh(out, obj.mesh());
+                out.put(obj.is_editable());
+                if(obj.is_editable()) {
+                    out.put(obj.get_mesh().flipped());
+                    put_polygons(out, obj.get_mesh());
+                }
+            }
+
+            // Joints parents first, so each can be added to the one before
+            Skeleton& skel = obj.armature;
+            std::vector<Joint*> joints;
+            std::unordered_map<Joint*, long long> joint_idx;
+            std::function<void(Joint*)> add = [&](Joint* j) {
+                joint_idx[j] = (long long)joints.size();
+                joints.push_back(j);
+                for(Joint* c : j->children) add(c);
+            };
+            for(Joint* root : skel.roots) add(root);
+
+            out.put(skel.base_pos);
+            out.put((unsigned long long)joints.size());
+            for(Joint* j : joints) {
+                out.put(j->parent ? joint_idx[j->parent] : -1ll);
+                out.put(j->extent);
+                out.put(j->pose);
+                out.put(j->radius);
+                out.put(j->anim);
+            }
+            std::vector<Skeleton::IK_Handle*> handles;
+            for(Skeleton::IK_Handle* h : skel.handles) {
+                if(joint_idx.count(h->joint)) handles.push_back(h);
+            }
+            out.put((unsigned long long)handles.size());
+            for(Skeleton::IK_Handle* h : handles) {
+                out.put(joint_idx[h->joint]);
+                out.put(h->target);
+                out.put(h->enabled);
+                out.put(h->anim);
+            }
+
+        } else if(item.is<Scene_Light>()) {
+
+            const Scene_Light& light = item.get<Scene_Light>();
+            out.put(Item_Kind::light);
+            out.put(std::string(light.opt.name));
+            out.put(light.opt.type);
+            out.put(light.opt.spectrum);
+            out.put(light.opt.intensity);
+            out.put(light.opt.angle_bounds);
+            out.put(light.opt.size);
+            out.put(light.opt.has_emissive_map ? light.emissive_loaded() : std::string());
+            out.put(light.pose);
+            out.put(light.anim.splines);
+            out.put(light.lanim.splines);
+
+        } else if(item.is<Scene_Particles>()) {
+
+            const Scene_Particles& particles = item.get<Scene_Particles>();
+            out.put(Item_Kind::particles);
+            out.put(std::string(particles.opt.name));
+            out.put(particles.opt.color);
+            out.put(particles.opt.velocity);
+            out.put(particles.opt.angle);
+            out.put(particles.opt.scale);
+            out.put(particles.opt.lifetime);
+            out.put(particles.opt.pps);
+            out.put(particles.opt.enabled);
+            out.put(particles.pose);
+            out.put(particles.anim.splines);
+            out.put(particles.panim.splines);
+            put_mesh(out, particles.mesh());
+        }
+    }
+
+    stream.close();
+    if(!stream.good()) return "Failed to write " + tmp + ".";
+
+#ifdef _WIN32
+    std::remove(file.c_str()); // rename() won't replace a file here
+#endif
+    if(std::rename(tmp.c_str(), file.c_str())) return "Failed to move " + tmp + " to " + file + ".";
+    return {};
+}
+
+std::string Scene::load_binary(Load_Opts loader, std::string file, File_Extras& extras) {
+
+    Mapped_File mapped;
+    std::string err = mapped.open(file);
+    if(!err.empty()) return err;
+
+    if(mapped.size() < sizeof(magic) ||
+       std::memcmp(mapped.data(), magic, sizeof(magic)) != 0) {
+        return file + " is not a .c3d scene.";
+    }
+    Reader in(mapped.data() + sizeof(magic), mapped.size() - sizeof(magic));
+    unsigned int file_version = in.get<unsigned int>();
+    if(file_version != version) {
+        return file + " is .c3d version " + std::to_string(file_version) + ", but only version " +
+               std::to_string(version) + " can be read.";
+    }
+
+    File_Camera render_cam = get_camera(in), anim_cam = get_camera(in);
+    Camera_Splines anim_splines;
+    in.get(anim_splines);
+    int frames = in.get<int>(), fps = in.get<int>();
+
+    if(loader.new_scene) {
+        extras.render_cam = render_cam;
+        extras.anim_cam = anim_cam;
+        for(float t : anim_splines.keys()) {
+            auto [p, r, fov, ar, ap, d] = anim_splines.at(t);
+            (void)ar;
+            extras.anim_cam_keys.push_back({t, p, r, Vec3{fov, ap + 1.0f, d}});
+        }
+    }
+    if(frames > 0) {
+        extras.frames = frames;
+        extras.fps = fps;
+    }
+
+    std::vector<std::string> errors;
+    unsigned long long n_items = in.get<unsigned long long>();
+    for(unsigned long long i = 0; i < n_items && in.ok(); i++) {
+
+        Item_Kind kind = in.get<Item_Kind>();
+        std::string name = in.string();
+        if(!in.ok()) break;
+
+        if(kind == Item_Kind::object) {
+
+            Pose pose = in.get<Pose>();
+            Anim_Pose anim;
+            in.get(anim.splines);
+            bool smooth = in.get<bool>(), wireframe = in.get<bool>();
+            PT::Shape_Type shape = in.get<PT::Shape_Type>();
+            float radius = in.get<float>();
+            Material mat;
+            get_material(in, mat);
+
+            Scene_Object obj;
+            if(shape != PT::Shape_Type::none) {
+                obj = Scene_Object(reserve_id(), pose, GL::Mesh(), name);
+                obj.opt.shape_type = shape;
+                obj.opt.shape = PT::Shape(PT::Sphere(radius));
+            } else {
+                GL::Mesh mesh = get_mesh(in);
+                bool editable = in.get<bool>();
+                Halfedge_Mesh hemesh;
+                std::string poly_err;
+                if(editable) {
+                    bool flipped = in.get<bool>();
+                    if(loader.editable) {
+                        poly_err = get_polygons(in, hemesh);
+                        if(flipped) hemesh.flip();
+                    } else {
+                        skip_polygons(in);
+                    }
+                }
+                if(!in.ok()) break;
+                if(!poly_err.empty()) errors.push_back(poly_err);
+
+                if(editable && loader.editable && poly_err.empty()) {
+                    obj = Scene_Object(reserve_id(), pose, std::move(hemesh), name);
+                    obj.opt.smooth_normals = smooth;
+                    obj.set_mesh_dirty();
+                } else {
+                    // Kept so writing the scene back out keeps it too
+                    obj = Scene_Object(reserve_id(), pose, std::move(mesh), name);
+                    obj.opt.smooth_normals = smooth;
+                }
+            }
+            obj.opt.wireframe = wireframe;
+            obj.anim = std::move(anim);
+            obj.material = std::move(mat);
+
+            // Joint IDs follow the object's, so they're added once it exists
+            Skeleton& skel = obj.armature;
+            skel.base() = in.get<Vec3>();
+            unsigned long long n_joints = in.get<unsigned long long>();
+            if(n_joints > in.left()) in.fail();
+            std::vector<Joint*> joints(in.ok() ? (size_t)n_joints : 0);
+            for(size_t j = 0; j < joints.size() && in.ok(); j++) {
+                long long parent = in.get<long long>();
+                Vec3 extent = in.get<Vec3>();
+                if(parent >= (long long)j) {
+                    in.fail();
+                    break;
+                }
+                joints[j] = parent < 0 ? skel.add_root(extent)
+                                       : skel.add_child(joints[(size_t)parent], extent);
+                joints[j]->pose = in.get<Vec3>();
+                joints[j]->radius = in.get<float>();
+                in.get(joints[j]->anim);
+            }
+            unsigned long long n_handles = in.get<unsigned long long>();
+            for(unsigned long long h = 0; h < n_handles && in.ok(); h++) {
+                unsigned long long joint = in.get<unsigned long long>();
+                Vec3 target = in.get<Vec3>();
+                if(joint >= joints.size() || !joints[(size_t)joint]) {
+                    in.fail();
+                    break;
+                }
+                Skeleton::IK_Handle* handle = skel.add_handle(target, joints[(size_t)joint]);
+                handle->enabled = in.get<bool>();
+                in.get(handle->anim);
+            }
+            if(!in.ok()) break;
+
+            obj.set_skel_dirty();
+            add(std::move(obj));
+
+        } else if(kind == Item_Kind::light) {
+
+            Scene_Light::Options opt;
+            opt.type = in.get<Light_Type>();
+            opt.spectrum = in.get<Spectrum>();
+            opt.intensity = in.get<float>();
+            opt.angle_bounds = in.get<Vec2>();
+            opt.size = in.get<Vec2>();
+            std::string emissive_map = in.string();
+            opt.has_emissive_map = !emissive_map.empty();
+            snprintf(opt.name, Scene_Light::max_name_len, "%s", name.c_str());
+
+            Scene_Light light(opt.type, reserve_id(), in.get<Pose>(), name);
+            light.opt = opt;
+            in.get(light.anim.splines);
+            in.get(light.lanim.splines);
+            if(!in.ok()) break;
+
+            if(opt.has_emissive_map) {
+                err = light.emissive_load(emissive_map);
+                if(!err.empty()) errors.push_back(err);
+            }
+            if(!light.is_env() || !has_env_light()) add(std::move(light));
+
+        } else if(kind == Item_Kind::particles) {
+
+            Scene_Particles::Options opt;
+            snprintf(opt.name, Scene_Particles::max_name_len, "%s", name.c_str());
+            opt.color = in.get<Spectrum>();
+            opt.velocity = in.get<float>();
+            opt.angle = in.get<float>();
+            opt.scale = in.get<float>();
+            opt.lifetime = in.get<float>();
+            opt.pps = in.get<float>();
+            opt.enabled = in.get<bool>();
+
+            Scene_Particles particles(reserve_id(), in.get<Pose>(), name);
+            particles.opt = opt;
+            in.get(particles.anim.splines);
+            in.get(particles.panim.splines);
+            GL::Mesh mesh = get_mesh(in);
+            if(!in.ok()) break;
+            particles.take_mesh(std::move(mesh));
+            add(std::move(particles));
+        }
+    }
+    if(!in.ok()) return file + " is truncated or corrupt.";
+
+    std::stringstream stream;
+    for(const std::string& e : errors) stream << e << std::endl;
+    return stream.str();
+}
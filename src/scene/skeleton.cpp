@@ -1,6 +1,6 @@
 
 #include "skeleton.h"
-#include "../gui/manager.h"
+#include "../gui/widgets.h"
 #include "renderer.h"
 
 Joint::Joint(unsigned int id) : _id(id) {
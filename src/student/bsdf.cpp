@@ -58,6 +58,10 @@ Spectrum BSDF_Lambertian::evaluate(Vec3 out_dir, Vec3 in_dir) const {
     return albedo * (1.0f / PI_F);
 }
 
+float BSDF_Lambertian::pdf(Vec3 out_dir, Vec3 in_dir) const {
+    return in_dir.y > 0.0f ? in_dir.y / PI_F : 0.0f;
+}
+
 BSDF_Sample BSDF_Mirror::sample(Vec3 out_dir) const {
 
     // TODO (PathTracer): Task 6
@@ -79,6 +83,10 @@ Spectrum BSDF_Mirror::evaluate(Vec3 out_dir, Vec3 in_dir) const {
     return {};
 }
 
+float BSDF_Mirror::pdf(Vec3 out_dir, Vec3 in_dir) const {
+    return 0.0f;
+}
+
 BSDF_Sample BSDF_Glass::sample(Vec3 out_dir) const {
 
     // TODO (PathTracer): Task 6
@@ -121,6 +129,10 @@ Spectrum BSDF_Glass::evaluate(Vec3 out_dir, Vec3 in_dir) const {
     return {};
 }
 
+float BSDF_Glass::pdf(Vec3 out_dir, Vec3 in_dir) const {
+    return 0.0f;
+}
+
 BSDF_Sample BSDF_Diffuse::sample(Vec3 out_dir) const {
     BSDF_Sample ret;
     ret.direction = sampler.sample(ret.pdf);
@@ -134,6 +146,10 @@ Spectrum BSDF_Diffuse::evaluate(Vec3 out_dir, Vec3 in_dir) const {
     return {};
 }
 
+float BSDF_Diffuse::pdf(Vec3 out_dir, Vec3 in_dir) const {
+    return in_dir.y > 0.0f ? 1.0f / (2.0f * PI_F) : 0.0f;
+}
+
 BSDF_Sample BSDF_Refract::sample(Vec3 out_dir) const {
 
     // TODO (PathTracer): Task 6
@@ -155,4 +171,8 @@ Spectrum BSDF_Refract::evaluate(Vec3 out_dir, Vec3 in_dir) const {
     return {};
 }
 
+float BSDF_Refract::pdf(Vec3 out_dir, Vec3 in_dir) const {
+    return 0.0f;
+}
+
 } // namespace PT
@@ -254,6 +254,7 @@ size_t BVH<Primitive>::new_node(BBox box, size_t start, size_t size, size_t l, s
 
 template<typename Primitive>
 BBox BVH<Primitive>::bbox() const {
+    if(nodes.empty()) return {};
     return nodes[root_idx].bbox;
 }
 
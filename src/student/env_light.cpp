@@ -3,22 +3,53 @@
 #include "debug.h"
 
 #include <limits>
+#include <list>
+#include <mutex>
+#include <tuple>
 
 namespace PT {
 
+Env_Map::Data::Data(const HDR_Image& image) : sampler(image) {
+
+    std::tie(w, h) = image.dimension();
+    texels.resize((w + 1) * h);
+    for(size_t j = 0; j < h; j++) {
+        for(size_t i = 0; i < w; i++) {
+            texels[j * (w + 1) + i] = image.at(i, j);
+        }
+        texels[j * (w + 1) + w] = image.at(0, j);
+    }
+}
+
+std::shared_ptr<const Env_Map::Data> Env_Map::Data::get(const HDR_Image& image) {
+
+    // Big maps take hundreds of MB, so only keep the most recently used few
+    static const size_t max_cached = 2;
+    static std::mutex cache_mut;
+    static std::list<std::pair<size_t, std::shared_ptr<const Data>>> cache;
+
+    std::lock_guard<std::mutex> lock(cache_mut);
+
+    for(auto entry = cache.begin(); entry != cache.end(); entry++) {
+        if(entry->first == image.identity()) {
+            cache.splice(cache.begin(), cache, entry);
+            return cache.front().second;
+        }
+    }
+
+    cache.emplace_front(image.identity(), std::make_shared<const Data>(image));
+    if(cache.size() > max_cached) cache.pop_back();
+    return cache.front().second;
+}
+
 Light_Sample Env_Map::sample() const {
 
     Light_Sample ret;
     ret.distance = std::numeric_limits<float>::infinity();
 
     // TODO (PathTracer): Task 7
-    // Uniformly sample the sphere. Tip: implement Samplers::Sphere::Uniform
-    Samplers::Sphere::Uniform uniform;
-    ret.direction = uniform.sample(ret.pdf);
-
-    // Once you've implemented Samplers::Sphere::Image, remove the above and
-    // uncomment this line to use importance sampling instead.
-    // ret.direction = sampler.sample(ret.pdf);
+    // Importance sample the environment map
+    ret.direction = data->sampler.sample(ret.pdf);
 
     ret.radiance = sample_direction(ret.direction);
     return ret;
@@ -30,7 +61,30 @@ Spectrum Env_Map::sample_direction(Vec3 dir) const {
     // Find the incoming light along a given direction by finding the corresponding
     // place in the enviornment image. You should bi-linearly interpolate the value
     // between the 4 image pixels nearest to the exact direction.
-    return Spectrum();
+    size_t w = data->w, h = data->h;
+    if(w == 0 || h == 0) return {};
+
+    Vec2 uv = Samplers::Sphere::to_uv(dir);
+    float x = uv.x * w - 0.5f;
+    float y = clamp(uv.y * h - 0.5f, 0.0f, (float)(h - 1));
+
+    // Wrap around in phi, clamp at the poles
+    float fx = std::floor(x), fy = std::floor(y);
+    float tx = x - fx, ty = y - fy;
+    size_t x0 = fx < 0.0f ? w - 1 : std::min((size_t)fx, w - 1);
+    size_t y0 = (size_t)fy;
+    size_t y1 = std::min(y0 + 1, h - 1);
+
+    const Spectrum* bottom = &data->texels[y0 * (w + 1) + x0];
+    const Spectrum* top = &data->texels[y1 * (w + 1) + x0];
+
+    Spectrum b = bottom[0] * (1.0f - tx) + bottom[1] * tx;
+    Spectrum t = top[0] * (1.0f - tx) + top[1] * tx;
+    return b * (1.0f - ty) + t * ty;
+}
+
+float Env_Map::pdf(Vec3 dir) const {
+    return data->sampler.pdf(dir);
 }
 
 Light_Sample Env_Hemisphere::sample() const {
@@ -46,6 +100,10 @@ Spectrum Env_Hemisphere::sample_direction(Vec3 dir) const {
     return {};
 }
 
+float Env_Hemisphere::pdf(Vec3 dir) const {
+    return dir.y > 0.0f ? 1.0f / (2.0f * PI_F) : 0.0f;
+}
+
 Light_Sample Env_Sphere::sample() const {
     Light_Sample ret;
     ret.direction = sampler.sample(ret.pdf);
@@ -58,4 +116,8 @@ Spectrum Env_Sphere::sample_direction(Vec3) const {
     return radiance;
 }
 
+float Env_Sphere::pdf(Vec3) const {
+    return 1.0f / (4.0f * PI_F);
+}
+
 } // namespace PT
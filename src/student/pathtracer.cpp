@@ -6,11 +6,22 @@
 
 namespace PT {
 
-// Return the radiance along a ray entering the camera and landing on a
-// point within pixel (x,y) of the output image.
+// Multiple importance sampling weight for a sample taken with density a, when
+// the same direction could also have been generated with density b.
+static float power_heuristic(float a, float b) {
+    a *= a;
+    b *= b;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+// Share of scattered directions drawn from the path guide where it has data
+static const float guide_fraction = 0.5f;
+
+// Return a ray entering the camera and landing on a point within pixel (x,y)
+// of the output image. Its radiance is then found with trace_ray.
 //
 
-Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
+Ray Pathtracer::pixel_ray(size_t x, size_t y) {
 
     Vec2 xy((float)x, (float)y);
     Vec2 wh((float)out_w, (float)out_h);
@@ -18,7 +29,7 @@ Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
     // TODO (PathTracer): Task 1
 
     // Generate a sample within the pixel with coordinates xy and return the
-    // incoming light using trace_ray.
+    // ray through it.
 
 
     // If n_samples is 1, please send the ray through the center of the pixel.
@@ -46,16 +57,35 @@ Spectrum Pathtracer::trace_pixel(size_t x, size_t y) {
     Ray out = camera.generate_ray(xy / wh);
     if (RNG::coin_flip(0.0003f))
         log_ray(out, 5.0f);
-    return trace_ray(out);
+    return out;
 }
 
-Spectrum Pathtracer::trace_ray(const Ray& ray) {
+Spectrum Pathtracer::trace_ray(const Ray& ray, float bsdf_pdf, bool caustic_path,
+                               Hit_Features* features, const Primary_Hit* primary) {
+
+    // bsdf_pdf is the density with which the previous bounce sampled this ray. If it
+    // is nonzero, light sampling was also done there, so any light we find here is
+    // weighted against the light sample that could have found it instead.
+
+    // caustic_path is set once the path has left a diffuse surface. Lights reached
+    // from there through delta bounces alone are already in the caustic photon map.
+
+    // features, if given, receives what the ray hit first (for the denoiser).
+
+    // primary, if given, is what tracing this camera ray in a packet already
+    // found; see Primary_Hit.
 
     // Trace ray into scene. If nothing is hit, sample the environment
-    Trace hit = scene.hit(ray);
+    Trace hit = primary ? primary->hit : scene.hit(ray);
     if(!hit.hit) {
         if(env_light.has_value()) {
-            return env_light.value().sample_direction(ray.dir);
+            const Env_Light& env = env_light.value();
+            Spectrum radiance = env.sample_direction(ray.dir);
+            if(features) features->direct = radiance;
+            if(bsdf_pdf > 0.0f) {
+                radiance *= power_heuristic(bsdf_pdf, n_area_samples * env.pdf(ray.dir));
+            }
+            return radiance;
         }
         return {};
     }
@@ -66,6 +96,14 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
         hit.normal = -hit.normal;
     }
 
+    if(features) {
+        features->albedo = bsdf.albedo();
+        features->normal = hit.normal;
+        features->depth = hit.distance;
+        features->object_id = hit.object;
+        features->material_id = hit.material + 1;
+    }
+
     // Set up a coordinate frame at the hit point, where the surface normal becomes {0, 1, 0}
     // This gives us out_dir and later in_dir in object space, where computations involving the
     // normal become much easier. For example, cos(theta) = dot(N,dir) = dir.y!
@@ -76,6 +114,17 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     // Debugging: if the normal colors flag is set, return the normal color
     if(debug_data.normal_colors) return Spectrum::direction(hit.normal);
 
+    // With path guiding on, non-delta surfaces mix BSDF sampling with the learned
+    // distribution of incoming light, so every density below is that mixture.
+    const SD_Tree* guide_tree = guide_pass.sample.get();
+    bool guided = guide_tree && !bsdf.is_discrete() && guide_tree->can_sample(hit.position);
+    auto scatter_pdf = [&](Vec3 in_dir) {
+        float pdf = bsdf.pdf(out_dir, in_dir);
+        if(!guided) return pdf;
+        float guide_pdf = guide_tree->pdf(hit.position, object_to_world.rotate(in_dir));
+        return (1.0f - guide_fraction) * pdf + guide_fraction * guide_pdf;
+    };
+
     // Now we can compute the rendering equation at this point.
     // We split it into two stages:
     //  1. sampling direct lighting (i.e. directly connecting the current path to
@@ -90,7 +139,7 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     {
 
         // lambda function to sample a light. Called in loop below.
-        auto sample_light = [&](const auto& light) {
+        auto sample_light = [&](const auto& light, size_t light_idx) {
             // If the light is discrete (e.g. a point light), then we only need
             // one sample, as all samples will be equivalent
             int samples = light.is_discrete() ? 1 : (int)n_area_samples;
@@ -120,15 +169,26 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
                 // arbitrary length, it will hit the light it was cast at. Therefore, you should
                 // modify the time_bounds of your shadow ray to account for this. Using EPS_F is
                 // recommended.
-                Ray shadow(hit.position, sample.direction);
-                shadow.dist_bounds = Vec2(EPS_F, sample.distance);
-                Trace hit = scene.hit(shadow);
-                if (hit.hit) continue;
+                Shadow known = Shadow::unknown;
+                if(primary && primary->shadows && light_idx < lights.size())
+                    known = primary->shadows[light_idx];
+                if(known == Shadow::blocked) continue;
+                if(known == Shadow::unknown) {
+                    Ray shadow(hit.position, sample.direction);
+                    shadow.dist_bounds = Vec2(EPS_F, sample.distance - EPS_F);
+                    if (scene.hits(shadow)) continue;
+                }
 
                 // Note: that along with the typical cos_theta, pdf factors, we divide by samples.
                 // This is because we're doing another monte-carlo estimate of the lighting from
                 // area lights here.
-                radiance_out += (cos_theta / (samples * sample.pdf)) * sample.radiance * attenuation;
+                float weight = 1.0f;
+                if(!light.is_discrete()) {
+                    weight = power_heuristic(samples * sample.pdf, scatter_pdf(in_dir));
+                }
+                Spectrum direct = (cos_theta / (samples * sample.pdf)) * sample.radiance * attenuation;
+                radiance_out += weight * direct;
+                if(features) features->direct += direct;
             }
         };
 
@@ -137,10 +197,19 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
         if(!bsdf.is_discrete()) {
 
             // loop over all the lights and accumulate radiance.
-            for(const auto& light : lights)
-                sample_light(light);
+            for(size_t i = 0; i < lights.size(); i++)
+                sample_light(lights[i], i);
             if(env_light.has_value())
-                sample_light(env_light.value());
+                sample_light(env_light.value(), lights.size());
+
+            // Light focused onto this point by mirrors and glass
+            if(caustics) {
+                radiance_out += caustics->gather(hit.position, [&](const Photon& p) {
+                    Vec3 in_dir = world_to_object.rotate(p.direction);
+                    if(in_dir.y <= 0.0f) return Spectrum{};
+                    return bsdf.evaluate(out_dir, in_dir) * p.power;
+                });
+            }
         }
     }
 
@@ -155,8 +224,30 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     // (2) Randomly select a new ray direction (it may be reflection or transmittance
     // ray depending on surface type) using bsdf.sample()
     BSDF_Sample in_sample = bsdf.sample(out_dir);
-    radiance_out += in_sample.emissive;
-    
+
+    // Emitters that could also have been reached by light sampling at the previous
+    // bounce are weighted against that strategy.
+    int light_idx = emitter_lights[hit.material];
+    if(bsdf_pdf > 0.0f && light_idx >= 0) {
+        float light_pdf = n_area_samples * lights[light_idx].pdf(ray.point, hit);
+        radiance_out += power_heuristic(bsdf_pdf, light_pdf) * in_sample.emissive;
+    } else if(!(caustics && caustic_path && light_idx >= 0)) {
+        radiance_out += in_sample.emissive;
+    }
+    if(features) features->direct += in_sample.emissive;
+
+    if(guided) {
+        if(RNG::coin_flip(guide_fraction)) {
+            float guide_pdf;
+            in_sample.direction = world_to_object.rotate(guide_tree->sample(hit.position, guide_pdf));
+            in_sample.attenuation = in_sample.direction.y > 0.0f
+                                        ? bsdf.evaluate(out_dir, in_sample.direction)
+                                        : Spectrum{};
+        }
+        in_sample.pdf = scatter_pdf(in_sample.direction);
+    }
+    if(in_sample.pdf <= 0.0f) return radiance_out;
+
     // (3) Compute the throughput of the recursive ray. This should be the current ray's
     // throughput scaled by the BSDF attenuation, cos(theta), and BSDF sample PDF.
     // Potentially terminate the path using Russian roulette as a function of the new throughput.
@@ -176,7 +267,13 @@ Spectrum Pathtracer::trace_ray(const Ray& ray) {
     // set the new throughput and depth values.
     Ray rec(hit.position, object_to_world.rotate(in_sample.direction));
     rec.depth = ray.depth + 1; rec.dist_bounds.x = EPS_F;
-    Spectrum radiance_recursive = trace_ray(rec);
+    Spectrum radiance_recursive = trace_ray(rec, bsdf.is_discrete() ? 0.0f : in_sample.pdf,
+                                            caustic_path || !bsdf.is_discrete());
+
+    // Teach the guide how much light arrived from this direction
+    if(guide_pass.train && !bsdf.is_discrete()) {
+        guide_pass.train->record(hit.position, rec.dir, radiance_recursive.luma() / in_sample.pdf);
+    }
 
     // (5) Add contribution due to incoming light with proper weighting. Remember to add in
     // the BSDF sample emissive term.
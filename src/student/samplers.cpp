@@ -23,7 +23,18 @@ Vec3 Hemisphere::Cosine::sample(float& pdf) const {
 
     // TODO (PathTracer): Task 6
     // You may implement this, but don't have to.
-    return Vec3();
+    float Xi1 = RNG::unit();
+    float Xi2 = RNG::unit();
+
+    float r = std::sqrt(Xi1);
+    float phi = 2.0f * PI_F * Xi2;
+
+    float xs = r * std::cos(phi);
+    float ys = std::sqrt(std::max(0.0f, 1.0f - Xi1));
+    float zs = r * std::sin(phi);
+
+    pdf = ys / PI_F;
+    return Vec3(xs, ys, zs);
 }
 
 Vec3 Sphere::Uniform::sample(float& pdf) const {
@@ -32,8 +43,25 @@ Vec3 Sphere::Uniform::sample(float& pdf) const {
     // Generate a uniformly random point on the unit sphere (or equivalently, direction)
     // Tip: start with Hemisphere::Uniform
 
-    pdf = 1.0f; // what was the PDF at the chosen direction?
-    return Vec3();
+    Vec3 dir = hemi.sample(pdf);
+    if(RNG::coin_flip()) dir.y = -dir.y;
+
+    pdf = 1.0f / (4.0f * PI_F); // what was the PDF at the chosen direction?
+    return dir;
+}
+
+Vec2 Sphere::to_uv(Vec3 dir) {
+    float phi = std::atan2(dir.z, dir.x);
+    if(phi < 0.0f) phi += 2.0f * PI_F;
+    float theta = std::acos(clamp(dir.y, -1.0f, 1.0f));
+    return Vec2(phi / (2.0f * PI_F), 1.0f - theta / PI_F);
+}
+
+Vec3 Sphere::from_uv(Vec2 uv) {
+    float phi = uv.x * 2.0f * PI_F;
+    float theta = (1.0f - uv.y) * PI_F;
+    float s = std::sin(theta);
+    return Vec3(s * std::cos(phi), std::cos(theta), s * std::sin(phi));
 }
 
 Sphere::Image::Image(const HDR_Image& image) {
@@ -41,22 +69,56 @@ Sphere::Image::Image(const HDR_Image& image) {
     // TODO (PathTracer): Task 7
     // Set up importance sampling for a spherical environment map image.
 
-    // You may make use of the pdf, cdf, and total members, or create your own
-    // representation.
-
     const auto [_w, _h] = image.dimension();
     w = _w;
     h = _h;
+
+    // Weight each pixel by its brightness and the solid angle it covers
+    std::vector<float> weights(w * h);
+    for(size_t j = 0; j < h; j++) {
+        float s = std::sin(PI_F * (1.0f - (j + 0.5f) / h));
+        for(size_t i = 0; i < w; i++) {
+            size_t idx = j * w + i;
+            weights[idx] = image.at(idx).luma() * s;
+        }
+    }
+    pixels = Alias(weights);
 }
 
 Vec3 Sphere::Image::sample(float& out_pdf) const {
 
     // TODO (PathTracer): Task 7
     // Use your importance sampling data structure to generate a sample direction.
-    // Tip: std::upper_bound can easily binary search your CDF
 
-    out_pdf = 1.0f; // what was the PDF (again, PMF here) of your chosen sample?
-    return Vec3();
+    if(pixels.empty()) {
+        Sphere::Uniform uniform;
+        return uniform.sample(out_pdf);
+    }
+
+    float pmf;
+    size_t idx = pixels.sample(pmf);
+
+    // Jitter within the chosen pixel so the density is piecewise constant in (u,v)
+    Vec2 uv((idx % w + RNG::unit()) / w, (idx / w + RNG::unit()) / h);
+    Vec3 dir = from_uv(uv);
+
+    float s = std::sqrt(std::max(0.0f, 1.0f - dir.y * dir.y));
+    out_pdf = pmf * (w * h) / (2.0f * PI_F * PI_F * s);
+    return dir;
+}
+
+float Sphere::Image::pdf(Vec3 dir) const {
+
+    if(pixels.empty()) return 1.0f / (4.0f * PI_F);
+
+    Vec2 uv = to_uv(dir);
+    size_t i = std::min((size_t)(uv.x * w), w - 1);
+    size_t j = std::min((size_t)(uv.y * h), h - 1);
+
+    // Jacobian from (u,v) in [0,1]^2 to solid angle is 2 pi^2 sin(theta)
+    float s = std::sqrt(std::max(0.0f, 1.0f - dir.y * dir.y));
+    if(s == 0.0f) return 0.0f;
+    return pixels.pmf(j * w + i) * (w * h) / (2.0f * PI_F * PI_F * s);
 }
 
 Vec3 Point::sample(float& pmf) const {
@@ -74,6 +136,60 @@ Vec3 Two_Points::sample(float& pmf) const {
     return p2;
 }
 
+Alias::Alias(const std::vector<float>& weights) {
+
+    size_t n = weights.size();
+    total = 0.0f;
+    for(float w : weights) total += w;
+    if(n == 0 || total <= 0.0f) return;
+
+    probs.resize(n);
+    accept.resize(n);
+    alias.resize(n);
+
+    // Split the scaled weights into under- and over-full buckets, then top up
+    // each under-full bucket with the remainder of an over-full one.
+    std::vector<size_t> small, large;
+    for(size_t i = 0; i < n; i++) {
+        probs[i] = weights[i] / total;
+        accept[i] = probs[i] * n;
+        alias[i] = i;
+        if(accept[i] < 1.0f)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while(!small.empty() && !large.empty()) {
+        size_t s = small.back(), l = large.back();
+        small.pop_back();
+        alias[s] = l;
+        accept[l] -= 1.0f - accept[s];
+        if(accept[l] < 1.0f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Leftovers are only off from 1 by rounding error
+    for(size_t i : small) accept[i] = 1.0f;
+    for(size_t i : large) accept[i] = 1.0f;
+}
+
+size_t Alias::sample(float& pmf) const {
+
+    float u = RNG::unit() * probs.size();
+    size_t i = std::min((size_t)u, probs.size() - 1);
+    if(u - i >= accept[i]) i = alias[i];
+
+    pmf = probs[i];
+    return i;
+}
+
+float Alias::pmf(size_t i) const {
+    return probs[i];
+}
+
 Vec3 Hemisphere::Uniform::sample(float& pdf) const {
 
     float Xi1 = RNG::unit();
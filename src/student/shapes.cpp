@@ -25,11 +25,8 @@ Trace Sphere::hit(const Ray& ray) const {
     // but only the _later_ one is within ray.dist_bounds, you should
     // return that one!
     Trace ret;
-    ret.origin = ray.point;
     ret.hit = false;       // was there an intersection?
     ret.distance = 0.0f;   // at what distance did the intersection occur?
-    ret.position = Vec3{}; // where was the intersection?
-    ret.normal = Vec3{};   // what was the surface normal at the intersection?
 
     //implcid surface all |x|^2 = radius ^2
     float b = dot(ray.point, ray.dir);
@@ -45,8 +42,6 @@ Trace Sphere::hit(const Ray& ray) const {
     {
         ret.hit = true;
         ret.distance = tmin;
-        ret.position = ray.point + ray.dir*tmin;
-        ret.normal = ret.position.unit(); //from the origin to the point out of sphere
         ray.dist_bounds.y = tmin;
         return ret;
     }
@@ -54,8 +49,6 @@ Trace Sphere::hit(const Ray& ray) const {
     {
         ret.hit = true;
         ret.distance = tmax;
-        ret.position = ray.point + ray.dir*tmax;
-        ret.normal = ret.position.unit(); //from the origin to the point out of sphere
         ray.dist_bounds.y = tmax;
         return ret;
     }
@@ -64,4 +57,10 @@ Trace Sphere::hit(const Ray& ray) const {
     return ret;
 }
 
+void Sphere::compute_interaction(const Ray& ray, Trace& hit) const {
+    hit.origin = ray.point;
+    hit.position = ray.point + ray.dir*hit.distance;
+    hit.normal = hit.position.unit(); //from the origin to the point out of sphere
+}
+
 } // namespace PT
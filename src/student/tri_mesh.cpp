@@ -39,12 +39,10 @@ Trace Triangle::hit(const Ray& ray) const {
     Vec3 s = ray.point - v_0.position;
 
     Trace ret;
-    ret.origin = ray.point;
     ret.hit = false;       // was there an intersection?
     ret.distance = 0.0f;   // at what distance did the intersection occur?
-    ret.position = Vec3{}; // where was the intersection?
-    ret.normal = Vec3{};   // what was the surface normal at the intersection?
-                           // (this should be interpolated between the three vertex normals)
+    ret.uv = Vec2{};       // where on the triangle was it? (position and normal follow from
+                           // these in compute_interaction, once the closest hit is known)
     float denom = dot(cross(e1, ray.dir),e2);
     if(denom <= 1e-6 && denom >= -1e-6)
     {
@@ -59,11 +57,9 @@ Trace Triangle::hit(const Ray& ray) const {
         if(uvt.z < ray.dist_bounds.y && uvt.z > ray.dist_bounds.x && uvt.x > 0 && uvt.y > 0 && (uvt.x + uvt.y) <= 1)
         {
             ret.hit = true;
-            ret.origin = ray.point;
-            ret.position = ray.point + ray.dir*uvt.z;
             ret.distance = uvt.z;
-            ret.normal = uvt.x*v_1.normal + uvt.y*v_2.normal + (1-uvt.x-uvt.y)*v_0.normal;
-            ret.normal = ret.normal.unit();
+            ret.uv = Vec2(uvt.x, uvt.y);
+            ret.primitive = id;
 
             ray.dist_bounds.y = uvt.z;
             
@@ -76,6 +72,19 @@ Trace Triangle::hit(const Ray& ray) const {
     return ret;
 }
 
+void Triangle::compute_interaction(const Ray& ray, Trace& hit) const {
+
+    const Tri_Mesh_Vert& v_0 = vertex_list[v0];
+    const Tri_Mesh_Vert& v_1 = vertex_list[v1];
+    const Tri_Mesh_Vert& v_2 = vertex_list[v2];
+
+    // The normal is interpolated between the three vertex normals
+    hit.origin = ray.point;
+    hit.position = ray.point + ray.dir*hit.distance;
+    hit.normal = hit.uv.x*v_1.normal + hit.uv.y*v_2.normal + (1-hit.uv.x-hit.uv.y)*v_0.normal;
+    hit.normal = hit.normal.unit();
+}
+
 Triangle::Triangle(Tri_Mesh_Vert* verts, unsigned int v0, unsigned int v1, unsigned int v2)
     : vertex_list(verts), v0(v0), v1(v1), v2(v2) {
 }
@@ -97,6 +106,7 @@ void Tri_Mesh::build(const GL::Mesh& mesh) {
     }
 
     triangles.build(std::move(tris), 4);
+    triangles.for_each([](Triangle& tri, size_t i) { tri.id = (unsigned int)i; });
 }
 
 Tri_Mesh::Tri_Mesh(const GL::Mesh& mesh) {
@@ -107,6 +117,8 @@ Tri_Mesh Tri_Mesh::copy() const {
     Tri_Mesh ret;
     ret.verts = verts;
     ret.triangles = triangles.copy();
+    // The copied triangles still point at this mesh's vertices
+    ret.triangles.for_each([&ret](Triangle& tri, size_t) { tri.vertex_list = ret.verts.data(); });
     return ret;
 }
 
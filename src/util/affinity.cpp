@@ -0,0 +1,142 @@
+
+#include "affinity.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Affinity {
+
+static std::atomic<bool> is_enabled{false};
+static thread_local size_t node = 0;
+
+void enable(bool on) {
+    is_enabled = on;
+}
+
+bool enabled() {
+    return is_enabled;
+}
+
+#ifdef __linux__
+
+// Parses sysfs lists like "0-15,32-47"
+static std::vector<unsigned int> parse_cpus(const std::string& list) {
+    std::vector<unsigned int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while(std::getline(stream, range, ',')) {
+        unsigned int lo = 0, hi = 0;
+        int n = sscanf(range.c_str(), "%u-%u", &lo, &hi);
+        if(n < 1) continue;
+        if(n == 1) hi = lo;
+        for(unsigned int c = lo; c <= hi; c++) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+static std::vector<std::vector<unsigned int>> find_nodes() {
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::vector<std::vector<unsigned int>> found;
+    for(int i = 0;; i++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(i) + "/cpulist");
+        if(!file) break;
+        std::string list;
+        std::getline(file, list);
+
+        // Nodes may be memory only, and containers may only get some CPUs
+        std::vector<unsigned int> cpus;
+        for(unsigned int c : parse_cpus(list)) {
+            if(!masked || (c < CPU_SETSIZE && CPU_ISSET(c, &allowed))) cpus.push_back(c);
+        }
+        if(!cpus.empty()) found.push_back(std::move(cpus));
+    }
+
+    if(found.empty()) {
+        std::vector<unsigned int> cpus;
+        for(unsigned int c = 0; c < CPU_SETSIZE; c++) {
+            if(masked ? CPU_ISSET(c, &allowed) : c < std::thread::hardware_concurrency())
+                cpus.push_back(c);
+        }
+        found.push_back(std::move(cpus));
+    }
+    return found;
+}
+
+static bool pin(const std::vector<unsigned int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int c : cpus) CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+
+static std::vector<std::vector<unsigned int>> find_nodes() {
+    std::vector<unsigned int> cpus;
+    for(unsigned int c = 0; c < std::max(1u, std::thread::hardware_concurrency()); c++)
+        cpus.push_back(c);
+    return {cpus};
+}
+
+static bool pin(const std::vector<unsigned int>& cpus) {
+    return false;
+}
+
+#endif
+
+const std::vector<std::vector<unsigned int>>& nodes() {
+    static const auto found = find_nodes();
+    return found;
+}
+
+size_t worker_node(size_t worker, size_t workers) {
+    if(!is_enabled || !workers) return 0;
+    return worker * nodes().size() / workers;
+}
+
+bool pin_worker(size_t worker, size_t workers) {
+
+    if(!is_enabled || !workers) return false;
+    size_t n = worker_node(worker, workers);
+
+    // Workers on one node take its CPUs in order, which on Linux puts them on
+    // separate cores before sharing any as hyperthreads
+    size_t first = (n * workers + nodes().size() - 1) / nodes().size();
+    const std::vector<unsigned int>& cpus = nodes()[n];
+    if(!pin({cpus[(worker - first) % cpus.size()]})) return false;
+    node = n;
+    return true;
+}
+
+size_t current_node() {
+    return node;
+}
+
+void on_each_node(const std::function<void(size_t)>& f) {
+
+    std::vector<std::thread> threads;
+    for(size_t n = 0; n < nodes().size(); n++) {
+        threads.emplace_back([&f, n]() {
+            pin(nodes()[n]);
+            node = n;
+            f(n);
+        });
+    }
+    for(std::thread& t : threads) t.join();
+}
+
+} // namespace Affinity
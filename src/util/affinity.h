@@ -0,0 +1,33 @@
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+// Where threads run on machines with several NUMA nodes (sockets). Off until
+// enable() is called; then thread pools pin their workers to cores, spread
+// over the nodes, and structures can be copied so each node reads its own.
+// Only Linux is supported; elsewhere everything sees one node and pinning
+// does nothing.
+namespace Affinity {
+
+void enable(bool on);
+bool enabled();
+
+// CPUs this process may use, grouped by node. Never empty.
+const std::vector<std::vector<unsigned int>>& nodes();
+
+// Which node worker i of n runs on, so neighbouring workers share one
+size_t worker_node(size_t worker, size_t workers);
+
+// Pins the calling thread, as worker i of n, to one CPU; false if it couldn't
+bool pin_worker(size_t worker, size_t workers);
+
+// The node the calling thread was pinned to, or 0
+size_t current_node();
+
+// Runs f(node) for every node at once, each on a thread kept to that node, so
+// what f allocates and first writes lives in that node's memory
+void on_each_node(const std::function<void(size_t)>& f);
+
+} // namespace Affinity
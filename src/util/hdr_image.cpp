@@ -1,23 +1,32 @@
 
 #include "hdr_image.h"
 #include "../lib/log.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cmath>
 
 #include <sf_libs/stb_image.h>
 #include <sf_libs/tinyexr.h>
 
+static std::atomic<size_t> next_identity(1);
+
 HDR_Image::HDR_Image() : w(0), h(0) {
 }
 
 HDR_Image::HDR_Image(size_t w, size_t h) : w(w), h(h) {
     assert(w > 0 && h > 0);
     pixels.resize(w * h);
+    _identity = next_identity++;
 }
 
 HDR_Image HDR_Image::copy() const {
     HDR_Image ret;
-    ret.resize(w, h);
-    ret.pixels.insert(ret.pixels.begin(), pixels.begin(), pixels.end());
+    ret.w = w;
+    ret.h = h;
+    ret.pixels = pixels;
     ret.last_path = last_path;
+    ret._identity = _identity;
     ret.dirty = true;
     ret.exposure = exposure;
     return ret;
@@ -32,11 +41,13 @@ void HDR_Image::resize(size_t _w, size_t _h) {
     h = _h;
     pixels.clear();
     pixels.resize(w * h);
+    _identity = next_identity++;
     dirty = true;
 }
 
 void HDR_Image::clear(Spectrum color) {
     for(auto& s : pixels) s = color;
+    _identity = next_identity++;
     dirty = true;
 }
 
@@ -135,6 +146,10 @@ std::string HDR_Image::loaded_from() const {
     return last_path;
 }
 
+size_t HDR_Image::identity() const {
+    return _identity;
+}
+
 void HDR_Image::tonemap(float e) const {
 
     if(e <= 0.0f) {
@@ -158,6 +173,29 @@ const GL::Tex2D& HDR_Image::get_texture(float e) const {
     return render_tex;
 }
 
+// Every output level k > 0 begins where
+//   round(pow(1 - exp(-x * e), 1 / GAMMA) * 255) = k,
+// so converting a channel is a branchless search of these thresholds instead
+// of an exp and a pow.
+struct Tonemap_Levels {
+
+    Tonemap_Levels(float e) {
+        start[0] = -INFINITY;
+        for(int k = 1; k < 256; k++) {
+            float y = std::pow((k - 0.5f) / 255.0f, GAMMA);
+            start[k] = -std::log(1.0f - y) / e;
+        }
+    }
+
+    unsigned char operator()(float x) const {
+        int k = 0;
+        for(int step = 128; step; step >>= 1) k += (x >= start[k + step]) ? step : 0;
+        return (unsigned char)k;
+    }
+
+    float start[256];
+};
+
 void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e) const {
 
     if(e <= 0.0f) {
@@ -166,24 +204,23 @@ void HDR_Image::tonemap_to(std::vector<unsigned char>& data, float e) const {
 
     if(data.size() != w * h * 4) data.resize(w * h * 4);
 
-    for(size_t j = 0; j < h; j++) {
-        for(size_t i = 0; i < w; i++) {
-
-            size_t pidx = (h - j - 1) * w + i;
-            const Spectrum& sample = pixels[pidx];
-
-            float r = 1.0f - std::exp(-sample.r * exposure);
-            float g = 1.0f - std::exp(-sample.g * exposure);
-            float b = 1.0f - std::exp(-sample.b * exposure);
+    Tonemap_Levels levels(e);
 
-            Spectrum out(r, g, b);
-            out.make_srgb();
-
-            size_t didx = 4 * (j * w + i);
-            data[didx] = (unsigned char)std::round(out.r * 255.0f);
-            data[didx + 1] = (unsigned char)std::round(out.g * 255.0f);
-            data[didx + 2] = (unsigned char)std::round(out.b * 255.0f);
-            data[didx + 3] = 255;
+    auto row = [&](size_t j) {
+        const Spectrum* src = &pixels[(h - j - 1) * w];
+        unsigned char* dst = &data[4 * j * w];
+        for(size_t i = 0; i < w; i++) {
+            dst[4 * i] = levels(src[i].r);
+            dst[4 * i + 1] = levels(src[i].g);
+            dst[4 * i + 2] = levels(src[i].b);
+            dst[4 * i + 3] = 255;
         }
+    };
+
+    // Small images aren't worth starting threads for
+    if(w * h < 256 * 256) {
+        for(size_t j = 0; j < h; j++) row(j);
+    } else {
+        Thread_Pool::shared().parallel_for(0, h, 1, row);
     }
 }
@@ -31,6 +31,10 @@ public:
     std::string load_from(std::string file);
     std::string loaded_from() const;
 
+    /// Unique per image contents: changes on load, resize and clear (but not on
+    /// writes through at()), and is shared by copies.
+    size_t identity() const;
+
     void tonemap_to(std::vector<unsigned char>& data, float exposure = 0.0f) const;
     const GL::Tex2D& get_texture(float exposure = 0.0f) const;
 
@@ -38,6 +42,7 @@ private:
     void tonemap(float exposure = 0.0f) const;
 
     size_t w, h;
+    size_t _identity = 0;
     std::string last_path;
     std::vector<Spectrum> pixels;
 
@@ -0,0 +1,345 @@
+
+#include "image_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sf_libs/stb_image_write.h>
+#include <sf_libs/tinyexr.h>
+
+// How many frames may wait per encoding thread before submit() blocks
+static const size_t queue_depth = 2;
+
+Image_Encoder::Image_Encoder(const Options& o) : opt(o) {
+
+    // stb reads these globals on every write, so they can't differ per image.
+    // Everything else keeps the defaults.
+    old_level = stbi_write_png_compression_level;
+    old_filter = stbi_write_force_png_filter;
+    if(opt.format == Image_Format::png_fast) {
+        stbi_write_png_compression_level = 5;
+        stbi_write_force_png_filter = 1;
+    }
+    // tonemap_to already puts the top row first
+    stbi_flip_vertically_on_write(0);
+
+    size_t n = std::max(opt.threads, size_t(1));
+    for(size_t i = 0; i < n; i++) threads.emplace_back([this]() { worker(); });
+}
+
+Image_Encoder::~Image_Encoder() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for(std::thread& t : threads) t.join();
+    if(stream) fclose(stream);
+    stbi_write_png_compression_level = old_level;
+    stbi_write_force_png_filter = old_filter;
+}
+
+bool Image_Encoder::is_stream(Image_Format format) {
+    return format == Image_Format::y4m || format == Image_Format::rgb;
+}
+
+const char* Image_Encoder::extension(Image_Format format) {
+    switch(format) {
+    case Image_Format::exr: return ".exr";
+    case Image_Format::y4m: return ".y4m";
+    case Image_Format::rgb: return ".rgb";
+    default: return ".png";
+    }
+}
+
+std::string Image_Encoder::open_stream(const std::string& path) {
+    finish();
+    if(stream) fclose(stream);
+    stream = fopen(path.c_str(), "wb");
+    next_submit = next_write = 0;
+    if(!stream) return "Failed to open " + path + " for writing.";
+    return {};
+}
+
+void Image_Encoder::run(std::function<std::string()> job) {
+    std::unique_lock<std::mutex> lock(mut);
+    done_cv.wait(lock, [&]() { return jobs.size() < queue_depth * threads.size(); });
+    jobs.push_back(std::move(job));
+    pending++;
+    work_cv.notify_one();
+}
+
+void Image_Encoder::submit(const std::string& path, HDR_Image&& image, float exposure) {
+
+    // Jobs are std::functions, which must be copyable
+    auto shared = std::make_shared<HDR_Image>(std::move(image));
+
+    if(is_stream(opt.format)) {
+        // Numbered here and popped in order, so the frame that's next to be
+        // written is always already running.
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            index = next_submit++;
+        }
+        run([=]() { return write_stream(index, *shared, exposure); });
+    } else {
+        run([=]() { return write_frame(path, *shared, exposure); });
+    }
+}
+
+std::string Image_Encoder::finish() {
+    std::unique_lock<std::mutex> lock(mut);
+    done_cv.wait(lock, [&]() { return pending == 0; });
+    if(stream) fflush(stream);
+    return std::move(error);
+}
+
+void Image_Encoder::worker() {
+    for(;;) {
+        std::function<std::string()> job;
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            work_cv.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if(jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        done_cv.notify_all();
+
+        std::string err = job();
+
+        std::lock_guard<std::mutex> lock(mut);
+        if(error.empty()) error = std::move(err);
+        pending--;
+        done_cv.notify_all();
+    }
+}
+
+static unsigned int crc32(unsigned int crc, const unsigned char* data, size_t bytes) {
+    static const auto table = []() {
+        std::vector<unsigned int> t(256);
+        for(unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for(size_t i = 0; i < bytes; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(std::vector<unsigned char>& out, unsigned int v) {
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+PNG_Stream::~PNG_Stream() {
+    if(file) fclose(file);
+}
+
+void PNG_Stream::chunk(const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> out;
+    put_u32(out, (unsigned int)data.size());
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_u32(out, crc32(0, &out[4], out.size() - 4));
+    failed = failed || fwrite(out.data(), 1, out.size(), file) != out.size();
+}
+
+std::string PNG_Stream::open(const std::string& p, size_t _w, size_t _h) {
+
+    if(file) fclose(file);
+    path = p;
+    w = _w;
+    h = _h;
+    rows_done = 0;
+    adler_a = 1;
+    adler_b = 0;
+    failed = false;
+
+    file = fopen(path.c_str(), "wb");
+    if(!file) return "Failed to write png: " + path;
+
+    const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    failed = fwrite(signature, 1, sizeof(signature), file) != sizeof(signature);
+
+    std::vector<unsigned char> header;
+    put_u32(header, (unsigned int)w);
+    put_u32(header, (unsigned int)h);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    chunk("IHDR", header);
+    return {};
+}
+
+void PNG_Stream::write(const unsigned char* rgba, size_t rows) {
+
+    if(!file || !rows) return;
+    rows = std::min(rows, h - rows_done);
+
+    // Each band is its own IDAT; together they make up one zlib stream of
+    // stored blocks, which is only ever closed by the last row.
+    size_t row_bytes = 1 + 3 * w;
+    std::vector<unsigned char> raw(row_bytes * rows);
+    for(size_t j = 0; j < rows; j++) {
+        unsigned char* dst = &raw[j * row_bytes];
+        const unsigned char* src = &rgba[4 * j * w];
+        *dst++ = 0;
+        for(size_t i = 0; i < w; i++) {
+            *dst++ = src[4 * i];
+            *dst++ = src[4 * i + 1];
+            *dst++ = src[4 * i + 2];
+        }
+    }
+    rows_done += rows;
+    bool last = rows_done == h;
+
+    std::vector<unsigned char> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    if(rows_done == rows) zlib.insert(zlib.end(), {0x78, 0x01});
+    size_t at = 0;
+    do {
+        size_t n = std::min(raw.size() - at, size_t(65535));
+        zlib.push_back(last && at + n == raw.size() ? 1 : 0);
+        zlib.push_back((unsigned char)n);
+        zlib.push_back((unsigned char)(n >> 8));
+        zlib.push_back((unsigned char)~n);
+        zlib.push_back((unsigned char)(~n >> 8));
+        zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + n);
+        for(size_t i = at; i < at + n; i++) {
+            adler_a = (adler_a + raw[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        at += n;
+    } while(at < raw.size());
+    if(last) put_u32(zlib, (adler_b << 16) | adler_a);
+
+    chunk("IDAT", zlib);
+}
+
+std::string PNG_Stream::close() {
+    if(!file) return {};
+    if(rows_done == h) chunk("IEND", {});
+    failed = fclose(file) != 0 || failed;
+    file = nullptr;
+    if(failed || rows_done != h) return "Failed to write png: " + path;
+    return {};
+}
+
+std::string Image_Encoder::write_frame(const std::string& path, const HDR_Image& image,
+                                       float exposure) {
+
+    // Written under another name and moved into place, so anything watching
+    // the file never reads half an image
+    std::string part = path + ".part";
+    std::string err = encode(part, image, exposure);
+    if(!err.empty()) {
+        std::remove(part.c_str());
+        return err;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename() won't replace a file here
+#endif
+    if(std::rename(part.c_str(), path.c_str())) return "Failed to move " + part + " to " + path;
+    return {};
+}
+
+std::string Image_Encoder::encode(const std::string& path, const HDR_Image& image,
+                                  float exposure) {
+
+    auto [w, h] = image.dimension();
+
+    if(opt.format == Image_Format::exr) {
+        std::vector<float> data(w * h * 3);
+        for(size_t j = 0; j < h; j++) {
+            for(size_t i = 0; i < w; i++) {
+                Spectrum s = image.at(i, h - j - 1);
+                float* dst = &data[3 * (j * w + i)];
+                dst[0] = s.r;
+                dst[1] = s.g;
+                dst[2] = s.b;
+            }
+        }
+        const char* err = nullptr;
+        if(SaveEXR(data.data(), (int)w, (int)h, 3, 1, path.c_str(), &err) != TINYEXR_SUCCESS) {
+            std::string msg = err ? err : "Unknown failure.";
+            if(err) FreeEXRErrorMessage(err);
+            return "Failed to write exr: " + msg;
+        }
+        return {};
+    }
+
+    std::vector<unsigned char> data;
+    image.tonemap_to(data, exposure);
+
+    if(opt.format == Image_Format::png_raw) {
+        PNG_Stream png;
+        std::string err = png.open(path, w, h);
+        if(!err.empty()) return err;
+        png.write(data.data(), h);
+        return png.close();
+    }
+
+    if(!stbi_write_png(path.c_str(), (int)w, (int)h, 4, data.data(), (int)w * 4)) {
+        return "Failed to write png: " + path;
+    }
+    return {};
+}
+
+std::string Image_Encoder::write_stream(size_t index, const HDR_Image& image, float exposure) {
+
+    auto [w, h] = image.dimension();
+    size_t n = w * h;
+
+    std::vector<unsigned char> data;
+    image.tonemap_to(data, exposure);
+
+    // Y4M frames are planar, raw frames interleaved
+    std::vector<unsigned char> frame;
+    if(opt.format == Image_Format::y4m) {
+        if(index == 0) {
+            std::string header = "YUV4MPEG2 W" + std::to_string(w) + " H" + std::to_string(h) +
+                                 " F" + std::to_string(opt.fps) + ":1 Ip A1:1 C444\n";
+            frame.insert(frame.end(), header.begin(), header.end());
+        }
+        const char tag[] = "FRAME\n";
+        frame.insert(frame.end(), tag, tag + 6);
+        size_t base = frame.size();
+        frame.resize(base + 3 * n);
+
+        // BT.709, limited range
+        for(size_t i = 0; i < n; i++) {
+            float r = data[4 * i] / 255.0f;
+            float g = data[4 * i + 1] / 255.0f;
+            float b = data[4 * i + 2] / 255.0f;
+            float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+            frame[base + i] = (unsigned char)(16.5f + 219.0f * y);
+            frame[base + n + i] = (unsigned char)(128.5f + 224.0f * (b - y) / 1.8556f);
+            frame[base + 2 * n + i] = (unsigned char)(128.5f + 224.0f * (r - y) / 1.5748f);
+        }
+    } else {
+        frame.resize(3 * n);
+        for(size_t i = 0; i < n; i++) {
+            frame[3 * i] = data[4 * i];
+            frame[3 * i + 1] = data[4 * i + 1];
+            frame[3 * i + 2] = data[4 * i + 2];
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(stream_mut);
+    stream_cv.wait(lock, [&]() { return next_write == index; });
+    std::string err;
+    if(!stream) {
+        err = "No stream open to write frames to.";
+    } else if(fwrite(frame.data(), 1, frame.size(), stream) != frame.size()) {
+        err = "Failed to write frame " + std::to_string(index) + ".";
+    }
+    next_write++;
+    stream_cv.notify_all();
+    return err;
+}
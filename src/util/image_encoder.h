@@ -0,0 +1,102 @@
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hdr_image.h"
+
+enum class Image_Format {
+    png,      // deflate level 8, best filter per row
+    png_fast, // lowest deflate level, one filter
+    png_raw,  // stored without compression
+    exr,      // half-float RGB
+    y4m,      // one YUV 4:4:4 stream, for piping into video encoders
+    rgb       // one stream of raw 8-bit RGB frames
+};
+
+// Writes an uncompressed RGB PNG a band of rows at a time, so the whole image
+// never has to be in memory. Rows come top first as RGBA, like tonemap_to makes.
+class PNG_Stream {
+public:
+    PNG_Stream() = default;
+    ~PNG_Stream();
+
+    PNG_Stream(const PNG_Stream& src) = delete;
+    PNG_Stream& operator=(const PNG_Stream& src) = delete;
+
+    std::string open(const std::string& path, size_t w, size_t h);
+    void write(const unsigned char* rgba, size_t rows);
+    // Returns an error if anything failed to write, or rows are missing
+    std::string close();
+
+private:
+    void chunk(const char* type, const std::vector<unsigned char>& data);
+
+    FILE* file = nullptr;
+    std::string path;
+    size_t w = 0, h = 0, rows_done = 0;
+    unsigned int adler_a = 1, adler_b = 0;
+    bool failed = false;
+};
+
+// Tonemaps and writes finished frames on background threads, so the caller can
+// get on with the next one. Image formats go to one file per frame, in any
+// order; stream formats append every frame to one file, in submission order.
+class Image_Encoder {
+public:
+    struct Options {
+        Image_Format format = Image_Format::png;
+        size_t threads = 2;
+        int fps = 24; // written to Y4M headers
+    };
+
+    Image_Encoder(const Options& opt);
+    ~Image_Encoder();
+
+    Image_Encoder(const Image_Encoder& src) = delete;
+    Image_Encoder& operator=(const Image_Encoder& src) = delete;
+
+    // Stream formats write here; may be a FIFO an encoder reads from
+    std::string open_stream(const std::string& path);
+
+    // Blocks while too many frames are already waiting
+    void submit(const std::string& path, HDR_Image&& image, float exposure);
+    void run(std::function<std::string()> job);
+
+    // Waits for everything submitted. Returns the first error, if any.
+    std::string finish();
+
+    static bool is_stream(Image_Format format);
+    static const char* extension(Image_Format format);
+
+private:
+    void worker();
+    std::string write_frame(const std::string& path, const HDR_Image& image, float exposure);
+    std::string encode(const std::string& path, const HDR_Image& image, float exposure);
+    std::string write_stream(size_t index, const HDR_Image& image, float exposure);
+
+    Options opt;
+    int old_level = 8, old_filter = -1;
+
+    std::mutex mut;
+    std::condition_variable work_cv, done_cv;
+    std::deque<std::function<std::string()>> jobs;
+    size_t pending = 0;
+    bool stopping = false;
+    std::string error;
+    std::vector<std::thread> threads;
+
+    // Frames take turns writing to the stream, in the order they were submitted
+    std::mutex stream_mut;
+    std::condition_variable stream_cv;
+    FILE* stream = nullptr;
+    size_t next_submit = 0, next_write = 0;
+};
@@ -0,0 +1,190 @@
+
+#include "json.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct Parser {
+    const char* at;
+    const char* begin;
+    std::string err;
+
+    bool fail(const std::string& msg) {
+        if(err.empty()) {
+            size_t line = 1;
+            for(const char* c = begin; c < at; c++) line += *c == '\n';
+            err = "Line " + std::to_string(line) + ": " + msg;
+        }
+        return false;
+    }
+
+    void skip() {
+        while(*at && std::isspace((unsigned char)*at)) at++;
+    }
+
+    bool literal(const char* word) {
+        size_t n = std::strlen(word);
+        if(std::strncmp(at, word, n)) return false;
+        at += n;
+        return true;
+    }
+
+    bool string(std::string& out) {
+        at++;
+        for(;;) {
+            char c = *at++;
+            if(!c) return fail("Unterminated string.");
+            if(c == '"') return true;
+            if(c != '\\') {
+                out += c;
+                continue;
+            }
+            switch(*at++) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                // Code points are re-encoded as UTF-8; surrogate pairs aren't joined
+                char hex[5] = {};
+                for(int i = 0; i < 4; i++) {
+                    if(!std::isxdigit((unsigned char)*at)) return fail("Bad \\u escape.");
+                    hex[i] = *at++;
+                }
+                unsigned long cp = std::strtoul(hex, nullptr, 16);
+                if(cp < 0x80) {
+                    out += (char)cp;
+                } else if(cp < 0x800) {
+                    out += (char)(0xc0 | (cp >> 6));
+                    out += (char)(0x80 | (cp & 0x3f));
+                } else {
+                    out += (char)(0xe0 | (cp >> 12));
+                    out += (char)(0x80 | ((cp >> 6) & 0x3f));
+                    out += (char)(0x80 | (cp & 0x3f));
+                }
+            } break;
+            default: return fail("Bad escape in string.");
+            }
+        }
+    }
+
+    bool value(Json& out, int depth) {
+
+        if(depth > 64) return fail("Nested too deeply.");
+        skip();
+
+        switch(*at) {
+        case '{': {
+            out.type = Json::Type::object;
+            at++;
+            skip();
+            if(*at == '}') {
+                at++;
+                return true;
+            }
+            for(;;) {
+                skip();
+                if(*at != '"') return fail("Expected a key.");
+                std::string key;
+                if(!string(key)) return false;
+                skip();
+                if(*at++ != ':') return fail("Expected ':' after \"" + key + "\".");
+                out.object.emplace_back(std::move(key), Json{});
+                if(!value(out.object.back().second, depth + 1)) return false;
+                skip();
+                if(*at == ',') {
+                    at++;
+                } else if(*at == '}') {
+                    at++;
+                    return true;
+                } else {
+                    return fail("Expected ',' or '}'.");
+                }
+            }
+        }
+        case '[': {
+            out.type = Json::Type::array;
+            at++;
+            skip();
+            if(*at == ']') {
+                at++;
+                return true;
+            }
+            for(;;) {
+                out.array.emplace_back();
+                if(!value(out.array.back(), depth + 1)) return false;
+                skip();
+                if(*at == ',') {
+                    at++;
+                } else if(*at == ']') {
+                    at++;
+                    return true;
+                } else {
+                    return fail("Expected ',' or ']'.");
+                }
+            }
+        }
+        case '"': out.type = Json::Type::string; return string(out.string);
+        default: break;
+        }
+
+        if(literal("true")) {
+            out.type = Json::Type::boolean;
+            out.boolean = true;
+            return true;
+        }
+        if(literal("false")) {
+            out.type = Json::Type::boolean;
+            return true;
+        }
+        if(literal("null")) {
+            out.type = Json::Type::null;
+            return true;
+        }
+
+        char* end = nullptr;
+        out.number = std::strtod(at, &end);
+        if(end == at) return fail("Unexpected character.");
+        out.type = Json::Type::number;
+        at = end;
+        return true;
+    }
+};
+
+} // namespace
+
+std::string Json::parse(const std::string& text, Json& out) {
+    Parser p{text.c_str(), text.c_str(), {}};
+    out = Json{};
+    if(!p.value(out, 0)) return p.err;
+    p.skip();
+    if(*p.at) {
+        p.fail("Unexpected text after the end.");
+        return p.err;
+    }
+    return {};
+}
+
+const Json* Json::find(const std::string& key) const {
+    for(const auto& [k, v] : object) {
+        if(k == key) return &v;
+    }
+    return nullptr;
+}
+
+double Json::get(const std::string& key, double fallback) const {
+    const Json* v = find(key);
+    return v && v->type == Type::number ? v->number : fallback;
+}
+
+std::string Json::get(const std::string& key, const std::string& fallback) const {
+    const Json* v = find(key);
+    return v && v->type == Type::string ? v->string : fallback;
+}
@@ -0,0 +1,26 @@
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON to read configuration files: a parsed value and lookups
+// that fall back to a default when a key is missing or has another type.
+struct Json {
+    enum class Type { null, boolean, number, string, array, object };
+
+    Type type = Type::null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> array;
+    std::vector<std::pair<std::string, Json>> object;
+
+    // Returns an error message with the line it happened on, or an empty string
+    static std::string parse(const std::string& text, Json& out);
+
+    const Json* find(const std::string& key) const;
+    double get(const std::string& key, double fallback) const;
+    std::string get(const std::string& key, const std::string& fallback) const;
+};
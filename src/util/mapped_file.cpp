@@ -0,0 +1,114 @@
+
+#include "mapped_file.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Mapped_File::~Mapped_File() {
+    close();
+}
+
+// Tries to map the file, leaving _data null if it can't
+#ifdef _WIN32
+
+static const unsigned char* map(const std::string& file, size_t& size, void*& mapping) {
+
+    HANDLE handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(handle == INVALID_HANDLE_VALUE) return nullptr;
+
+    LARGE_INTEGER bytes;
+    if(!GetFileSizeEx(handle, &bytes) || bytes.QuadPart == 0) {
+        CloseHandle(handle);
+        return nullptr;
+    }
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if(!mapping) return nullptr;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!view) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+        return nullptr;
+    }
+    size = (size_t)bytes.QuadPart;
+    return static_cast<const unsigned char*>(view);
+}
+
+#elif defined(MAPPED_FILE_POSIX)
+
+static const unsigned char* map(const std::string& file, size_t& size) {
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if(fd < 0) return nullptr;
+
+    struct stat info;
+    if(fstat(fd, &info) || info.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(view == MAP_FAILED) return nullptr;
+
+    // Readers go front to back, so let the kernel read ahead
+    posix_madvise(view, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+    size = (size_t)info.st_size;
+    return static_cast<const unsigned char*>(view);
+}
+
+#endif
+
+std::string Mapped_File::open(const std::string& file) {
+
+    close();
+
+#ifdef _WIN32
+    _data = map(file, _size, mapping);
+#elif defined(MAPPED_FILE_POSIX)
+    _data = map(file, _size);
+#endif
+    if(_data) {
+        mapped = true;
+        return {};
+    }
+
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if(!in.is_open()) return "Failed to open " + file + ".";
+    buffer.resize((size_t)in.tellg());
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if(!in.good()) return "Failed to read " + file + ".";
+
+    _data = buffer.data();
+    _size = buffer.size();
+    return {};
+}
+
+void Mapped_File::close() {
+    if(mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+        CloseHandle(mapping);
+        mapping = nullptr;
+#elif defined(MAPPED_FILE_POSIX)
+        munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+    }
+    buffer = {};
+    _data = nullptr;
+    _size = 0;
+    mapped = false;
+}
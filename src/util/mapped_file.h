@@ -0,0 +1,36 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A whole file mapped read-only into memory, so reading it costs no more than
+// the page faults that bring it in. Where mapping isn't supported, or fails,
+// the file is read into a buffer instead.
+class Mapped_File {
+public:
+    Mapped_File() = default;
+    ~Mapped_File();
+
+    Mapped_File(const Mapped_File& src) = delete;
+    Mapped_File& operator=(const Mapped_File& src) = delete;
+
+    std::string open(const std::string& file);
+    void close();
+
+    const unsigned char* data() const {
+        return _data;
+    }
+    size_t size() const {
+        return _size;
+    }
+
+private:
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+    bool mapped = false;
+    std::vector<unsigned char> buffer;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
@@ -32,4 +32,10 @@ void seed() {
     rng.seed(seed);
 }
 
+void seed(unsigned long long seed, unsigned long long stream) {
+    std::seed_seq seq{(unsigned int)seed, (unsigned int)(seed >> 32), (unsigned int)stream,
+                      (unsigned int)(stream >> 32)};
+    rng.seed(seq);
+}
+
 } // namespace RNG
@@ -16,4 +16,8 @@ bool coin_flip(float p = 0.5f);
 
 // Seed the current thread's PRNG
 void seed();
+
+// Seed the current thread's PRNG with a reproducible stream. Different streams
+// of the same seed are independent.
+void seed(unsigned long long seed, unsigned long long stream);
 } // namespace RNG
@@ -0,0 +1,88 @@
+
+#include "scratch_image.h"
+#include "hdr_image.h"
+#include "image_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Rows tonemapped at once when converting
+static const size_t band_rows = 64;
+
+Scratch_Image::~Scratch_Image() {
+    close();
+}
+
+std::string Scratch_Image::open(const std::string& p, size_t _w, size_t _h) {
+
+    close();
+    path = p;
+    w = _w;
+    h = _h;
+    err.clear();
+
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) return "Failed to create " + path + ".";
+
+    // Unwritten pixels read back as black
+    file.seekp((std::streamoff)(w * h * sizeof(Spectrum)) - 1);
+    file.put(0);
+    if(!file) {
+        close();
+        return "Not enough space for " + path + ".";
+    }
+    return {};
+}
+
+void Scratch_Image::close() {
+    if(!file.is_open()) return;
+    file.close();
+    std::remove(path.c_str());
+}
+
+void Scratch_Image::write(size_t x, size_t y, size_t rect_w, size_t rect_h,
+                          const std::vector<Spectrum>& pixels) {
+
+    std::lock_guard<std::mutex> lock(mut);
+    for(size_t j = 0; j < rect_h; j++) {
+        file.seekp((std::streamoff)(((y + j) * w + x) * sizeof(Spectrum)));
+        file.write(reinterpret_cast<const char*>(&pixels[j * rect_w]),
+                   rect_w * sizeof(Spectrum));
+    }
+    if(!file && err.empty()) err = "Failed to write to " + path + ".";
+}
+
+std::string Scratch_Image::error() {
+    std::lock_guard<std::mutex> lock(mut);
+    return err;
+}
+
+std::string Scratch_Image::write_png(const std::string& out, float exposure) {
+
+    std::lock_guard<std::mutex> lock(mut);
+    if(!err.empty()) return err;
+
+    PNG_Stream png;
+    std::string e = png.open(out, w, h);
+    if(!e.empty()) return e;
+
+    // Bands go from the top down, which is the bottom of the file up
+    std::vector<Spectrum> rows;
+    std::vector<unsigned char> data;
+    HDR_Image band;
+    for(size_t top = h; top > 0;) {
+
+        size_t n = std::min(band_rows, top);
+        top -= n;
+        rows.resize(n * w);
+        file.seekg((std::streamoff)(top * w * sizeof(Spectrum)));
+        file.read(reinterpret_cast<char*>(rows.data()), rows.size() * sizeof(Spectrum));
+        if(!file) return "Failed to read back " + path + ".";
+
+        if(band.dimension().second != n) band.resize(w, n);
+        for(size_t i = 0; i < n * w; i++) band.at(i) = rows[i];
+        band.tonemap_to(data, exposure);
+        png.write(data.data(), n);
+    }
+    return png.close();
+}
@@ -0,0 +1,39 @@
+
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../lib/spectrum.h"
+
+// An HDR image kept in a file instead of memory, for renders too big to hold
+// at once. Rectangles may be written from any thread as they finish; the image
+// is then read back a band of rows at a time to convert it.
+class Scratch_Image {
+public:
+    Scratch_Image() = default;
+    ~Scratch_Image();
+
+    Scratch_Image(const Scratch_Image& src) = delete;
+    Scratch_Image& operator=(const Scratch_Image& src) = delete;
+
+    std::string open(const std::string& path, size_t w, size_t h);
+    void close(); // and delete the file
+
+    // Pixels of the rectangle, row by row; row 0 is the bottom, as in HDR_Image
+    void write(size_t x, size_t y, size_t w, size_t h, const std::vector<Spectrum>& pixels);
+
+    // The first write that failed, if any
+    std::string error();
+
+    // Tonemaps to an uncompressed PNG, a band of rows at a time
+    std::string write_png(const std::string& path, float exposure);
+
+private:
+    std::mutex mut;
+    std::fstream file;
+    std::string path, err;
+    size_t w = 0, h = 0;
+};
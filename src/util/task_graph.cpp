@@ -0,0 +1,111 @@
+
+#include "task_graph.h"
+
+#include <cstdio>
+#include <thread>
+
+Task_Graph::Task_Graph(Thread_Pool& pool) : pool(pool) {
+}
+
+Task_Graph::Node Task_Graph::add(std::string name, std::function<void()> task,
+                                 const std::vector<Node>& after) {
+    Node node = nodes.size();
+    auto entry = std::make_unique<Entry>();
+    entry->task = std::move(task);
+    entry->timing.name = std::move(name);
+    entry->deps = after.size();
+    for(Node dep : after) {
+        assert(dep < node);
+        nodes[dep]->next.push_back(node);
+    }
+    nodes.push_back(std::move(entry));
+    return node;
+}
+
+double Task_Graph::now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void Task_Graph::run() {
+
+    if(nodes.empty()) return;
+
+    begin = std::chrono::steady_clock::now();
+    remaining = nodes.size();
+    for(auto& entry : nodes) entry->waiting = entry->deps;
+
+    for(Node node = 0; node < nodes.size(); node++) {
+        if(!nodes[node]->deps) pool.enqueue([this, node]() { execute(node); });
+    }
+
+    std::unique_lock<std::mutex> lock(mut);
+    done_cv.wait(lock, [this]() { return remaining == 0; });
+}
+
+void Task_Graph::execute(Node node) {
+
+    for(;;) {
+        Entry& entry = *nodes[node];
+        entry.timing.thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+        entry.timing.start = now();
+        entry.task();
+        entry.timing.end = now();
+
+        Node carry_on = nodes.size();
+        for(Node next : entry.next) {
+            if(--nodes[next]->waiting) continue;
+            if(carry_on == nodes.size()) {
+                carry_on = next;
+            } else {
+                pool.enqueue([this, next]() { execute(next); });
+            }
+        }
+
+        // Counted off under the lock, so run() can't return and take the graph
+        // with it until the last node is done touching it
+        bool stop = carry_on == nodes.size();
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            if(--remaining == 0) done_cv.notify_all();
+        }
+        if(stop) return;
+        node = carry_on;
+    }
+}
+
+std::vector<Task_Graph::Timing> Task_Graph::timings() const {
+    std::vector<Timing> ret;
+    for(const auto& entry : nodes) ret.push_back(entry->timing);
+    return ret;
+}
+
+std::string Task_Graph::write_trace(const std::string& path) const {
+
+    FILE* file = fopen(path.c_str(), "w");
+    if(!file) return "Failed to open " + path + " for writing.";
+
+    // Chrome wants small thread ids, so number them in order of appearance
+    std::vector<size_t> threads;
+    fprintf(file, "[\n");
+    for(size_t i = 0; i < nodes.size(); i++) {
+        const Timing& t = nodes[i]->timing;
+        size_t tid = 0;
+        while(tid < threads.size() && threads[tid] != t.thread) tid++;
+        if(tid == threads.size()) threads.push_back(t.thread);
+
+        std::string name;
+        for(char c : t.name) {
+            if(c == '"' || c == '\\') name += '\\';
+            name += c;
+        }
+        fprintf(file,
+                "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %zu, \"ts\": %.1f, "
+                "\"dur\": %.1f}%s\n",
+                name.c_str(), tid, t.start * 1e6, (t.end - t.start) * 1e6,
+                i + 1 < nodes.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+
+    if(fclose(file)) return "Failed to write " + path + ".";
+    return {};
+}
@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Tasks that run on a pool as soon as everything they depend on has finished.
+// Nodes are all added before run(), which starts the ones with nothing to wait
+// for. A finishing node carries straight on with one dependent it released and
+// enqueues the rest, so chains don't bounce through the queues.
+class Task_Graph {
+public:
+    using Node = size_t;
+
+    struct Timing {
+        std::string name;
+        double start = 0.0, end = 0.0; // seconds since run() began
+        size_t thread = 0;
+    };
+
+    Task_Graph(Thread_Pool& pool);
+
+    Task_Graph(const Task_Graph& src) = delete;
+    Task_Graph& operator=(const Task_Graph& src) = delete;
+
+    Node add(std::string name, std::function<void()> task, const std::vector<Node>& after = {});
+
+    // Blocks until every node has run; don't call from one of the pool's tasks
+    void run();
+
+    // From the last run(), in the order nodes were added
+    std::vector<Timing> timings() const;
+    // As a Chrome trace (chrome://tracing, Perfetto)
+    std::string write_trace(const std::string& path) const;
+
+private:
+    struct Entry {
+        std::function<void()> task;
+        std::vector<Node> next;
+        size_t deps = 0;
+        std::atomic<size_t> waiting{0};
+        Timing timing;
+    };
+
+    void execute(Node node);
+    double now() const;
+
+    Thread_Pool& pool;
+    std::vector<std::unique_ptr<Entry>> nodes;
+    std::chrono::steady_clock::time_point begin;
+
+    std::atomic<size_t> remaining{0};
+    std::mutex mut;
+    std::condition_variable done_cv;
+};
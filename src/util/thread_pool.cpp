@@ -1,72 +1,144 @@
 
 #include "thread_pool.h"
 #include "../util/rand.h"
+#include "affinity.h"
 
-Thread_Pool::Thread_Pool(size_t threads) {
-    start(threads);
+static std::atomic<size_t> n_default_threads{0};
+
+// Which pool, if any, the current thread works for
+static thread_local const Thread_Pool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+size_t Thread_Pool::default_threads() {
+    size_t n = n_default_threads;
+    return n ? n : std::max(1u, std::thread::hardware_concurrency());
 }
 
-Thread_Pool::~Thread_Pool() {
-    stop();
+void Thread_Pool::set_default_threads(size_t threads) {
+    n_default_threads = threads;
 }
 
-void Thread_Pool::start(size_t threads) {
-    n_threads = threads;
-    stop_now = false;
-    stop_when_done = false;
-    for(size_t i = 0; i < threads; i++)
-        workers.emplace_back([this] {
-            RNG::seed();
-            for(;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] {
-                        return this->stop_now || this->stop_when_done || !this->tasks.empty();
-                    });
-                    if(this->stop_now || (this->stop_when_done && this->tasks.empty())) return;
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-                task();
-            }
-        });
+Thread_Pool& Thread_Pool::shared() {
+    static Thread_Pool pool;
+    return pool;
 }
 
-void Thread_Pool::clear() {
+Thread_Pool::Thread_Pool(size_t threads) {
+    threads = std::max(threads, size_t(1));
+    for(size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Queue>());
+        queues.back()->node = Affinity::worker_node(i, threads);
+    }
+    for(size_t i = 0; i < threads; i++) workers.emplace_back([this, i]() { work(i); });
+}
+
+Thread_Pool::~Thread_Pool() {
     stop();
-    start(n_threads);
 }
 
-void Thread_Pool::wait() {
+size_t Thread_Pool::size() const {
+    return queues.size();
+}
+
+void Thread_Pool::push(std::function<void()>&& task) {
 
+    // Counted first, so a worker that takes it straight away can't count it off
+    // before it's counted on
+    pending++;
+    queued++;
+    size_t q = current_pool == this ? current_worker : next_queue++ % queues.size();
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop_when_done = true;
+        std::lock_guard<std::mutex> lock(queues[q]->mut);
+        queues[q]->tasks.push_back(std::move(task));
     }
 
-    condition.notify_all();
-    for(std::thread& worker : workers) {
-        worker.join();
+    // Taking the lock orders this with a worker deciding to sleep
+    { std::lock_guard<std::mutex> lock(sleep_mut); }
+    work_cv.notify_one();
+}
+
+bool Thread_Pool::pop(size_t worker, std::function<void()>& task) {
+
+    if(!queued) return false;
+
+    // Newest from our own queue, oldest from anyone else's. Workers on our
+    // own node come first, so tasks only cross nodes when one runs dry.
+    size_t node = queues[worker]->node;
+    for(int pass = 0; pass < 2; pass++) {
+        for(size_t k = 0; k < queues.size(); k++) {
+            Queue& q = *queues[(worker + k) % queues.size()];
+            if((q.node == node) != (pass == 0)) continue;
+            std::lock_guard<std::mutex> lock(q.mut);
+            if(q.tasks.empty()) continue;
+            if(k == 0) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
     }
-    workers.clear();
+    return false;
+}
+
+void Thread_Pool::work(size_t worker) {
+
+    RNG::seed();
+    Affinity::pin_worker(worker, queues.size());
+    current_pool = this;
+    current_worker = worker;
 
-    start(n_threads);
+    for(;;) {
+        std::function<void()> task;
+        if(pop(worker, task)) {
+            task();
+            task = nullptr;
+            if(--pending == 0) {
+                std::lock_guard<std::mutex> lock(sleep_mut);
+                idle_cv.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mut);
+        work_cv.wait(lock, [this]() { return stopping || queued > 0; });
+        if(stopping) return;
+    }
 }
 
-void Thread_Pool::stop() {
+void Thread_Pool::wait() {
+    assert(current_pool != this);
+    std::unique_lock<std::mutex> lock(sleep_mut);
+    idle_cv.wait(lock, [this]() { return pending == 0; });
+}
 
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop_now = true;
+void Thread_Pool::clear() {
+    size_t dropped = 0;
+    for(auto& q : queues) {
+        std::lock_guard<std::mutex> lock(q->mut);
+        dropped += q->tasks.size();
+        q->tasks.clear();
+    }
+    queued -= dropped;
+    if((pending -= dropped) == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mut);
+        idle_cv.notify_all();
     }
+    wait();
+}
 
-    condition.notify_all();
-    for(std::thread& worker : workers) {
-        worker.join();
+void Thread_Pool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mut);
+        stopping = true;
     }
+    work_cv.notify_all();
+    for(std::thread& worker : workers) worker.join();
     workers.clear();
-
-    std::queue<std::function<void()>> empty;
-    std::swap(tasks, empty);
+    for(auto& q : queues) q->tasks.clear();
+    queued = 0;
+    pending = 0;
 }
@@ -1,50 +1,138 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <condition_variable>
+#include <deque>
 #include <functional>
-#include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <vector>
 
 #include "../lib/log.h"
 
+// Hands out tokens for work that should stop early once it's no longer wanted.
+// cancel() moves on to a new generation, which every earlier token sees the
+// next time it's checked; later tokens start out fresh, so no flag is reset.
+class Cancel_Source {
+public:
+    class Token {
+    public:
+        Token() = default;
+        bool cancelled() const {
+            return source && source->generation.load(std::memory_order_relaxed) != generation;
+        }
+
+    private:
+        Token(const Cancel_Source* s, unsigned long long g) : source(s), generation(g) {
+        }
+        const Cancel_Source* source = nullptr;
+        unsigned long long generation = 0;
+        friend class Cancel_Source;
+    };
+
+    Token token() const {
+        return Token(this, generation.load());
+    }
+    void cancel() {
+        generation++;
+    }
+
+private:
+    std::atomic<unsigned long long> generation{0};
+};
+
+// Worker threads that live as long as the pool. Each has its own queue:
+// tasks enqueued from a worker go on that worker's queue, others are dealt
+// out in turn, and idle workers steal from the front of each other's queues.
+// With Affinity enabled, workers are pinned and steal within their node first.
 class Thread_Pool {
 public:
-    Thread_Pool(size_t threads);
+    Thread_Pool(size_t threads = default_threads());
     ~Thread_Pool();
 
-    void stop();
-    void wait();
-    void clear();
+    Thread_Pool(const Thread_Pool& src) = delete;
+    Thread_Pool& operator=(const Thread_Pool& src) = delete;
 
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args)
-        -> std::future<typename std::invoke_result<F, Args...>::type> {
+    // Thread count for pools that aren't given one, from --threads
+    static size_t default_threads();
+    static void set_default_threads(size_t threads);
 
-        using return_type = typename std::invoke_result<F, Args...>::type;
-        assert(!stop_now && !stop_when_done);
+    // For one-off parallel passes outside of any other pool
+    static Thread_Pool& shared();
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    size_t size() const;
 
-        std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks.emplace([task]() { (*task)(); });
-        }
-        condition.notify_one();
-        return res;
+    void stop();  // joins the workers; queued tasks are dropped
+    void wait();  // until every task has run; don't call from a task
+    void clear(); // drops queued tasks and waits for running ones
+
+    template<typename F> void enqueue(F&& f) {
+        assert(!stopping);
+        push(std::function<void()>(std::forward<F>(f)));
+    }
+
+    // Calls f(i) for every i in [begin, end), handing out grain indices at a
+    // time. The calling thread helps, so it's safe to call from a task.
+    template<typename F> void parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+
+        if(begin >= end) return;
+        grain = std::max(grain, size_t(1));
+        size_t chunks = (end - begin + grain - 1) / grain;
+
+        // Helpers that start after every chunk is taken only touch this, which
+        // they keep alive, so the caller can return as soon as the work is done.
+        struct Loop {
+            std::atomic<size_t> next{0}, done{0};
+            std::mutex mut;
+            std::condition_variable cv;
+        };
+        auto loop = std::make_shared<Loop>();
+        auto body = [&](size_t c) {
+            size_t lo = begin + c * grain, hi = std::min(end, lo + grain);
+            for(size_t i = lo; i < hi; i++) f(i);
+        };
+
+        auto run = [loop, chunks, body = &body]() {
+            for(size_t c; (c = loop->next++) < chunks;) {
+                (*body)(c);
+                if(++loop->done == chunks) {
+                    std::lock_guard<std::mutex> lock(loop->mut);
+                    loop->cv.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(chunks, size()) - 1;
+        for(size_t i = 0; i < helpers; i++) enqueue(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(loop->mut);
+        loop->cv.wait(lock, [&]() { return loop->done == chunks; });
     }
 
 private:
-    void start(size_t);
-    size_t n_threads;
-    bool stop_now = true;
-    bool stop_when_done = true;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
+    struct Queue {
+        std::mutex mut;
+        std::deque<std::function<void()>> tasks;
+        size_t node = 0; // NUMA node of its worker, if pinned
+    };
+
+    void push(std::function<void()>&& task);
+    bool pop(size_t worker, std::function<void()>& task);
+    void work(size_t worker);
+
+    std::vector<std::unique_ptr<Queue>> queues;
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+
+    std::atomic<size_t> queued{0};  // tasks waiting in queues
+    std::atomic<size_t> pending{0}; // tasks queued or running
+    std::atomic<size_t> next_queue{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex sleep_mut;
+    std::condition_variable work_cv, idle_cv;
 };
@@ -0,0 +1,183 @@
+// Checks Vec4 and Mat4 against double-precision references. CMake builds this
+// twice, once as configured (SSE on x86) and once with CARDINAL3D_SCALAR_MATH,
+// so both paths, and Mat4::inverse's 2x2-block and cofactor versions in
+// particular, are held to the same bounds.
+
+#include <array>
+#include <cstdio>
+#include <random>
+
+#include "lib/mathlib.h"
+
+using Mat4d = std::array<std::array<double, 4>, 4>;
+
+static Mat4d to_double(const Mat4& m) {
+    Mat4d r;
+    for(int c = 0; c < 4; c++)
+        for(int i = 0; i < 4; i++) r[c][i] = m[c][i];
+    return r;
+}
+
+// Gauss-Jordan with partial pivoting; false if m is singular
+static bool inverse(Mat4d m, Mat4d& inv) {
+    for(int c = 0; c < 4; c++)
+        for(int i = 0; i < 4; i++) inv[c][i] = c == i ? 1.0 : 0.0;
+    // Columns are stored, so eliminate on the transpose: inverse(M^T) = inverse(M)^T
+    for(int c = 0; c < 4; c++) {
+        int pivot = c;
+        for(int k = c + 1; k < 4; k++)
+            if(std::abs(m[k][c]) > std::abs(m[pivot][c])) pivot = k;
+        if(m[pivot][c] == 0.0) return false;
+        std::swap(m[c], m[pivot]);
+        std::swap(inv[c], inv[pivot]);
+        double s = 1.0 / m[c][c];
+        for(int i = 0; i < 4; i++) {
+            m[c][i] *= s;
+            inv[c][i] *= s;
+        }
+        for(int k = 0; k < 4; k++) {
+            if(k == c) continue;
+            double f = m[k][c];
+            for(int i = 0; i < 4; i++) {
+                m[k][i] -= f * m[c][i];
+                inv[k][i] -= f * inv[c][i];
+            }
+        }
+    }
+    return true;
+}
+
+// Largest entry of |a - b|, relative to the largest entry of b
+static double error(const Mat4& a, const Mat4d& b) {
+    double diff = 0.0, size = 0.0;
+    for(int c = 0; c < 4; c++)
+        for(int i = 0; i < 4; i++) {
+            diff = std::max(diff, std::abs(a[c][i] - b[c][i]));
+            size = std::max(size, std::abs(b[c][i]));
+        }
+    return diff / std::max(size, 1.0);
+}
+
+struct Check {
+    const char* name;
+    double bound;
+    double worst = 0.0;
+    void operator()(double err) {
+        worst = std::max(worst, err);
+    }
+    bool report() const {
+        bool ok = worst <= bound;
+        std::printf("%-24s max error %.3g (bound %.3g)%s\n", name, worst, bound,
+                    ok ? "" : "  FAILED");
+        return ok;
+    }
+};
+
+int main() {
+
+#ifdef CARDINAL3D_SSE
+    std::printf("Checking the SSE path\n");
+#else
+    std::printf("Checking the scalar path\n");
+#endif
+
+    std::mt19937 rng(248);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto rand_vec4 = [&]() { return Vec4{unit(rng), unit(rng), unit(rng), unit(rng)}; };
+    auto rand_vec3 = [&]() { return Vec3{unit(rng), unit(rng), unit(rng)}; };
+
+    Check inv_general{"inverse (general)", 1e-4};
+    Check inv_affine{"inverse (transforms)", 1e-5};
+    Check inv_identity{"M * inverse(M)", 1e-4};
+    Check mat_vec{"Mat4 * Vec4", 1e-6};
+    Check mat_mat{"Mat4 * Mat4", 1e-6};
+    Check point{"Mat4 * Vec3", 1e-5};
+    Check det{"det", 1e-5};
+    Check transpose{"transpose", 0.0};
+
+    for(int n = 0; n < 20000; n++) {
+
+        Mat4 m{rand_vec4(), rand_vec4(), rand_vec4(), rand_vec4()};
+        Mat4d md = to_double(m), inv_d;
+
+        // Only well-conditioned matrices: float can't promise much for the rest
+        if(inverse(md, inv_d) && std::abs(m.det()) > 0.05f) {
+            double cond = 0.0;
+            for(int c = 0; c < 4; c++)
+                for(int i = 0; i < 4; i++) cond = std::max(cond, std::abs(inv_d[c][i]));
+            if(cond < 20.0) {
+                Mat4 inv = m.inverse();
+                inv_general(error(inv, inv_d));
+                Mat4d I = to_double(Mat4::I);
+                inv_identity(error(m * inv, I));
+            }
+        }
+
+        // Rigid transforms with a scale, as objects are posed
+        Vec3 axis = rand_vec3();
+        if(axis.norm() > 0.1f) {
+            Mat4 t = Mat4::translate(rand_vec3() * 10.0f) *
+                     Mat4::rotate(unit(rng) * 180.0f, axis) * Mat4::scale(Vec3{1.5f} + rand_vec3());
+            Mat4d t_inv;
+            if(inverse(to_double(t), t_inv)) inv_affine(error(t.inverse(), t_inv));
+        }
+
+        Vec4 v = rand_vec4();
+        Vec4 mv = m * v;
+        for(int i = 0; i < 4; i++) {
+            double r = 0.0;
+            for(int c = 0; c < 4; c++) r += md[c][i] * v[c];
+            mat_vec(std::abs(mv[i] - r));
+        }
+
+        Mat4 o{rand_vec4(), rand_vec4(), rand_vec4(), rand_vec4()};
+        Mat4d prod;
+        for(int c = 0; c < 4; c++)
+            for(int i = 0; i < 4; i++) {
+                prod[c][i] = 0.0;
+                for(int k = 0; k < 4; k++) prod[c][i] += md[k][i] * o[c][k];
+            }
+        mat_mat(error(m * o, prod));
+
+        Vec3 p = rand_vec3();
+        Mat4 a = Mat4::translate(rand_vec3()) * Mat4::scale(Vec3{1.5f} + rand_vec3());
+        Vec3 ap = a * p;
+        for(int i = 0; i < 3; i++) {
+            double r = a[3][i];
+            for(int c = 0; c < 3; c++) r += (double)a[c][i] * p[c];
+            point(std::abs(ap[i] - r));
+        }
+
+        Mat4 mt = m.T();
+        for(int c = 0; c < 4; c++)
+            for(int i = 0; i < 4; i++) transpose(mt[c][i] != m[i][c]);
+
+        // Elimination's pivots multiply out to the determinant
+        double d = 1.0;
+        {
+            Mat4d lu = md;
+            for(int c = 0; c < 4 && d != 0.0; c++) {
+                int pivot = c;
+                for(int k = c + 1; k < 4; k++)
+                    if(std::abs(lu[k][c]) > std::abs(lu[pivot][c])) pivot = k;
+                if(pivot != c) {
+                    std::swap(lu[c], lu[pivot]);
+                    d = -d;
+                }
+                d *= lu[c][c];
+                if(lu[c][c] == 0.0) break;
+                for(int k = c + 1; k < 4; k++) {
+                    double f = lu[k][c] / lu[c][c];
+                    for(int i = c; i < 4; i++) lu[k][i] -= f * lu[c][i];
+                }
+            }
+        }
+        det(std::abs(m.det() - d));
+    }
+
+    bool ok = true;
+    for(const Check* c :
+        {&inv_general, &inv_affine, &inv_identity, &mat_vec, &mat_mat, &point, &det, &transpose})
+        ok = c->report() && ok;
+    return ok ? 0 : 1;
+}